@@ -0,0 +1,78 @@
+#pragma once
+
+/*
+Small helpers shared by the benchmark executables.
+
+This header replaces the global operator new/delete to count allocations, so
+it must only be included from the one translation unit holding main().
+*/
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+// gcc cannot see that the replaced operator new below pairs malloc with free
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+namespace bench {
+
+inline std::atomic<std::size_t> g_allocCount{0};
+inline std::atomic<std::size_t> g_allocBytes{0};
+
+struct AllocStats {
+    std::size_t count;
+    std::size_t bytes;
+};
+
+inline
+AllocStats allocSnapshot() {
+    return AllocStats{g_allocCount.load(std::memory_order_relaxed), g_allocBytes.load(std::memory_order_relaxed)};
+}
+
+inline
+AllocStats allocSince(const AllocStats& start) {
+    auto now = allocSnapshot();
+    return AllocStats{now.count - start.count, now.bytes - start.bytes};
+}
+
+class Timer {
+
+public:
+    Timer() : d_start(std::chrono::steady_clock::now()) {}
+
+    double elapsedNs() const {
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - d_start).count();
+    }
+
+    private:
+    std::chrono::steady_clock::time_point d_start;
+};
+
+// stops the optimizer from throwing away a result we only compute for timing
+template <typename T>
+inline void doNotOptimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+} // namespace bench
+
+void* operator new(std::size_t size) {
+    bench::g_allocCount.fetch_add(1, std::memory_order_relaxed);
+    bench::g_allocBytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(size ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
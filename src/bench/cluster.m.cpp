@@ -0,0 +1,242 @@
+#include "benchutils.h"
+#include "server.h"
+#include "hashring.h"
+#include "spdlog/spdlog.h"
+
+#include <csignal>
+#include <string>
+#include <vector>
+#include <zmq.hpp>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/*
+Usage: ./bench_cluster [rooms (default 64)] [members per room (default 8)] [messages per room (default 1000)]
+
+Runs a cluster of 1, 2 and 4 single threaded server processes and reports the
+total chat messages delivered per second. Clients connect to the nodes round
+robin, so most members reach their room through a node that does not own it
+and every delivery to them crosses the peer links. The clients are split over
+as many processes as there are nodes so the client side scales with them.
+*/
+
+namespace {
+
+struct BenchConfig {
+    std::size_t rooms = 64;
+    std::size_t members = 8;
+    std::size_t messages = 1000;
+};
+
+std::string roomName(std::size_t room) {
+    return "room-" + std::to_string(room);
+}
+
+void sendMessage(zmq::socket_t& socket, const ClientBaseMessage& message) {
+    auto serialized = serialize_clientbasemsg(message);
+    zmq::message_t msg(*serialized);
+    socket.send(msg, zmq::send_flags::none);
+}
+
+bool awaitAccepted(zmq::socket_t& socket) {
+    zmq::message_t reply;
+    if (!socket.recv(reply, zmq::recv_flags::none).has_value()) {
+        return false;
+    }
+    auto response = deserialize_serverbasemsg(reply.to_string_view());
+    if (!response.has_value()) {
+        return false;
+    }
+    if (const auto* created = std::get_if<ServerCreateRoomResponse>(&response->payload)) {
+        return created->accepted;
+    }
+    if (const auto* connected = std::get_if<ServerConnectionResponse>(&response->payload)) {
+        return connected->accepted;
+    }
+    return false;
+}
+
+void runServer(const std::vector<std::string>& addresses, const std::vector<std::string>& peers, std::size_t node) {
+    ServerConfig config;
+    config.sessionTimeout = std::chrono::milliseconds(0);
+    config.clusterNodes = peers;
+    config.clusterSelf = node;
+    Server server(addresses[node], config);
+    server.run();
+}
+
+// runs the rooms assigned to this process, the first member creates the room and sends, the rest count
+std::size_t runClients(const BenchConfig& config, const std::vector<std::string>& addresses, std::size_t process,
+                       int readyFd, int goFd) {
+    zmq::context_t context(1);
+    context.set(zmq::ctxopt::max_sockets, static_cast<int>(config.rooms * config.members + 16));
+
+    std::vector<zmq::socket_t> senders;
+    std::vector<std::string> senderRooms;
+    std::vector<zmq::socket_t> receivers;
+    for (std::size_t room = process; room < config.rooms; room += addresses.size()) {
+        for (std::size_t member = 0; member < config.members; ++member) {
+            std::string id = roomName(room) + "-" + std::to_string(member);
+            zmq::socket_t dealer(context, ZMQ_DEALER);
+            dealer.set(zmq::sockopt::routing_id, id);
+            dealer.set(zmq::sockopt::linger, 0);
+            dealer.set(zmq::sockopt::rcvhwm, 0);
+            dealer.connect(addresses[(room + member) % addresses.size()]);
+
+            if (member == 0) {
+                sendMessage(dealer, ClientBaseMessage{id, ClientCreateRoomRequest{roomName(room)}});
+            } else {
+                sendMessage(dealer, ClientBaseMessage{id, ClientConnectionRequest{roomName(room), std::nullopt}});
+            }
+            if (!awaitAccepted(dealer)) {
+                // still report ready so the parent does not wait on us forever
+                char byte = 0;
+                [[maybe_unused]] auto written = write(readyFd, &byte, 1);
+                return 0;
+            }
+            if (member == 0) {
+                senderRooms.push_back(roomName(room));
+            }
+            (member == 0 ? senders : receivers).push_back(std::move(dealer));
+        }
+    }
+
+    char byte = 0;
+    if (write(readyFd, &byte, 1) != 1 || read(goFd, &byte, 1) != 1) {
+        return 0;
+    }
+
+    for (std::size_t i = 0; i < senders.size(); ++i) {
+        auto& sender = senders[i];
+        ClientBaseMessage chat{sender.get(zmq::sockopt::routing_id), ClientChatMessage{senderRooms[i], std::string(64, 'x')}};
+        for (std::size_t n = 0; n < config.messages; ++n) {
+            sendMessage(sender, chat);
+        }
+    }
+
+    std::vector<zmq::pollitem_t> items;
+    for (auto& receiver : receivers) {
+        items.push_back({receiver.handle(), 0, ZMQ_POLLIN, 0});
+    }
+
+    // stop once everything arrived or nothing has for a second
+    std::size_t delivered = 0;
+    std::size_t expected = receivers.size() * config.messages;
+    while (delivered < expected && zmq::poll(items.data(), items.size(), std::chrono::milliseconds(1000)) > 0) {
+        for (std::size_t i = 0; i < items.size(); ++i) {
+            if (!(items[i].revents & ZMQ_POLLIN)) {
+                continue;
+            }
+            zmq::message_t msg;
+            while (receivers[i].recv(msg, zmq::recv_flags::dontwait).has_value()) {
+                ++delivered;
+            }
+        }
+    }
+    return delivered;
+}
+
+} // namespace
+
+int main(int argc, const char *argv[]){
+
+    spdlog::set_level(spdlog::level::off);
+
+    BenchConfig config;
+    config.rooms = argc > 1 ? std::stoul(argv[1]) : config.rooms;
+    config.members = argc > 2 ? std::stoul(argv[2]) : config.members;
+    config.messages = argc > 3 ? std::stoul(argv[3]) : config.messages;
+
+    std::printf("%6s %12s %12s %14s %12s %14s\n",
+                "nodes", "remote %", "delivered", "expected", "wall ms", "msgs/s");
+
+    int port = 19500;
+    for (std::size_t nodes : {1, 2, 4}) {
+        std::vector<std::string> addresses;
+        std::vector<std::string> peers;
+        for (std::size_t n = 0; n < nodes; ++n) {
+            addresses.push_back("tcp://127.0.0.1:" + std::to_string(port++));
+            peers.push_back("tcp://127.0.0.1:" + std::to_string(port++));
+        }
+
+        // share of members connected to a node other than the one owning their room
+        HashRing ring(peers);
+        std::size_t remote = 0;
+        for (std::size_t room = 0; room < config.rooms; ++room) {
+            for (std::size_t member = 1; member < config.members; ++member) {
+                remote += (room + member) % nodes != ring.owner(roomName(room));
+            }
+        }
+
+        // nothing in this process touches zmq, so every fork starts clean
+        std::vector<pid_t> servers;
+        for (std::size_t n = 0; n < nodes; ++n) {
+            pid_t child = fork();
+            if (child == 0) {
+                runServer(addresses, peers, n);
+                _exit(0);
+            }
+            servers.push_back(child);
+        }
+
+        int ready[2];
+        int go[2];
+        int done[2];
+        if (pipe(ready) != 0 || pipe(go) != 0 || pipe(done) != 0) {
+            return 1;
+        }
+
+        std::vector<pid_t> clients;
+        for (std::size_t p = 0; p < nodes; ++p) {
+            pid_t child = fork();
+            if (child == 0) {
+                auto delivered = runClients(config, addresses, p, ready[1], go[0]);
+                auto written = write(done[1], &delivered, sizeof(delivered));
+                _exit(written == sizeof(delivered) ? 0 : 1);
+            }
+            clients.push_back(child);
+        }
+
+        char byte = 0;
+        std::size_t readyCount = 0;
+        while (readyCount < nodes && read(ready[0], &byte, 1) == 1) {
+            ++readyCount;
+        }
+
+        bench::Timer timer;
+        for (std::size_t p = 0; p < nodes; ++p) {
+            if (write(go[1], &byte, 1) != 1) {
+                return 1;
+            }
+        }
+
+        std::size_t delivered = 0;
+        for (std::size_t p = 0; p < nodes; ++p) {
+            std::size_t count = 0;
+            if (read(done[0], &count, sizeof(count)) == sizeof(count)) {
+                delivered += count;
+            }
+        }
+        // includes the clients' one second wait for stragglers when messages were lost
+        double wall = timer.elapsedNs();
+
+        for (auto pid : clients) {
+            waitpid(pid, nullptr, 0);
+        }
+        for (auto pid : servers) {
+            kill(pid, SIGKILL);
+            waitpid(pid, nullptr, 0);
+        }
+        for (int fd : {ready[0], ready[1], go[0], go[1], done[0], done[1]}) {
+            close(fd);
+        }
+
+        std::size_t expected = config.rooms * (config.members - 1) * config.messages;
+        double members = static_cast<double>(config.rooms * (config.members - 1));
+        std::printf("%6zu %12.1f %12zu %14zu %12.1f %14.0f\n",
+                    nodes, members > 0 ? 100.0 * remote / members : 0.0, delivered, expected,
+                    wall / 1e6, wall > 0 ? delivered / (wall / 1e9) : 0.0);
+    }
+
+    return 0;
+}
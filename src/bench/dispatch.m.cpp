@@ -0,0 +1,152 @@
+#include "benchutils.h"
+#include "registry.h"
+
+#include <random>
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <unordered_map>
+
+/*
+Usage: ./bench_dispatch [clients (default 100000)] [room size (default 50)]
+
+Compares the per chat message dispatch cost of the string keyed server state
+(d_clients / d_clientData / d_rooms / Room::clients keyed by client id) with
+the interned handles it was replaced by. Each message does the validity checks,
+resolves the sender's room, checks membership and walks the room's members
+the way a fan-out would.
+*/
+
+namespace {
+
+// the server state as it was before interning
+struct StringState {
+    struct Client {
+        std::string room;
+    };
+    struct Room {
+        std::unordered_set<std::string> clients;
+    };
+
+    std::unordered_set<std::string> clients;
+    std::unordered_map<std::string, Client> clientData;
+    std::unordered_map<std::string, Room> rooms;
+
+    std::size_t dispatch(const std::string& senderId) {
+        if (!(clients.contains(senderId) && clientData.contains(senderId) &&
+              rooms.contains(clientData[senderId].room))) {
+            return 0;
+        }
+
+        auto roomId = clientData[senderId].room;
+        auto& room = rooms[roomId];
+        if (!room.clients.contains(senderId)) {
+            return 0;
+        }
+
+        std::size_t routed = 0;
+        for (const auto& client : room.clients) {
+            if (client == senderId) {
+                continue;
+            }
+            routed += client.size();
+        }
+        return routed;
+    }
+};
+
+// the interned state the server uses now
+struct HandleState {
+    struct Client {
+        RoomHandle room = k_invalidHandle;
+    };
+
+    IdRegistry clients;
+    std::vector<Client> clientData;
+    IdRegistry roomIds;
+    std::unordered_map<RoomHandle, MemberSet> rooms;
+
+    std::size_t dispatch(const std::string& senderId) {
+        auto client = clients.find(senderId);
+        if (!client.has_value() || clientData[*client].room == k_invalidHandle) {
+            return 0;
+        }
+
+        auto& members = rooms[clientData[*client].room];
+        if (!members.contains(*client)) {
+            return 0;
+        }
+
+        std::size_t routed = 0;
+        for (auto member : members) {
+            if (member == *client) {
+                continue;
+            }
+            // sending resolves the routing id from the handle
+            routed += clients.name(member).size();
+        }
+        return routed;
+    }
+};
+
+template <typename State>
+double timeDispatch(State& state, const std::vector<std::string>& senders) {
+    std::size_t routed = 0;
+    bench::Timer timer;
+    for (const auto& sender : senders) {
+        routed += state.dispatch(sender);
+    }
+    auto ns = timer.elapsedNs();
+    bench::doNotOptimize(routed);
+    return ns / senders.size();
+}
+
+} // namespace
+
+int main(int argc, const char *argv[]){
+
+    std::size_t clientCount = argc > 1 ? std::stoul(argv[1]) : 100000;
+    std::size_t roomSize = argc > 2 ? std::stoul(argv[2]) : 50;
+    std::size_t roomCount = (clientCount + roomSize - 1) / roomSize;
+    const std::size_t messages = 1000000;
+
+    StringState strings;
+    HandleState handles;
+
+    char name[32];
+    for (std::size_t i = 0; i < roomCount; ++i) {
+        std::snprintf(name, sizeof(name), "room-%010zu", i);
+        strings.rooms[name];
+        handles.rooms[handles.roomIds.intern(name)];
+    }
+
+    std::vector<std::string> ids;
+    for (std::size_t i = 0; i < clientCount; ++i) {
+        std::snprintf(name, sizeof(name), "client-%010zu", i);
+        ids.push_back(name);
+
+        std::snprintf(name, sizeof(name), "room-%010zu", i % roomCount);
+        strings.clients.insert(ids.back());
+        strings.clientData[ids.back()].room = name;
+        strings.rooms[name].clients.insert(ids.back());
+
+        auto client = handles.clients.intern(ids.back());
+        auto room = *handles.roomIds.find(name);
+        handles.clientData.push_back(HandleState::Client{room});
+        handles.rooms[room].insert(client);
+    }
+
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<std::size_t> pick(0, clientCount - 1);
+    std::vector<std::string> senders;
+    senders.reserve(messages);
+    for (std::size_t i = 0; i < messages; ++i) {
+        senders.push_back(ids[pick(rng)]);
+    }
+
+    std::printf("%zu clients, %zu rooms of %zu, %zu messages\n", clientCount, roomCount, roomSize, messages);
+    std::printf("string keyed:     %8.1f ns/message\n", timeDispatch(strings, senders));
+    std::printf("interned handles: %8.1f ns/message\n", timeDispatch(handles, senders));
+
+    return 0;
+}
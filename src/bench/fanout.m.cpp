@@ -0,0 +1,77 @@
+#include "benchutils.h"
+#include "roomshard.h"
+#include "spdlog/spdlog.h"
+
+#include <string>
+#include <vector>
+
+/*
+Measures RoomShard::broadcastMessage fan-out as the room grows.
+
+For each room size we broadcast a fixed chat message and report, per broadcast:
+- time, and time per delivered message
+- C++ heap allocations and bytes allocated
+- payload bytes copied (deliveries whose buffer is not the shared payload)
+*/
+
+int main(int argc, const char *argv[]){
+
+    spdlog::set_level(spdlog::level::off);
+
+    const std::vector<std::size_t> roomSizes = {10, 100, 1000, 10000};
+    const std::size_t iterations = 1000;
+    const std::string text(256, 'x');
+
+    std::printf("%10s %14s %14s %12s %14s %14s\n",
+                "members", "ns/broadcast", "ns/delivery", "allocs/bc", "alloc B/bc", "copied B/bc");
+
+    for (auto members : roomSizes) {
+        std::size_t deliveries = 0;
+        std::size_t bytesCopied = 0;
+        const void* sharedBuffer = nullptr;
+
+        RoomShard shard([&](ClientHandle client, zmq::message_t&& payload, OutboundKind) {
+            ++deliveries;
+            if (sharedBuffer == nullptr) {
+                sharedBuffer = payload.data();
+            } else if (payload.data() != sharedBuffer) {
+                bytesCopied += payload.size();
+            }
+        });
+
+        RoomTask create{RoomTask::Type::e_CREATE, k_invalidHandle, 0};
+        create.roomId = "bench";
+        shard.process(create);
+        for (ClientHandle client = 0; client < members; ++client) {
+            shard.process(RoomTask{RoomTask::Type::e_JOIN, client, 0});
+        }
+
+        RoomTask chat{RoomTask::Type::e_CHAT, 0, 0};
+        chat.clientId = "client-0";
+        chat.message = text;
+
+        deliveries = 0;
+        bench::AllocStats allocs{0, 0};
+        double totalNs = 0;
+        for (std::size_t i = 0; i < iterations; ++i) {
+            sharedBuffer = nullptr;
+            auto start = bench::allocSnapshot();
+            bench::Timer timer;
+            shard.process(chat);
+            totalNs += timer.elapsedNs();
+            auto used = bench::allocSince(start);
+            allocs.count += used.count;
+            allocs.bytes += used.bytes;
+        }
+
+        std::printf("%10zu %14.0f %14.1f %12.2f %14.1f %14.1f\n",
+                    members,
+                    totalNs / iterations,
+                    totalNs / deliveries,
+                    static_cast<double>(allocs.count) / iterations,
+                    static_cast<double>(allocs.bytes) / iterations,
+                    static_cast<double>(bytesCopied) / iterations);
+    }
+
+    return 0;
+}
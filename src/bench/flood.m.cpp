@@ -0,0 +1,173 @@
+#include "benchutils.h"
+#include "server.h"
+#include "spdlog/spdlog.h"
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <zmq.hpp>
+
+/*
+Usage: ./bench_flood [room members (default 100)] [seconds per run (default 3)]
+
+Runs a server on loopback with a room of listening members, one client
+flooding chat into the room as fast as it can and one "steady" client saying
+something every 10ms. Reports, without and with a per client rate limit, how
+many of the flooder's messages got fanned out, what the server sent in total
+and how late the steady client's messages reached a member (p50/p99), i.e.
+how much one flooding client costs everyone else in its room.
+*/
+
+namespace {
+
+struct Mode {
+    const char* name;
+    RateLimitConfig rateLimit;
+};
+
+void sendMessage(zmq::socket_t& socket, const ClientBaseMessage& message) {
+    auto serialized = serialize_clientbasemsg(message);
+    zmq::message_t msg(*serialized);
+    socket.send(msg, zmq::send_flags::none);
+}
+
+// connects a dealer as id and joins general, waiting for the server to accept
+zmq::socket_t joinGeneral(zmq::context_t& context, const std::string& address, const std::string& id) {
+    zmq::socket_t dealer(context, ZMQ_DEALER);
+    dealer.set(zmq::sockopt::routing_id, id);
+    dealer.set(zmq::sockopt::linger, 0);
+    dealer.set(zmq::sockopt::rcvhwm, 0);
+    dealer.connect(address);
+
+    sendMessage(dealer, ClientBaseMessage{id, ClientConnectionRequest{"general", std::nullopt}});
+    zmq::message_t reply;
+    auto res = dealer.recv(reply, zmq::recv_flags::none);
+    bench::doNotOptimize(res);
+    return dealer;
+}
+
+std::int64_t steadyNowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+} // namespace
+
+int main(int argc, const char *argv[]){
+
+    spdlog::set_level(spdlog::level::err);
+
+    std::size_t members = argc > 1 ? std::stoul(argv[1]) : 100;
+    auto runFor = std::chrono::seconds(argc > 2 ? std::stoul(argv[2]) : 3);
+
+    const std::vector<Mode> modes = {
+        {"unlimited", RateLimitConfig{}},
+        {"100 msg/s", RateLimitConfig{100, 0, 2, true}},
+        {"20 msg/s", RateLimitConfig{20, 0, 2, true}},
+    };
+
+    std::printf("%12s %14s %14s %14s %12s %12s\n", "limit", "flood sent", "flood fanned", "server sent", "p50 ms", "p99 ms");
+
+    int port = 18900;
+    for (const auto& mode : modes) {
+        auto address = "tcp://127.0.0.1:" + std::to_string(port++);
+
+        ServerConfig config;
+        config.sessionTimeout = std::chrono::milliseconds(0);
+        config.rateLimit = mode.rateLimit;
+        Server server(address, config);
+        server.createRoom("general");
+        std::thread serverThread(&Server::run, &server);
+
+        zmq::context_t context(1);
+        auto watcher = joinGeneral(context, address, "watcher");
+        std::vector<zmq::socket_t> listeners;
+        for (std::size_t i = 1; i < members; ++i) {
+            listeners.push_back(joinGeneral(context, address, "member-" + std::to_string(i)));
+        }
+        auto flooder = joinGeneral(context, address, "flooder");
+        auto steady = joinGeneral(context, address, "steady");
+
+        std::atomic_bool done(false);
+
+        // keeps the other members reading so the server is never held up by them
+        std::thread drainThread([&] {
+            std::vector<zmq::pollitem_t> items;
+            for (auto& listener : listeners) {
+                items.push_back({listener.handle(), 0, ZMQ_POLLIN, 0});
+            }
+            while (!done) {
+                zmq::poll(items.data(), items.size(), std::chrono::milliseconds(10));
+                for (auto& listener : listeners) {
+                    zmq::message_t msg;
+                    while (listener.recv(msg, zmq::recv_flags::dontwait).has_value()) {
+                    }
+                }
+            }
+        });
+
+        std::size_t floodSent = 0;
+        std::thread floodThread([&] {
+            auto serialized = *serialize_clientbasemsg(
+                ClientBaseMessage{"flooder", ClientChatMessage{"general", std::string(64, 'x')}});
+            while (!done) {
+                zmq::message_t msg(serialized.data(), serialized.size());
+                if (flooder.send(msg, zmq::send_flags::dontwait).has_value()) {
+                    ++floodSent;
+                }
+            }
+        });
+
+        std::thread steadyThread([&] {
+            while (!done) {
+                sendMessage(steady, ClientBaseMessage{"steady", ClientChatMessage{"general", std::to_string(steadyNowNs())}});
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+        });
+
+        // the watcher is one of the members, it times the steady client's messages and counts the flood
+        std::size_t floodFanned = 0;
+        std::vector<double> latenciesMs;
+        auto end = std::chrono::steady_clock::now() + runFor;
+        watcher.set(zmq::sockopt::rcvtimeo, 100);
+        while (std::chrono::steady_clock::now() < end) {
+            zmq::message_t msg;
+            if (!watcher.recv(msg, zmq::recv_flags::none).has_value()) {
+                continue;
+            }
+            auto baseMessage = deserialize_serverbasemsg(msg.to_string_view());
+            if (!baseMessage.has_value() || !std::holds_alternative<ServerRoomChatMessage>(baseMessage->payload)) {
+                continue;
+            }
+            const auto& chat = std::get<ServerRoomChatMessage>(baseMessage->payload).message;
+            if (chat.senderId == "flooder") {
+                ++floodFanned;
+            } else if (chat.senderId == "steady") {
+                latenciesMs.push_back((steadyNowNs() - std::stoll(chat.message)) / 1e6);
+            }
+        }
+
+        done = true;
+        floodThread.join();
+        steadyThread.join();
+        drainThread.join();
+        server.stop();
+        serverThread.join();
+
+        std::uint64_t serverSent = 0;
+        for (const auto& [client, stats] : server.outboundQueueStats()) {
+            serverSent += stats.sent;
+        }
+
+        std::sort(latenciesMs.begin(), latenciesMs.end());
+        auto percentile = [&latenciesMs](std::size_t p) {
+            return latenciesMs.empty() ? 0.0 : latenciesMs[std::min(latenciesMs.size() - 1, latenciesMs.size() * p / 100)];
+        };
+        std::printf("%12s %14zu %14zu %14lu %12.2f %12.2f\n", mode.name, floodSent, floodFanned,
+                    static_cast<unsigned long>(serverSent), percentile(50), percentile(99));
+    }
+
+    return 0;
+}
@@ -0,0 +1,113 @@
+#include "benchutils.h"
+#include "roomshard.h"
+#include "spdlog/spdlog.h"
+
+#include <string>
+#include <vector>
+
+/*
+Usage: ./bench_joinstorm [clients per storm (default 1000)]
+
+Measures a join storm, every client of a room rejoining at once (e.g. after a
+network blip), for join history tails of 10 to 500 messages. Per join we report
+time, C++ heap allocations and bytes allocated for:
+- reserialize: the whole response serialized from a copy of the history, as
+  every join used to be
+- cached:      RoomShard joins with nothing said in between, all but the first
+  share the room's cached response
+- spliced:     RoomShard joins with a chat message before each one, so every
+  join builds a new response from the history's cached message encodings
+*/
+
+namespace {
+
+struct JoinStats {
+    double ns = 0;
+    double allocs = 0;
+    double allocBytes = 0;
+};
+
+// runs join once per client, timing only the joins
+template <typename Join, typename Between>
+JoinStats measure(std::size_t clients, Join&& join, Between&& between) {
+    JoinStats stats;
+    for (std::size_t client = 0; client < clients; ++client) {
+        between();
+        auto start = bench::allocSnapshot();
+        bench::Timer timer;
+        join(client);
+        stats.ns += timer.elapsedNs();
+        auto used = bench::allocSince(start);
+        stats.allocs += used.count;
+        stats.allocBytes += used.bytes;
+    }
+    stats.ns /= clients;
+    stats.allocs /= clients;
+    stats.allocBytes /= clients;
+    return stats;
+}
+
+void printRow(const char* mode, std::size_t tail, std::size_t bytes, const JoinStats& stats) {
+    std::printf("%12s %8zu %12zu %12.0f %10.2f %12.0f\n", mode, tail, bytes, stats.ns, stats.allocs, stats.allocBytes);
+}
+
+} // namespace
+
+int main(int argc, const char *argv[]){
+
+    spdlog::set_level(spdlog::level::off);
+
+    std::size_t clients = argc > 1 ? std::stoul(argv[1]) : 1000;
+    const std::vector<std::size_t> tails = {10, 50, 200, 500};
+
+    std::printf("%12s %8s %12s %12s %10s %12s\n", "mode", "tail", "bytes", "ns/join", "al/join", "alloc B/join");
+
+    for (auto tail : tails) {
+        std::size_t responseBytes = 0;
+        RoomShard shard([&](ClientHandle, zmq::message_t&& payload, OutboundKind) {
+            responseBytes = payload.size();
+        });
+
+        RoomTask create{RoomTask::Type::e_CREATE, k_invalidHandle, 0};
+        create.roomId = "bench";
+        shard.process(create);
+
+        // the speaker, its messages fill the history
+        ClientHandle speaker = clients;
+        shard.process(RoomTask{RoomTask::Type::e_JOIN, speaker, 0});
+        RoomTask chat{RoomTask::Type::e_CHAT, speaker, 0};
+        chat.clientId = "client-speaker";
+        chat.message = std::string(64, 'x');
+        for (std::size_t i = 0; i < HistoryRetention{}.maxMessages; ++i) {
+            shard.process(chat);
+        }
+
+        auto join = [&](std::size_t client) {
+            RoomTask task{RoomTask::Type::e_JOIN, static_cast<ClientHandle>(client), 0};
+            task.count = tail;
+            shard.process(task);
+        };
+        auto nothing = [] {};
+        auto speak = [&] { shard.process(chat); };
+
+        // the same room contents, serialized whole the way every join used to be
+        RoomHistory history;
+        for (std::size_t i = 0; i < HistoryRetention{}.maxMessages; ++i) {
+            history.push(chat.clientId, chat.message, i);
+        }
+        auto reserialize = measure(clients, [&](std::size_t) {
+            auto messages = history.tail(tail);
+            auto start = history.nextSequence() - messages.size();
+            ServerBaseMessage message{ServerConnectionResponse{"bench", true, std::nullopt, std::move(messages), start, std::nullopt}};
+            bench::doNotOptimize(serialize_serverbasemsg(message));
+        }, nothing);
+        auto cached = measure(clients, join, nothing);
+        auto spliced = measure(clients, join, speak);
+
+        printRow("reserialize", tail, responseBytes, reserialize);
+        printRow("cached", tail, responseBytes, cached);
+        printRow("spliced", tail, responseBytes, spliced);
+    }
+
+    return 0;
+}
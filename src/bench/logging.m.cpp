@@ -0,0 +1,78 @@
+#include "benchutils.h"
+#include "logging.h"
+#include "spdlog/spdlog.h"
+#include "spdlog/sinks/basic_file_sink.h"
+
+#include <string>
+#include <vector>
+
+/*
+Usage: ./bench_logging [messages (default 1000000)] [log file (default bench_logging.log)]
+
+Logs the server's "Received message" record once per chat message the way the
+chat handler does, and reports the handler side cost per message for each
+logging setup. The sink writes to a file and flushes every record, about what a
+terminal costs, so a synchronous logger caps the message rate at the sink's.
+Logged is what reached the file, the rest was sampled out or dropped because
+the queue was full. Every mode but default logs every chat record.
+*/
+
+namespace {
+
+struct Mode {
+    const char* name;
+    LogConfig config;
+};
+
+LogConfig asyncConfig(LogOverflow overflow, LogSampling chat = {}) {
+    LogConfig config;
+    config.overflow = overflow;
+    config.sampling[static_cast<std::size_t>(LogCategory::e_CHAT)] = chat;
+    return config;
+}
+
+} // namespace
+
+int main(int argc, const char *argv[]){
+
+    std::size_t messages = argc > 1 ? std::stoul(argv[1]) : 1000000;
+    std::string path = argc > 2 ? argv[2] : "bench_logging.log";
+
+    LogConfig sync;
+    sync.async = false;
+    sync.sampling[static_cast<std::size_t>(LogCategory::e_CHAT)] = LogSampling{};
+    const std::vector<Mode> modes = {
+        {"sync", sync},
+        {"block", asyncConfig(LogOverflow::e_BLOCK)},
+        {"drop-new", asyncConfig(LogOverflow::e_DROP_NEW)},
+        {"default", LogConfig{}},
+        {"rate 1000/s", asyncConfig(LogOverflow::e_DROP_NEW, LogSampling{1, 1000})},
+    };
+
+    std::printf("%14s %10s %14s %12s %12s %12s\n", "mode", "ns/msg", "msgs/s", "logged", "sampled out", "dropped");
+
+    const std::string senderId = "client-bench";
+    const std::string chatMessage(64, 'x');
+    for (const auto& mode : modes) {
+        auto sink = std::make_shared<spdlog::sinks::basic_file_sink_mt>(path, true);
+        setupLogging(mode.config, sink);
+        spdlog::set_level(spdlog::level::info);
+        spdlog::flush_on(spdlog::level::info);
+
+        bench::Timer timer;
+        for (std::size_t n = 0; n < messages; ++n) {
+            logSampled(LogCategory::e_CHAT, spdlog::level::info, "Received message: [{}] {}", senderId, chatMessage);
+        }
+        double ns = timer.elapsedNs();
+        auto stats = logStats();
+
+        // waits for the writer to finish before the next mode truncates the file
+        shutdownLogging();
+
+        std::printf("%14s %10.1f %14.0f %12zu %12zu %12zu\n", mode.name, ns / messages, messages / (ns / 1e9),
+                    static_cast<std::size_t>(messages - stats.sampledOut - stats.dropped),
+                    static_cast<std::size_t>(stats.sampledOut), static_cast<std::size_t>(stats.dropped));
+    }
+
+    return 0;
+}
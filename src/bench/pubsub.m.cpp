@@ -0,0 +1,190 @@
+#include "benchutils.h"
+#include "server.h"
+#include "spdlog/spdlog.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+#include <zmq.hpp>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+/*
+Usage: ./bench_pubsub [messages per run (default 1000)] [largest room (default 1000)]
+
+Compares server CPU per delivered chat message when rooms fan out over the
+ROUTER socket (one send per member) and over a PUB socket (one publish per
+message, zmq does the fan-out). The clients run in a forked child so the
+parent's CPU time is the server alone, including its zmq I/O thread.
+
+Opening large rooms needs a raised file descriptor limit (ulimit -n).
+*/
+
+namespace {
+
+enum class Mode { e_ROUTER, e_PUB };
+
+double cpuNs() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    auto toNs = [](const timeval& tv) { return tv.tv_sec * 1e9 + tv.tv_usec * 1e3; };
+    return toNs(usage.ru_utime) + toNs(usage.ru_stime);
+}
+
+void sendMessage(zmq::socket_t& socket, const ClientBaseMessage& message) {
+    auto serialized = serialize_clientbasemsg(message);
+    zmq::message_t msg(*serialized);
+    socket.send(msg, zmq::send_flags::none);
+}
+
+// the room's members, the first one sends and the rest count what they receive
+std::size_t runClients(Mode mode, const std::string& address, std::size_t members, std::size_t messages,
+                       int readyFd, int goFd) {
+    zmq::context_t context(1);
+    context.set(zmq::ctxopt::max_sockets, static_cast<int>(members * 2 + 16));
+
+    std::vector<zmq::socket_t> dealers;
+    std::vector<zmq::socket_t> subscribers;
+    for (std::size_t i = 0; i < members; ++i) {
+        std::string id = "member-" + std::to_string(i);
+        zmq::socket_t dealer(context, ZMQ_DEALER);
+        dealer.set(zmq::sockopt::routing_id, id);
+        dealer.set(zmq::sockopt::linger, 0);
+        dealer.set(zmq::sockopt::rcvhwm, 0);
+        dealer.connect(address);
+
+        sendMessage(dealer, ClientBaseMessage{id, ClientConnectionRequest{"bench", std::nullopt}});
+        zmq::message_t reply;
+        if (!dealer.recv(reply, zmq::recv_flags::none).has_value()) {
+            return 0;
+        }
+
+        auto response = deserialize_serverbasemsg(reply.to_string_view());
+        if (mode == Mode::e_PUB && i > 0 && response.has_value()
+            && std::holds_alternative<ServerConnectionResponse>(response->payload)) {
+            const auto& publish = std::get<ServerConnectionResponse>(response->payload).publish;
+            zmq::socket_t subscriber(context, ZMQ_SUB);
+            subscriber.set(zmq::sockopt::linger, 0);
+            subscriber.set(zmq::sockopt::rcvhwm, 0);
+            subscriber.set(zmq::sockopt::subscribe, publish->topic);
+            subscriber.connect(publish->address);
+            subscribers.push_back(std::move(subscriber));
+        }
+        dealers.push_back(std::move(dealer));
+    }
+
+    // give the subscriptions time to reach the server
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+    char byte = 0;
+    if (write(readyFd, &byte, 1) != 1 || read(goFd, &byte, 1) != 1) {
+        return 0;
+    }
+
+    ClientBaseMessage chat{"member-0", ClientChatMessage{"bench", std::string(64, 'x')}};
+    for (std::size_t n = 0; n < messages; ++n) {
+        sendMessage(dealers[0], chat);
+    }
+
+    auto& receivers = mode == Mode::e_PUB ? subscribers : dealers;
+    std::size_t first = mode == Mode::e_PUB ? 0 : 1;
+    std::vector<zmq::pollitem_t> items;
+    for (std::size_t i = first; i < receivers.size(); ++i) {
+        items.push_back({receivers[i].handle(), 0, ZMQ_POLLIN, 0});
+    }
+
+    // stop once everything arrived or nothing has for a second
+    std::size_t delivered = 0;
+    std::size_t expected = messages * (members - 1);
+    while (delivered < expected && zmq::poll(items.data(), items.size(), std::chrono::milliseconds(1000)) > 0) {
+        for (std::size_t i = 0; i < items.size(); ++i) {
+            if (!(items[i].revents & ZMQ_POLLIN)) {
+                continue;
+            }
+            zmq::message_t msg;
+            while (receivers[first + i].recv(msg, zmq::recv_flags::dontwait).has_value()) {
+                // a published message is [topic][payload], only count the payload
+                if (!msg.more()) {
+                    ++delivered;
+                }
+            }
+        }
+    }
+    return delivered;
+}
+
+} // namespace
+
+int main(int argc, const char *argv[]){
+
+    spdlog::set_level(spdlog::level::off);
+
+    std::size_t messages = argc > 1 ? std::stoul(argv[1]) : 1000;
+    std::size_t largest = argc > 2 ? std::stoul(argv[2]) : 1000;
+    const std::vector<std::size_t> roomSizes = {10, 100, 500, 1000, 5000};
+
+    std::printf("%8s %10s %14s %14s %16s %12s\n",
+                "mode", "members", "delivered", "server cpu ms", "cpu ns/delivery", "wall ms");
+
+    int port = 19000;
+    for (auto members : roomSizes) {
+        if (members > largest) {
+            break;
+        }
+        for (auto mode : {Mode::e_ROUTER, Mode::e_PUB}) {
+            auto address = "tcp://127.0.0.1:" + std::to_string(port++);
+            auto publishAddress = "tcp://127.0.0.1:" + std::to_string(port++);
+
+            int ready[2];
+            int go[2];
+            int done[2];
+            if (pipe(ready) != 0 || pipe(go) != 0 || pipe(done) != 0) {
+                return 1;
+            }
+
+            // fork before the server exists so the child holds no zmq state of it
+            pid_t child = fork();
+            if (child == 0) {
+                auto delivered = runClients(mode, address, members, messages, ready[1], go[0]);
+                auto written = write(done[1], &delivered, sizeof(delivered));
+                _exit(written == sizeof(delivered) ? 0 : 1);
+            }
+
+            ServerConfig config;
+            if (mode == Mode::e_PUB) {
+                config.publishAddress = publishAddress;
+            }
+            Server server(address, config);
+            server.createRoom("bench");
+            std::thread serverThread(&Server::run, &server);
+
+            char byte = 0;
+            std::size_t delivered = 0;
+            double cpuStart = 0;
+            bench::Timer timer;
+            if (read(ready[0], &byte, 1) == 1) {
+                cpuStart = cpuNs();
+                timer = bench::Timer();
+                if (write(go[1], &byte, 1) == 1 && read(done[0], &delivered, sizeof(delivered)) != sizeof(delivered)) {
+                    delivered = 0;
+                }
+            }
+            double cpu = cpuNs() - cpuStart;
+            double wall = timer.elapsedNs();
+
+            server.stop();
+            serverThread.join();
+            waitpid(child, nullptr, 0);
+            for (int fd : {ready[0], ready[1], go[0], go[1], done[0], done[1]}) {
+                close(fd);
+            }
+
+            std::printf("%8s %10zu %14zu %14.1f %16.1f %12.1f\n",
+                        mode == Mode::e_PUB ? "pub" : "router", members, delivered,
+                        cpu / 1e6, delivered ? cpu / delivered : 0.0, wall / 1e6);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,121 @@
+#include "benchutils.h"
+#include "rebalance.h"
+#include "spdlog/spdlog.h"
+
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unistd.h>
+#include <functional>
+#include <filesystem>
+
+/*
+Usage: ./bench_rebalance [rooms (default 256)] [messages per room (default 1000)]
+
+Grows a cluster of 1 to 4 nodes by one node the way it is done, with every node
+stopped: writes each room's log on the node owning it, runs rebalanceLogs with
+the new node list and then restores every room from the log of its new owner,
+as the nodes do on startup. Reports how many rooms (and bytes) moved against
+the 1/n a consistent hash ring should move and against hashing mod n, how long
+the move and the restore took, and how many rooms came back incomplete.
+*/
+
+namespace {
+
+std::vector<std::string> nodeList(std::size_t count) {
+    std::vector<std::string> nodes;
+    for (std::size_t node = 0; node < count; ++node) {
+        nodes.push_back("tcp://127.0.0.1:" + std::to_string(9000 + node));
+    }
+    return nodes;
+}
+
+} // namespace
+
+int main(int argc, const char *argv[]){
+
+    spdlog::set_level(spdlog::level::warn);
+
+    std::size_t rooms = argc > 1 ? std::stoul(argv[1]) : 256;
+    std::size_t messages = argc > 2 ? std::stoul(argv[2]) : 1000;
+
+    auto base = std::filesystem::temp_directory_path() / ("dearchat-bench-rebalance-" + std::to_string(getpid()));
+    HistoryRetention everything{messages, std::numeric_limits<std::size_t>::max()};
+
+    std::printf("%-7s %-7s %-9s %-7s %-9s %-10s %-13s %-11s %s\n",
+                "nodes", "rooms", "moved", "ideal", "mod n", "MiB moved", "rebalance ms", "restore ms", "incomplete");
+    for (std::size_t before = 1; before <= 4; ++before) {
+        auto oldNodes = nodeList(before);
+        auto newNodes = nodeList(before + 1);
+        std::vector<std::string> directories;
+        for (std::size_t node = 0; node <= before; ++node) {
+            directories.push_back((base / std::to_string(before) / std::to_string(node)).string());
+        }
+
+        // every room logged on its owner in the cluster as it was
+        {
+            HashRing ring(oldNodes);
+            std::vector<std::unique_ptr<MessageLog>> logs;
+            for (const auto& directory : directories) {
+                logs.push_back(std::make_unique<MessageLog>(MessageLogConfig{directory}));
+            }
+            ServerChatMessage message{"client-0", std::string(64, 'x')};
+            for (std::size_t room = 0; room < rooms; ++room) {
+                auto roomId = "room-" + std::to_string(room);
+                auto& log = *logs[ring.owner(roomId)];
+                RoomHistory history;
+                log.open(roomId, history);
+                for (std::size_t i = 0; i < messages; ++i) {
+                    message.sequence = i;
+                    log.append(roomId, message);
+                }
+            }
+            for (auto& log : logs) {
+                log->flush();
+            }
+        }
+
+        std::size_t modMoved = 0;
+        for (std::size_t room = 0; room < rooms; ++room) {
+            auto hash = std::hash<std::string>{}("room-" + std::to_string(room));
+            modMoved += hash % before != hash % (before + 1);
+        }
+
+        bench::Timer rebalanceTimer;
+        auto stats = rebalanceLogs(newNodes, directories);
+        auto rebalanceNs = rebalanceTimer.elapsedNs();
+
+        // what the nodes do on startup, each restores the rooms it owns from its own log
+        HashRing ring(newNodes);
+        std::size_t incomplete = 0;
+        std::size_t restored = 0;
+        bench::Timer restoreTimer;
+        for (std::uint32_t node = 0; node < directories.size(); ++node) {
+            MessageLog log(MessageLogConfig{directories[node]});
+            for (const auto& roomId : log.roomIds()) {
+                if (ring.owner(roomId) != node) {
+                    continue;
+                }
+                RoomHistory history(everything);
+                log.open(roomId, history);
+                ++restored;
+                incomplete += history.nextSequence() != messages;
+            }
+        }
+        auto restoreNs = restoreTimer.elapsedNs();
+        incomplete += rooms - restored;
+
+        std::printf("%zu -> %zu  %-7zu %-9s %-7s %-9s %-10.1f %-13.1f %-11.1f %zu\n",
+                    before, before + 1, stats.rooms,
+                    (std::to_string(100 * stats.moved / std::max<std::size_t>(stats.rooms, 1)) + "%").c_str(),
+                    (std::to_string(100 / (before + 1)) + "%").c_str(),
+                    (std::to_string(100 * modMoved / std::max<std::size_t>(rooms, 1)) + "%").c_str(),
+                    stats.bytesMoved / double(1 << 20), rebalanceNs / 1e6, restoreNs / 1e6, incomplete);
+    }
+
+    std::filesystem::remove_all(base);
+
+    return 0;
+}
@@ -0,0 +1,125 @@
+#include "benchutils.h"
+#include "server.h"
+#include "spdlog/spdlog.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+#include <zmq.hpp>
+
+/*
+Usage: ./bench_receive [messages per sender (default 200000)] [senders (default 4)]
+
+Runs a server on loopback for each receive batch size, then pipelined with 1 to
+4 decoder threads (see ServerConfig::decoderThreads), has the senders blast
+chat messages into "general" and counts what a listening client receives.
+Reports delivered messages/sec per run, and the C++ heap allocations and
+bytes allocated per delivered message. The senders send a message serialized up
+front so the allocation counts are the server's (and whatever libzmq itself
+allocates with operator new, its message buffers use malloc and are not counted).
+*/
+
+namespace {
+
+struct Run {
+    std::size_t batchSize;
+    std::size_t decoders;
+};
+
+void sendMessage(zmq::socket_t& socket, const ClientBaseMessage& message) {
+    auto serialized = serialize_clientbasemsg(message);
+    zmq::message_t msg(*serialized);
+    socket.send(msg, zmq::send_flags::none);
+}
+
+// connects a dealer as id and joins general, waiting for the server to accept
+zmq::socket_t joinGeneral(zmq::context_t& context, const std::string& address, const std::string& id) {
+    zmq::socket_t dealer(context, ZMQ_DEALER);
+    dealer.set(zmq::sockopt::routing_id, id);
+    dealer.set(zmq::sockopt::linger, 0);
+    dealer.set(zmq::sockopt::rcvhwm, 0);
+    dealer.connect(address);
+
+    sendMessage(dealer, ClientBaseMessage{id, ClientConnectionRequest{"general", std::nullopt}});
+    zmq::message_t reply;
+    auto res = dealer.recv(reply, zmq::recv_flags::none);
+    bench::doNotOptimize(res);
+    return dealer;
+}
+
+} // namespace
+
+int main(int argc, const char *argv[]){
+
+    spdlog::set_level(spdlog::level::warn);
+
+    std::size_t perSender = argc > 1 ? std::stoul(argv[1]) : 200000;
+    std::size_t senderCount = argc > 2 ? std::stoul(argv[2]) : 4;
+    const std::vector<Run> runs = {{1, 0}, {4, 0}, {16, 0}, {64, 0}, {256, 0}, {64, 1}, {64, 2}, {64, 4}};
+
+    std::printf("%8s %9s %14s %14s %10s %12s\n", "batch", "decoders", "delivered", "msgs/s", "al/msg", "alloc B/msg");
+
+    int port = 18800;
+    for (const auto& run : runs) {
+        auto address = "tcp://127.0.0.1:" + std::to_string(port++);
+
+        ServerConfig config;
+        config.receiveBatchSize = run.batchSize;
+        config.decoderThreads = run.decoders;
+        Server server(address, config);
+        server.createRoom("general");
+        std::thread serverThread(&Server::run, &server);
+
+        zmq::context_t context(1);
+        auto receiver = joinGeneral(context, address, "receiver");
+
+        std::vector<zmq::socket_t> senders;
+        for (std::size_t i = 0; i < senderCount; ++i) {
+            senders.push_back(joinGeneral(context, address, "sender-" + std::to_string(i)));
+        }
+
+        std::vector<std::string> serialized;
+        for (std::size_t i = 0; i < senderCount; ++i) {
+            ClientBaseMessage message{"sender-" + std::to_string(i), ClientChatMessage{"general", std::string(64, 'x')}};
+            serialized.push_back(*serialize_clientbasemsg(message));
+        }
+
+        auto allocStart = bench::allocSnapshot();
+        bench::Timer timer;
+        std::vector<std::thread> senderThreads;
+        for (std::size_t i = 0; i < senderCount; ++i) {
+            senderThreads.emplace_back([&, i] {
+                for (std::size_t n = 0; n < perSender; ++n) {
+                    zmq::message_t msg(serialized[i].data(), serialized[i].size());
+                    senders[i].send(msg, zmq::send_flags::none);
+                }
+            });
+        }
+
+        // the receiver sees every message, stop once it has them all or the stream goes quiet
+        std::size_t delivered = 0;
+        double lastNs = 0;
+        receiver.set(zmq::sockopt::rcvtimeo, 1000);
+        while (delivered < perSender * senderCount) {
+            zmq::message_t msg;
+            if (!receiver.recv(msg, zmq::recv_flags::none).has_value()) {
+                break;
+            }
+            ++delivered;
+            lastNs = timer.elapsedNs();
+        }
+
+        for (auto& thread : senderThreads) {
+            thread.join();
+        }
+        auto allocs = bench::allocSince(allocStart);
+        server.stop();
+        serverThread.join();
+
+        double perMessage = delivered > 0 ? 1.0 / delivered : 0.0;
+        std::printf("%8zu %9zu %14zu %14.0f %10.2f %12.0f\n", run.batchSize, run.decoders, delivered, delivered / (lastNs / 1e9),
+                    allocs.count * perMessage, allocs.bytes * perMessage);
+    }
+
+    return 0;
+}
@@ -0,0 +1,61 @@
+#include "benchutils.h"
+#include "messagelog.h"
+#include "spdlog/spdlog.h"
+
+#include <limits>
+#include <string>
+#include <unistd.h>
+#include <filesystem>
+
+/*
+Usage: ./bench_recovery [messages (default 1000000)]
+
+Writes a room log of the given size through MessageLog (reporting append
+throughput with group commit), then measures how long it takes to recover
+the room with the default retention and with a retention holding every message.
+*/
+
+int main(int argc, const char *argv[]){
+
+    spdlog::set_level(spdlog::level::warn);
+
+    std::size_t messages = argc > 1 ? std::stoul(argv[1]) : 1000000;
+
+    auto directory = std::filesystem::temp_directory_path() / ("dearchat-bench-recovery-" + std::to_string(getpid()));
+    MessageLogConfig config;
+    config.directory = directory.string();
+
+    {
+        MessageLog log(config);
+        RoomHistory history;
+        log.open("bench", history);
+
+        ServerChatMessage message{"client-0", std::string(64, 'x')};
+        bench::Timer timer;
+        for (std::size_t i = 0; i < messages; ++i) {
+            log.append("bench", message);
+        }
+        log.flush();
+        auto ns = timer.elapsedNs();
+
+        std::printf("append:   %zu messages in %.1f ms (%.0f msgs/s, fsync'd)\n",
+                    messages, ns / 1e6, messages / (ns / 1e9));
+    }
+
+    HistoryRetention everything{messages, std::numeric_limits<std::size_t>::max()};
+    for (const auto& retention : {HistoryRetention{}, everything}) {
+        MessageLog log(config);
+        RoomHistory history(retention);
+
+        bench::Timer timer;
+        log.open("bench", history);
+        auto ns = timer.elapsedNs();
+
+        std::printf("recover:  %zu of %llu messages retained in %.1f ms\n",
+                    history.size(), static_cast<unsigned long long>(history.nextSequence()), ns / 1e6);
+    }
+
+    std::filesystem::remove_all(directory);
+
+    return 0;
+}
@@ -0,0 +1,136 @@
+#include "benchutils.h"
+#include "searchindex.h"
+
+#include <random>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+/*
+Usage: ./bench_search [messages (default 1000000,4000000)] [queries per kind (default 200)]
+
+Indexes rooms of up to millions of generated chat messages (8 to 16 words each,
+drawn from a 50k word vocabulary with Zipf frequencies, like real text) and
+reports the cost of indexing one message (the server does this after each
+batch's chat is sent, not per message), then query latency for:
+- common:   one of the 10 most frequent words, matches a large share of the room
+- rare:     one word from the long tail
+- two:      two mid-frequency words that must both appear
+- common+rare: the rare word bounds the work however common the other is
+Every query asks for the best 20 hits.
+*/
+
+namespace {
+
+class Corpus {
+
+public:
+    Corpus(std::size_t vocabulary, std::uint32_t seed)
+    : d_rng(seed)
+    {
+        for (std::size_t i = 0; i < vocabulary; ++i) {
+            d_words.push_back("w" + std::to_string(i));
+        }
+        // Zipf, the i-th most common word appears about 1/i as often as the first
+        std::vector<double> weights;
+        for (std::size_t i = 0; i < vocabulary; ++i) {
+            weights.push_back(1.0 / (i + 1));
+        }
+        d_pick = std::discrete_distribution<std::size_t>(weights.begin(), weights.end());
+    }
+
+    std::string message() {
+        std::string text;
+        std::size_t words = 8 + d_rng() % 9;
+        for (std::size_t i = 0; i < words; ++i) {
+            text += d_words[d_pick(d_rng)];
+            text += ' ';
+        }
+        return text;
+    }
+
+    const std::string& word(std::size_t rank) const {
+        return d_words[rank];
+    }
+
+    private:
+    std::mt19937 d_rng;
+    std::vector<std::string> d_words;
+    std::discrete_distribution<std::size_t> d_pick;
+};
+
+struct QueryStats {
+    double p50Us = 0;
+    double p99Us = 0;
+    double maxUs = 0;
+    double meanHits = 0;
+};
+
+template <typename NextQuery>
+QueryStats measure(const SearchIndex& index, std::size_t queries, NextQuery&& next) {
+    std::vector<double> us;
+    double hits = 0;
+    for (std::size_t i = 0; i < queries; ++i) {
+        auto query = next(i);
+        bench::Timer timer;
+        auto result = index.search(query, 0, 20);
+        us.push_back(timer.elapsedNs() / 1e3);
+        hits += result.total;
+        bench::doNotOptimize(result);
+    }
+    std::sort(us.begin(), us.end());
+    return QueryStats{us[us.size() / 2], us[us.size() * 99 / 100], us.back(), hits / queries};
+}
+
+void printRow(std::size_t messages, const char* kind, const QueryStats& stats) {
+    std::printf("%10zu %12s %10.1f %10.1f %10.1f %14.0f\n", messages, kind, stats.p50Us, stats.p99Us, stats.maxUs, stats.meanHits);
+}
+
+} // namespace
+
+int main(int argc, const char *argv[]){
+
+    std::vector<std::size_t> sizes = {1000000, 4000000};
+    if (argc > 1) {
+        sizes = {std::stoul(argv[1])};
+    }
+    std::size_t queries = argc > 2 ? std::stoul(argv[2]) : 200;
+
+    std::printf("%10s %12s %12s %12s %12s\n", "messages", "index ns/msg", "al/msg", "terms", "build s");
+    std::vector<std::pair<std::size_t, SearchIndex>> indexes;
+    Corpus corpus(50000, 7);
+    for (auto size : sizes) {
+        // generated up front so only indexing is timed
+        std::vector<std::string> messages;
+        messages.reserve(size);
+        for (std::size_t i = 0; i < size; ++i) {
+            messages.push_back(corpus.message());
+        }
+
+        SearchIndex index;
+        auto allocStart = bench::allocSnapshot();
+        bench::Timer timer;
+        for (std::size_t i = 0; i < size; ++i) {
+            index.add(i, messages[i]);
+        }
+        double ns = timer.elapsedNs();
+        auto allocs = bench::allocSince(allocStart);
+        std::printf("%10zu %12.0f %12.2f %12zu %12.2f\n", size, ns / size, static_cast<double>(allocs.count) / size,
+                    index.termCount(), ns / 1e9);
+        indexes.emplace_back(size, std::move(index));
+    }
+
+    std::printf("\n%10s %12s %10s %10s %10s %14s\n", "messages", "query", "p50 us", "p99 us", "max us", "mean matches");
+    for (const auto& [size, index] : indexes) {
+        printRow(size, "common", measure(index, queries, [&](std::size_t i) { return corpus.word(i % 10); }));
+        printRow(size, "rare", measure(index, queries, [&](std::size_t i) { return corpus.word(20000 + i * 97 % 20000); }));
+        printRow(size, "two", measure(index, queries, [&](std::size_t i) {
+            return corpus.word(100 + i % 200) + " " + corpus.word(300 + i * 7 % 200);
+        }));
+        printRow(size, "common+rare", measure(index, queries, [&](std::size_t i) {
+            return corpus.word(i % 10) + " " + corpus.word(20000 + i * 97 % 20000);
+        }));
+    }
+
+    return 0;
+}
@@ -0,0 +1,158 @@
+#include "benchutils.h"
+#include "messaging_view.h"
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+/*
+Usage: ./bench_serialization [max history entries (default 100000)]
+
+Measures the messaging.h codecs for every message variant. Chat messages are
+run with payloads from 10B to 64KiB, ServerConnectionResponse with histories
+of 0 to 100k entries. For both directions we report, per op:
+- time
+- encoded size
+- C++ heap allocations and bytes allocated
+
+A second table compares the server's receive path for client messages: the
+frame (and routing id) copied into std::strings and decoded into owning
+messages, as it used to be, against decoding in place into borrowed views.
+*/
+
+namespace {
+
+struct OpStats {
+    double ns;
+    double allocs;
+    double allocBytes;
+};
+
+const std::vector<std::size_t> s_payloadSizes = {10, 100, 1024, 4096, 16384, 65536};
+const std::vector<std::size_t> s_historySizes = {0, 10, 100, 1000, 10000, 100000};
+
+// runs op enough times to fill about 200ms (at least 3 times)
+template <typename Op>
+OpStats measure(Op&& op) {
+    bench::Timer calibrate;
+    op();
+    double once = std::max(calibrate.elapsedNs(), 1.0);
+    auto iterations = static_cast<std::size_t>(std::clamp(2e8 / once, 3.0, 1e6));
+
+    auto start = bench::allocSnapshot();
+    bench::Timer timer;
+    for (std::size_t i = 0; i < iterations; ++i) {
+        op();
+    }
+    double ns = timer.elapsedNs();
+    auto used = bench::allocSince(start);
+
+    return OpStats{ns / iterations,
+                   static_cast<double>(used.count) / iterations,
+                   static_cast<double>(used.bytes) / iterations};
+}
+
+void printRow(const std::string& name, const std::string& param, std::size_t bytes, const OpStats& ser, const OpStats& de) {
+    std::printf("%-26s %8s %10zu %12.0f %10.2f %12.0f %12.0f %10.2f %12.0f\n",
+                name.c_str(), param.c_str(), bytes,
+                ser.ns, ser.allocs, ser.allocBytes,
+                de.ns, de.allocs, de.allocBytes);
+}
+
+void runClient(const std::string& name, const std::string& param, const ClientBaseMessage& message) {
+    auto encoded = serialize_clientbasemsg(message);
+    auto ser = measure([&] { bench::doNotOptimize(serialize_clientbasemsg(message)); });
+    auto de = measure([&] { bench::doNotOptimize(deserialize_clientbasemsg(*encoded)); });
+    printRow(name, param, encoded->size(), ser, de);
+}
+
+void runServer(const std::string& name, const std::string& param, const ServerBaseMessage& message) {
+    auto encoded = serialize_serverbasemsg(message);
+    auto ser = measure([&] { bench::doNotOptimize(serialize_serverbasemsg(message)); });
+    auto de = measure([&] { bench::doNotOptimize(deserialize_serverbasemsg(*encoded)); });
+    printRow(name, param, encoded->size(), ser, de);
+}
+
+void runReceive(const std::string& name, const std::string& param, const ClientBaseMessage& message) {
+    auto encoded = serialize_clientbasemsg(message);
+    std::string_view frame(*encoded);
+    std::string_view id(message.senderId);
+    auto copied = measure([&] {
+        std::string idStr(id);
+        std::string data(frame);
+        auto decoded = deserialize_clientbasemsg(data);
+        bench::doNotOptimize(decoded.has_value() && decoded->senderId == idStr);
+    });
+    auto borrowed = measure([&] {
+        auto decoded = deserialize_clientbasemsg_view(frame);
+        bench::doNotOptimize(decoded.has_value() && decoded->senderId == id);
+    });
+    std::printf("%-26s %8s %10zu %12.0f %10.2f %12.0f %12.0f %10.2f %12.0f\n",
+                name.c_str(), param.c_str(), encoded->size(),
+                copied.ns, copied.allocs, copied.allocBytes,
+                borrowed.ns, borrowed.allocs, borrowed.allocBytes);
+}
+
+// a history of realistic short chat lines
+std::vector<ServerChatMessage> makeHistory(std::size_t entries) {
+    std::vector<ServerChatMessage> history;
+    history.reserve(entries);
+    for (std::size_t i = 0; i < entries; ++i) {
+        history.push_back(ServerChatMessage{"client-" + std::to_string(i % 100), std::string(64, 'x'), i});
+    }
+    return history;
+}
+
+} // namespace
+
+int main(int argc, const char *argv[]){
+
+    std::size_t maxHistory = argc > 1 ? std::stoul(argv[1]) : 100000;
+    const std::string sender = "client-42";
+
+    std::printf("%-26s %8s %10s %12s %10s %12s %12s %10s %12s\n",
+                "message", "param", "bytes", "ser ns/op", "ser al/op", "ser B/op", "de ns/op", "de al/op", "de B/op");
+
+    // --- client messages ---
+
+    for (auto size : s_payloadSizes) {
+        runClient("ClientChatMessage", std::to_string(size), ClientBaseMessage{sender, ClientChatMessage{"general", std::string(size, 'x')}});
+    }
+    runClient("ClientConnectionRequest", "-", ClientBaseMessage{sender, ClientConnectionRequest{"general", std::nullopt}});
+    runClient("ClientConnectionRequest", "resume", ClientBaseMessage{sender, ClientConnectionRequest{"general", 12345}});
+    runClient("ClientCreateRoomRequest", "-", ClientBaseMessage{sender, ClientCreateRoomRequest{"general"}});
+    runClient("ClientHistoryRequest", "-", ClientBaseMessage{sender, ClientHistoryRequest{"general", 12345, 50}});
+    runClient("ClientHeartbeat", "-", ClientBaseMessage{sender, ClientHeartbeat{}});
+
+    // --- server messages ---
+
+    for (auto size : s_payloadSizes) {
+        runServer("ServerRoomChatMessage", std::to_string(size),
+                  ServerBaseMessage{ServerRoomChatMessage{"general", ServerChatMessage{sender, std::string(size, 'x'), 12345}}});
+    }
+    for (auto entries : s_historySizes) {
+        if (entries > maxHistory) {
+            break;
+        }
+        runServer("ServerConnectionResponse", std::to_string(entries),
+                  ServerBaseMessage{ServerConnectionResponse{"general", true, std::nullopt, makeHistory(entries), 0, std::nullopt}});
+    }
+    runServer("ServerCreateRoomResponse", "-", ServerBaseMessage{ServerCreateRoomResponse{"general", false, "Room already exists", std::nullopt}});
+    for (std::size_t entries : {0, 50, 500}) {
+        runServer("ServerHistoryResponse", std::to_string(entries),
+                  ServerBaseMessage{ServerHistoryResponse{"general", makeHistory(entries), 0, true}});
+    }
+
+    // --- receive path ---
+
+    std::printf("\n%-26s %8s %10s %12s %10s %12s %12s %10s %12s\n",
+                "received", "param", "bytes", "copy ns/op", "copy al/op", "copy B/op", "view ns/op", "view al/op", "view B/op");
+    for (auto size : s_payloadSizes) {
+        runReceive("ClientChatMessage", std::to_string(size), ClientBaseMessage{sender, ClientChatMessage{"general", std::string(size, 'x')}});
+    }
+    runReceive("ClientConnectionRequest", "-", ClientBaseMessage{sender, ClientConnectionRequest{"general", std::nullopt}});
+    runReceive("ClientHistoryRequest", "-", ClientBaseMessage{sender, ClientHistoryRequest{"general", 12345, 50}});
+    runReceive("ClientHeartbeat", "-", ClientBaseMessage{sender, ClientHeartbeat{}});
+
+    return 0;
+}
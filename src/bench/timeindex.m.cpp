@@ -0,0 +1,86 @@
+#include "benchutils.h"
+#include "roomhistory.h"
+
+#include <random>
+#include <string>
+#include <vector>
+#include <limits>
+#include <algorithm>
+
+/*
+Usage: ./bench_timeindex [messages (default 1000,100000,1000000)] [queries (default 10000)]
+
+Fills a room's history with messages about a millisecond apart (with jitter)
+and reports the cost of finding where a random point in time falls, the first
+step of every history range request, with the sparse time index
+(RoomHistory::sequenceAt) vs a linear scan of the history. Also reports what a
+push costs now that it stamps the time and keeps the index up to date.
+*/
+
+namespace {
+
+// what answering a range request cost without an index, oldest to newest until stamped at or after timestamp
+std::uint64_t linearScan(const RoomHistory& history, std::uint64_t timestamp) {
+    for (std::size_t i = 0; i < history.size(); ++i) {
+        if (history[i].timestamp >= timestamp) {
+            return history.firstSequence() + i;
+        }
+    }
+    return history.nextSequence();
+}
+
+template <typename Find>
+double measure(const std::vector<std::uint64_t>& timestamps, Find&& find) {
+    std::uint64_t sum = 0;
+    bench::Timer timer;
+    for (auto timestamp : timestamps) {
+        sum += find(timestamp);
+    }
+    double ns = timer.elapsedNs();
+    bench::doNotOptimize(sum);
+    return ns / timestamps.size();
+}
+
+} // namespace
+
+int main(int argc, const char *argv[]){
+
+    std::vector<std::size_t> sizes = {1000, 100000, 1000000};
+    if (argc > 1) {
+        sizes = {std::stoul(argv[1])};
+    }
+    std::size_t queries = argc > 2 ? std::stoul(argv[2]) : 10000;
+
+    std::printf("%10s %12s %14s %14s %10s\n", "messages", "push ns", "indexed ns", "linear ns", "speedup");
+
+    std::mt19937_64 rng(7);
+    const std::string senderId = "client-bench";
+    const std::string message(64, 'x');
+    for (auto size : sizes) {
+        RoomHistory history(HistoryRetention{size, std::numeric_limits<std::size_t>::max()});
+        std::uint64_t now = 1'700'000'000'000'000'000ull;
+        bench::Timer timer;
+        for (std::size_t i = 0; i < size; ++i) {
+            now += 500'000 + rng() % 1'000'000;
+            history.push(senderId, message, now);
+        }
+        double pushNs = timer.elapsedNs() / size;
+
+        std::vector<std::uint64_t> timestamps;
+        timestamps.reserve(queries);
+        auto first = history[0].timestamp;
+        for (std::size_t i = 0; i < queries; ++i) {
+            timestamps.push_back(first + rng() % (now - first + 1));
+        }
+
+        // the linear scan is slow enough on big rooms that fewer queries give a stable number
+        std::vector<std::uint64_t> linearTimestamps(timestamps.begin(),
+                                                    timestamps.begin() + std::min<std::size_t>(queries, 10'000'000 / size + 1));
+
+        double indexed = measure(timestamps, [&](std::uint64_t t) { return history.sequenceAt(t); });
+        double linear = measure(linearTimestamps, [&](std::uint64_t t) { return linearScan(history, t); });
+        std::printf("%10zu %12.1f %14.1f %14.1f %9.0fx\n", size, pushNs, indexed, linear, linear / indexed);
+    }
+
+    return 0;
+}
@@ -2,10 +2,15 @@
 
 #include <zmq.hpp>
 #include <zmq.h>
+#include <ctime>
+#include <limits>
 #include <vector>
 #include <iostream>
 
 const std::string Client::s_inprocAddr = "inproc://sender";
+const std::uint32_t Client::s_historyPageSize = 50;
+const std::uint32_t Client::s_searchPageSize = 20;
+const std::chrono::milliseconds Client::s_heartbeatInterval(2000);
 
 Client::Client(const std::string& address, const std::string& id) 
 : d_clientId(id)
@@ -13,9 +18,21 @@ Client::Client(const std::string& address, const std::string& id)
 , d_context(1)
 , d_sender(d_context, ZMQ_PAIR)
 , d_agentDone(false)
+, d_oldestSequence(0)
+, d_hasOlderHistory(false)
+, d_historyRequested(false)
+, d_nextSequence(0)
+, d_unseenOwnMessages(0)
+, d_resuming(false)
+, d_searchOffset(0)
+, d_hasMoreResults(false)
 , console([this](const std::string& message) { send(message); }, 
           [this](const std::string& roomId) { connectToServer(roomId); },
-          [this](const std::string& roomId) { sendCreateRoomRequest(roomId); }
+          [this](const std::string& roomId) { sendCreateRoomRequest(roomId); },
+          [this](const std::string& roomId) { leaveRoom(roomId); },
+          [this]() { requestOlderHistory(); },
+          [this](const std::string& query) { search(query); },
+          [this]() { requestMoreResults(); }
           )
 {
     d_sender.bind(s_inprocAddr);
@@ -36,7 +53,17 @@ Client::~Client() {
 }
 
 void Client::connectToServer(const std::string& roomId) {
-    ClientConnectionRequest connectionRequest = {roomId};
+    ClientConnectionRequest connectionRequest = {roomId, std::nullopt};
+    // reconnecting to the room we are in only needs the messages we missed
+    d_resuming = roomId == currentRoom() && d_nextSequence > 0;
+    if (d_resuming) {
+        connectionRequest.lastSequence = d_nextSequence - 1;
+    } else {
+        d_nextSequence = 0;
+    }
+    d_unseenOwnMessages = 0;
+    setRoom(roomId);
+
     ClientBaseMessage baseMessage{d_clientId, connectionRequest};
     auto serialized = serialize_clientbasemsg(baseMessage);
 
@@ -57,6 +84,11 @@ void Client::connectToServer(const std::string& roomId) {
 }
 
 void Client::sendCreateRoomRequest(const std::string& roomId) {
+    setRoom(roomId);
+    d_hasOlderHistory = false;
+    d_nextSequence = 0;
+    d_unseenOwnMessages = 0;
+    d_resuming = false;
     ClientCreateRoomRequest createRoomRequest{roomId};
     ClientBaseMessage baseMessage{d_clientId, createRoomRequest};
     auto serialized = serialize_clientbasemsg(baseMessage);
@@ -75,13 +107,178 @@ void Client::sendCreateRoomRequest(const std::string& roomId) {
     console.AddLog("--- Requested creation of room: " + createRoomRequest.roomId + " ---");
 }
 
+void Client::leaveRoom(const std::string& roomId) {
+    {
+        std::lock_guard<std::mutex> lock(d_roomMutex);
+        if (d_joinedRooms.erase(roomId) == 0) {
+            console.AddLog("--- Not in room: " + roomId + " ---");
+            return;
+        }
+        if (d_roomId == roomId) {
+            d_roomId.clear();
+        }
+    }
+    if (currentRoom().empty()) {
+        d_hasOlderHistory = false;
+        d_nextSequence = 0;
+    }
+
+    ClientLeaveRoomRequest leaveRequest{roomId};
+    ClientBaseMessage baseMessage{d_clientId, leaveRequest};
+    auto serialized = serialize_clientbasemsg(baseMessage);
+
+    if (!serialized.has_value()) {
+        spdlog::warn("Failed to serialize message in Client::leaveRoom");
+        return;
+    }
+
+    zmq::message_t msg_t(*serialized);
+    auto res = d_sender.send(msg_t, zmq::send_flags::none);
+    if (!res.has_value()) {
+        spdlog::warn("Failed to send message on dealer (from leaveRoom)");
+    }
+
+    console.AddLog("--- Left room: " + roomId + " ---");
+}
+
+void Client::requestOlderHistory() {
+    if (!d_hasOlderHistory || d_historyRequested) {
+        return;
+    }
+
+    ClientHistoryRequest historyRequest{currentRoom(), d_oldestSequence, s_historyPageSize};
+    ClientBaseMessage baseMessage{d_clientId, historyRequest};
+    auto serialized = serialize_clientbasemsg(baseMessage);
+
+    if (!serialized.has_value()) {
+        spdlog::warn("Failed to serialize message in Client::requestOlderHistory");
+        return;
+    }
+
+    zmq::message_t msg_t(*serialized);
+    auto res = d_sender.send(msg_t, zmq::send_flags::none);
+    if (!res.has_value()) {
+        spdlog::warn("Failed to send message on dealer (from requestOlderHistory)");
+        return;
+    }
+    d_historyRequested = true;
+}
+
+void Client::search(const std::string& query) {
+    if (query.empty()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(d_roomMutex);
+        d_searchQuery = query;
+    }
+    d_hasMoreResults = false;
+    sendSearchRequest(query, 0);
+}
+
+void Client::requestMoreResults() {
+    if (!d_hasMoreResults) {
+        return;
+    }
+
+    std::string query;
+    {
+        std::lock_guard<std::mutex> lock(d_roomMutex);
+        query = d_searchQuery;
+    }
+    d_hasMoreResults = false;
+    sendSearchRequest(query, d_searchOffset);
+}
+
+void Client::sendSearchRequest(const std::string& query, std::uint32_t offset) {
+    ClientSearchRequest searchRequest{currentRoom(), query, offset, s_searchPageSize};
+    ClientBaseMessage baseMessage{d_clientId, searchRequest};
+    auto serialized = serialize_clientbasemsg(baseMessage);
+
+    if (!serialized.has_value()) {
+        spdlog::warn("Failed to serialize message in Client::sendSearchRequest");
+        return;
+    }
+
+    zmq::message_t msg_t(*serialized);
+    auto res = d_sender.send(msg_t, zmq::send_flags::none);
+    if (!res.has_value()) {
+        spdlog::warn("Failed to send message on dealer (from sendSearchRequest)");
+    }
+}
+
+void Client::requestHistoryRange(std::uint64_t fromTimestamp, std::uint64_t toTimestamp) {
+    ClientHistoryRangeRequest rangeRequest{currentRoom(), fromTimestamp, toTimestamp, s_historyPageSize};
+    ClientBaseMessage baseMessage{d_clientId, rangeRequest};
+    auto serialized = serialize_clientbasemsg(baseMessage);
+
+    if (!serialized.has_value()) {
+        spdlog::warn("Failed to serialize message in Client::requestHistoryRange");
+        return;
+    }
+
+    zmq::message_t msg_t(*serialized);
+    auto res = d_sender.send(msg_t, zmq::send_flags::none);
+    if (!res.has_value()) {
+        spdlog::warn("Failed to send message on dealer (from requestHistoryRange)");
+    }
+}
+
+void Client::sendDirect(const std::string& targetId, const std::string& message) {
+    if (targetId.empty() || message.empty()) {
+        return;
+    }
+
+    ClientDirectMessage directMessage{targetId, message};
+    ClientBaseMessage baseMessage{d_clientId, directMessage};
+    auto serialized = serialize_clientbasemsg(baseMessage);
+
+    if (!serialized.has_value()) {
+        spdlog::warn("Failed to serialize message in Client::sendDirect");
+        return;
+    }
+
+    zmq::message_t msg_t(*serialized);
+    auto res = d_sender.send(msg_t, zmq::send_flags::none);
+    if (!res.has_value()) {
+        spdlog::warn("Failed to send message on dealer (from sendDirect)");
+        return;
+    }
+    // the server only delivers it to the target
+    console.AddLog(directLine(targetId, ServerChatMessage{d_clientId, message}));
+}
+
+void Client::requestDirectHistory(const std::string& peerId) {
+    ClientDirectHistoryRequest historyRequest{peerId, std::numeric_limits<std::uint64_t>::max(), s_historyPageSize};
+    ClientBaseMessage baseMessage{d_clientId, historyRequest};
+    auto serialized = serialize_clientbasemsg(baseMessage);
+
+    if (!serialized.has_value()) {
+        spdlog::warn("Failed to serialize message in Client::requestDirectHistory");
+        return;
+    }
+
+    zmq::message_t msg_t(*serialized);
+    auto res = d_sender.send(msg_t, zmq::send_flags::none);
+    if (!res.has_value()) {
+        spdlog::warn("Failed to send message on dealer (from requestDirectHistory)");
+    }
+}
+
 void Client::send(const std::string& message) {
     // dont allow empty messages to be sent
     if (message.empty()) {
        return;
     }
 
-    ClientChatMessage chatMessage{message};
+    auto roomId = currentRoom();
+    if (roomId.empty()) {
+        console.AddLog("--- Join a room to talk ---");
+        return;
+    }
+
+    ClientChatMessage chatMessage{roomId, message};
     ClientBaseMessage baseMessage{d_clientId, chatMessage};
     auto serialized = serialize_clientbasemsg(baseMessage);
 
@@ -94,7 +291,9 @@ void Client::send(const std::string& message) {
     auto res = d_sender.send(msg_t, zmq::send_flags::none);
     if (!res.has_value()) {
         spdlog::warn("Failed to send message on sender");
+        return;
     }
+    ++d_unseenOwnMessages;
 }
 
 void Client::agent() {
@@ -107,15 +306,36 @@ void Client::agent() {
     forwarder.set(zmq::sockopt::linger,0);
     forwarder.connect(s_inprocAddr);
 
+    // only connected if the server publishes room chat
+    zmq::socket_t subscriber(d_context, ZMQ_SUB);
+    subscriber.set(zmq::sockopt::linger, 0);
+
     zmq::poller_t<> poller;
     poller.add(forwarder, zmq::event_flags::pollin); 
     poller.add(dealer, zmq::event_flags::pollin);
+    poller.add(subscriber, zmq::event_flags::pollin);
+
+    std::vector<zmq::poller_event<>> events(3); // 3 sockets
 
-    std::vector<zmq::poller_event<>> events(2); // 2 sockets
+    // serialized once, the heartbeat never changes
+    auto heartbeat = serialize_clientbasemsg(ClientBaseMessage{d_clientId, ClientHeartbeat{}});
+    auto nextHeartbeat = std::chrono::steady_clock::now();
 
     while (true) {
+        // keep the server from expiring our session even when we have nothing to say
+        auto now = std::chrono::steady_clock::now();
+        if (now >= nextHeartbeat && heartbeat.has_value()) {
+            zmq::message_t msg_t(*heartbeat);
+            auto res = dealer.send(msg_t, zmq::send_flags::dontwait);
+            if (!res.has_value()) {
+                spdlog::debug("Failed to send heartbeat on dealer");
+            }
+            nextHeartbeat = now + s_heartbeatInterval;
+        }
+
         // Poll for events
-        auto n = poller.wait_all(events, std::chrono::milliseconds(3000));
+        auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(nextHeartbeat - now);
+        auto n = poller.wait_all(events, std::max(timeout, std::chrono::milliseconds(1)));
         if (d_agentDone) {   
             break;
         } 
@@ -148,28 +368,66 @@ void Client::agent() {
                     continue;
                 }
 
-                auto baseMessage = deserialize_serverbasemsg(message.to_string());
+                auto baseMessage = deserialize_serverbasemsg(message.to_string_view());
                 if (!baseMessage.has_value()) {
                     spdlog::warn("Failed to deserialize server base message in Client::agent");
                     continue;
                 }
 
                 auto& payload = baseMessage->payload;
-                if (std::holds_alternative<ServerChatMessage>(payload)) {
-                    auto& message = std::get<ServerChatMessage>(payload);
-                    spdlog::debug("Received message from server: {}", message.message);
-
-                    std::string messageLine = "[" + message.senderId + "] " + message.message;
-
-                    console.AddLog(messageLine);
+                if (std::holds_alternative<ServerRoomChatMessage>(payload)) {
+                    receiveRoomChat(std::move(std::get<ServerRoomChatMessage>(payload)), dealer);
                 } else if (std::holds_alternative<ServerConnectionResponse>(payload)) {
                     auto& message = std::get<ServerConnectionResponse>(payload);
-                    if (message.accepted) {
+                    if (message.roomId != currentRoom()) {
+                        // we switched to another room before the answer came, this one stays joined in the background
+                        if (message.accepted) {
+                            subscribe(subscriber, message.publish);
+                        }
+                    } else if (message.accepted) {
                         spdlog::info("Connection accepted by server");
                         console.AddLog("--- Connection accepted by server ---");
-                        putHistoryOnConsole(message.chatHistory); 
+                        subscribe(subscriber, message.publish);
+                        auto historyEnd = message.historyStart + message.chatHistory.size();
+                        if (d_resuming) {
+                            // only the delta, our own messages in it are already on the console
+                            std::erase_if(message.chatHistory, [this](const ServerChatMessage& m) { return m.senderId == d_clientId; });
+                            for (const auto& chat : message.chatHistory) {
+                                trackSequence(chat.sequence);
+                                console.AddLog(historyLine(chat));
+                            }
+                            d_unseenOwnMessages = 0;
+                            d_resuming = false;
+                        } else {
+                            putHistoryOnConsole(message.chatHistory); 
+                            d_oldestSequence = message.historyStart;
+                            d_hasOlderHistory = message.historyStart > 0;
+                            d_historyRequested = false;
+                        }
+                        d_nextSequence = std::max<std::uint64_t>(d_nextSequence, historyEnd);
+
+                        // published chat that arrived while catching up, minus what the resume already covered
+                        if (d_catchingUp) {
+                            d_catchingUp = false;
+                            auto pending = std::move(d_pendingChat);
+                            d_pendingChat.clear();
+                            for (auto& chat : pending) {
+                                receiveChat(std::move(chat), dealer);
+                            }
+                        }
                     } else {
                         spdlog::warn("Connection rejected by server: {}", message.reason.value_or("No reason given"));
+                        // a catch up that failed will not be answered with the missing messages
+                        d_catchingUp = false;
+                        d_resuming = false;
+                        d_pendingChat.clear();
+                        {
+                            std::lock_guard<std::mutex> lock(d_roomMutex);
+                            d_joinedRooms.erase(message.roomId);
+                            if (d_roomId == message.roomId) {
+                                d_roomId.clear();
+                            }
+                        }
                         console.AddLog("--- Connection to server Refused! ---"); 
                         console.AddLog(message.reason.value_or("Server Reason: No reason given"));
                     }
@@ -178,15 +436,94 @@ void Client::agent() {
                     if (message.accepted) {
                         spdlog::info("Room creation accepted by server");
                         console.AddLog("--- Room creation accepted by server ---"); 
+                        subscribe(subscriber, message.publish);
                     } else {
                         spdlog::warn("Room creation rejected by server: {}", message.reason.value_or("No reason given"));
+                        {
+                            std::lock_guard<std::mutex> lock(d_roomMutex);
+                            d_joinedRooms.erase(message.roomId);
+                            if (d_roomId == message.roomId) {
+                                d_roomId.clear();
+                            }
+                        }
                         console.AddLog("--- Room creation Refused! ---"); 
                         console.AddLog(message.reason.value_or("Server Reason: No reason given"));
                     }
+                } else if (std::holds_alternative<ServerHistoryResponse>(payload)) {
+                    auto& message = std::get<ServerHistoryResponse>(payload);
+                    if (message.roomId != currentRoom()) {
+                        // asked for before we switched rooms, it is not the history on the console
+                        spdlog::debug("Dropping history page of room {}, no longer the current room", message.roomId);
+                        continue;
+                    }
+                    putOlderHistoryOnConsole(message.messages);
+                    d_oldestSequence = message.firstSequence;
+                    d_hasOlderHistory = message.hasMore;
+                    d_historyRequested = false;
+                } else if (std::holds_alternative<ServerSearchResponse>(payload)) {
+                    auto& message = std::get<ServerSearchResponse>(payload);
+                    if (message.roomId != currentRoom()) {
+                        // /more would page the new room with the old room's offsets
+                        spdlog::debug("Dropping search results of room {}, no longer the current room", message.roomId);
+                        continue;
+                    }
+                    putSearchResultsOnConsole(message);
+                    d_searchOffset = message.offset + static_cast<std::uint32_t>(message.hits.size());
+                    d_hasMoreResults = !message.hits.empty() && d_searchOffset < message.totalHits;
+                } else if (std::holds_alternative<ServerHistoryRangeResponse>(payload)) {
+                    auto& message = std::get<ServerHistoryRangeResponse>(payload);
+                    putHistoryRangeOnConsole(message);
+                    if (message.hasMore && !message.messages.empty()) {
+                        continueHistoryRange(dealer, message);
+                    }
+                } else if (std::holds_alternative<ServerDirectMessage>(payload)) {
+                    auto& message = std::get<ServerDirectMessage>(payload);
+                    console.AddLog(directLine(message.peerId, message.message));
+                } else if (std::holds_alternative<ServerDirectHistoryResponse>(payload)) {
+                    auto& message = std::get<ServerDirectHistoryResponse>(payload);
+                    if (message.messages.empty()) {
+                        console.AddLog("--- No direct messages with " + message.peerId + " ---");
+                    }
+                    for (const auto& direct : message.messages) {
+                        console.AddLog(directLine(message.peerId, direct));
+                    }
+                } else if (std::holds_alternative<ServerRateLimited>(payload)) {
+                    auto& message = std::get<ServerRateLimited>(payload);
+                    // dropped chat was never given a sequence, so it will not show up as a gap to explain
+                    d_unseenOwnMessages -= std::min<std::uint64_t>(message.dropped, d_unseenOwnMessages);
+                    console.AddLog("--- Sending too fast, " + std::to_string(message.dropped) +
+                                   " messages were not delivered (wait " + std::to_string(message.retryAfterMs) + "ms) ---");
+                } else if (std::holds_alternative<ServerSessionExpired>(payload)) {
+                    rejoinRooms(dealer, std::get<ServerSessionExpired>(payload));
                 } else {
                     spdlog::warn("Received unknown message type from server");
                 }
 
+            } else if (event.socket == subscriber) {
+                // published room chat, [topic][ServerBaseMessage]
+                zmq::message_t topic;
+                zmq::message_t message;
+                if (!subscriber.recv(topic, zmq::recv_flags::none).has_value()
+                    || !subscriber.recv(message, zmq::recv_flags::none).has_value()) {
+                    spdlog::warn("Failed to receive message on subscriber");
+                    continue;
+                }
+
+                auto baseMessage = deserialize_serverbasemsg(message.to_string_view());
+                if (!baseMessage.has_value() || !std::holds_alternative<ServerRoomChatMessage>(baseMessage->payload)) {
+                    spdlog::warn("Failed to deserialize published message in Client::agent");
+                    continue;
+                }
+
+                auto& chat = std::get<ServerRoomChatMessage>(baseMessage->payload);
+                if (!isJoined(chat.roomId)) {
+                    // a room we have since left, we are done with its topic
+                    if (d_publishTopics.erase(topic.to_string())) {
+                        subscriber.set(zmq::sockopt::unsubscribe, topic.to_string_view());
+                    }
+                    continue;
+                }
+                receiveRoomChat(std::move(chat), dealer);
             } // end if
         } // end for
 
@@ -194,16 +531,223 @@ void Client::agent() {
     // cleanup
     dealer.close();
     forwarder.close();
+    subscriber.close();
+}
+
+std::string Client::historyLine(const ServerChatMessage& message) const {
+    if (d_clientId == message.senderId) {
+        return "[ME] " + message.message;
+    }
+    return "[" + message.senderId + "] " + message.message;
 }
 
 void Client::putHistoryOnConsole(const std::vector<ServerChatMessage>& history) {
     for (const auto& message : history) {
-        std::string messageLine;
-        if (d_clientId == message.senderId) {
-            messageLine = "[ME] " + message.message;
-        } else {
-            messageLine = "[" + message.senderId + "] " + message.message;
+        console.AddLog(historyLine(message));
+    }
+}
+
+void Client::putHistoryRangeOnConsole(const ServerHistoryRangeResponse& response) {
+    if (response.messages.empty()) {
+        console.AddLog("--- No messages in that range ---");
+        return;
+    }
+
+    for (const auto& message : response.messages) {
+        std::time_t seconds = static_cast<std::time_t>(message.timestamp / 1'000'000'000);
+        std::tm local{};
+        localtime_r(&seconds, &local);
+        char time[16];
+        std::strftime(time, sizeof(time), "%H:%M:%S", &local);
+        console.AddLog(std::string(time) + " " + historyLine(message));
+    }
+}
+
+std::string Client::directLine(const std::string& peerId, const ServerChatMessage& message) const {
+    if (d_clientId == message.senderId) {
+        return "[ME -> " + peerId + "] " + message.message;
+    }
+    return "[" + message.senderId + " -> ME] " + message.message;
+}
+
+void Client::trackSequence(std::uint64_t sequence) {
+    std::uint64_t expected = d_nextSequence;
+    if (expected > 0 && sequence > expected) {
+        // the server skips the sender when broadcasting, so part of the jump may be our own messages
+        std::uint64_t jump = sequence - expected;
+        std::uint64_t own = std::min<std::uint64_t>(jump, d_unseenOwnMessages);
+        d_unseenOwnMessages -= own;
+        if (jump > own) {
+            console.AddLog("--- Missed " + std::to_string(jump - own) + " messages ---");
+        }
+    }
+    if (sequence >= expected) {
+        d_nextSequence = sequence + 1;
+    }
+}
+
+std::string Client::currentRoom() {
+    std::lock_guard<std::mutex> lock(d_roomMutex);
+    return d_roomId;
+}
+
+void Client::setRoom(const std::string& roomId) {
+    std::lock_guard<std::mutex> lock(d_roomMutex);
+    d_roomId = roomId;
+    d_joinedRooms.insert(roomId);
+}
+
+bool Client::isJoined(const std::string& roomId) {
+    std::lock_guard<std::mutex> lock(d_roomMutex);
+    return d_joinedRooms.contains(roomId);
+}
+
+void Client::receiveRoomChat(ServerRoomChatMessage&& chat, zmq::socket_t& dealer) {
+    if (chat.roomId == currentRoom()) {
+        receiveChat(std::move(chat.message), dealer);
+        return;
+    }
+
+    // publishing sends our own messages back, and chat from a room we have left may still be in flight
+    if (chat.message.senderId == d_clientId || !isJoined(chat.roomId)) {
+        return;
+    }
+    console.AddLog("[#" + chat.roomId + "] " + historyLine(chat.message));
+}
+
+void Client::receiveChat(ServerChatMessage&& message, zmq::socket_t& dealer) {
+    spdlog::debug("Received message from server: {}", message.message);
+    if (d_catchingUp) {
+        d_pendingChat.push_back(std::move(message));
+        return;
+    }
+
+    std::uint64_t expected = d_nextSequence;
+    if (!d_publishAddress.empty()) {
+        if (message.sequence < expected) {
+            // already shown, replayed by a catch up
+            return;
+        }
+        if (expected > 0 && message.sequence > expected) {
+            // published chat has no per client queue on the server, a jump means we lost some
+            d_pendingChat.push_back(std::move(message));
+            startCatchUp(dealer);
+            return;
+        }
+    }
+
+    trackSequence(message.sequence);
+    if (message.senderId == d_clientId) {
+        // publishing sends our own messages back, they are already on the console
+        if (d_unseenOwnMessages > 0) {
+            --d_unseenOwnMessages;
+        }
+        return;
+    }
+    console.AddLog("[" + message.senderId + "] " + message.message);
+}
+
+void Client::startCatchUp(zmq::socket_t& dealer) {
+    ClientConnectionRequest resume{currentRoom(), d_nextSequence - 1};
+    auto serialized = serialize_clientbasemsg(ClientBaseMessage{d_clientId, resume});
+    if (!serialized.has_value()) {
+        spdlog::warn("Failed to serialize message in Client::startCatchUp");
+        return;
+    }
+
+    zmq::message_t msg_t(*serialized);
+    if (!dealer.send(msg_t, zmq::send_flags::none).has_value()) {
+        spdlog::warn("Failed to send message on dealer (from startCatchUp)");
+        return;
+    }
+    d_resuming = true;
+    d_catchingUp = true;
+}
+
+void Client::rejoinRooms(zmq::socket_t& dealer, const ServerSessionExpired& notice) {
+    spdlog::warn("Removed from {} rooms by the server: {}", notice.roomIds.size(), notice.reason);
+    console.AddLog("--- " + notice.reason + ", rejoining ---");
+    for (const auto& roomId : notice.roomIds) {
+        if (!isJoined(roomId)) {
+            // left since, the notice crossed our leave
+            continue;
+        }
+        if (roomId == currentRoom() && d_nextSequence > 0) {
+            startCatchUp(dealer);
+            continue;
+        }
+
+        ClientConnectionRequest join{roomId, std::nullopt};
+        auto serialized = serialize_clientbasemsg(ClientBaseMessage{d_clientId, join});
+        if (!serialized.has_value()) {
+            spdlog::warn("Failed to serialize message in Client::rejoinRooms");
+            continue;
+        }
+        zmq::message_t msg_t(*serialized);
+        if (!dealer.send(msg_t, zmq::send_flags::none).has_value()) {
+            spdlog::warn("Failed to send message on dealer (from rejoinRooms)");
         }
-        console.AddLog(messageLine);
     }
 }
+
+void Client::continueHistoryRange(zmq::socket_t& dealer, const ServerHistoryRangeResponse& response) {
+    ClientHistoryRangeRequest rangeRequest{response.roomId, response.messages.back().timestamp + 1,
+                                           response.toTimestamp, s_historyPageSize};
+    auto serialized = serialize_clientbasemsg(ClientBaseMessage{d_clientId, rangeRequest});
+    if (!serialized.has_value()) {
+        spdlog::warn("Failed to serialize message in Client::continueHistoryRange");
+        return;
+    }
+
+    zmq::message_t msg_t(*serialized);
+    if (!dealer.send(msg_t, zmq::send_flags::none).has_value()) {
+        spdlog::warn("Failed to send message on dealer (from continueHistoryRange)");
+    }
+}
+
+void Client::subscribe(zmq::socket_t& subscriber, const std::optional<RoomPublish>& publish) {
+    if (!publish.has_value()) {
+        return;
+    }
+
+    if (d_publishAddress.empty()) {
+        // a wildcard bind is reachable on the host we reach the server on
+        d_publishAddress = publish->address;
+        auto wildcard = d_publishAddress.find("*");
+        if (wildcard != std::string::npos) {
+            auto hostStart = d_serverAddr.find("://") + 3;
+            auto host = d_serverAddr.substr(hostStart, d_serverAddr.rfind(':') - hostStart);
+            d_publishAddress.replace(wildcard, 1, host);
+        }
+        subscriber.connect(d_publishAddress);
+        spdlog::info("Subscribing to room chat on {}", d_publishAddress);
+    }
+
+    if (d_publishTopics.insert(publish->topic).second) {
+        subscriber.set(zmq::sockopt::subscribe, publish->topic);
+    }
+}
+
+void Client::putOlderHistoryOnConsole(const std::vector<ServerChatMessage>& history) {
+    std::vector<std::string> lines;
+    lines.reserve(history.size());
+    for (const auto& message : history) {
+        lines.push_back(historyLine(message));
+    }
+    console.PrependLog(lines);
+}
+
+void Client::putSearchResultsOnConsole(const ServerSearchResponse& response) {
+    if (response.hits.empty()) {
+        console.AddLog("--- No results for \"" + response.query + "\" in " + response.roomId + " ---");
+        return;
+    }
+
+    console.AddLog("--- Results " + std::to_string(response.offset + 1) + "-" +
+                   std::to_string(response.offset + response.hits.size()) + " of " +
+                   std::to_string(response.totalHits) + " for \"" + response.query + "\" in " + response.roomId + " ---");
+    for (const auto& hit : response.hits) {
+        console.AddLog("#" + std::to_string(hit.sequence) + " " + historyLine(hit));
+    }
+    console.AddLog("--- End of results ---");
+}
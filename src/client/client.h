@@ -2,9 +2,12 @@
 
 #include "spdlog/spdlog.h"
 #include "console.h"
-#include "messaging.h"
+#include "messaging_view.h"
 
+#include <set>
+#include <mutex>
 #include <string>
+#include <vector>
 // enable drafts for zmq::poller_t
 #define ZMQ_BUILD_DRAFT_API
 #include <zmq.hpp>
@@ -20,9 +23,32 @@ public:
 
     void send(const std::string& message);
 
+    // joins roomId and makes it the room we talk in, the rooms joined before stay joined and their
+    // chat keeps arriving (marked with the room) until they are left
     void connectToServer(const std::string& roomId);
 
     void sendCreateRoomRequest(const std::string& roomId);
+
+    void leaveRoom(const std::string& roomId);
+
+    // asks the server for the page of history before the oldest message we have
+    void requestOlderHistory();
+
+    // searches the current room's history for messages containing every word of query
+    void search(const std::string& query);
+
+    // asks for the next page of the last search's results
+    void requestMoreResults();
+
+    // asks for the current room's messages stamped in [fromTimestamp, toTimestamp) (ns since the Unix epoch),
+    // the pages after the first are asked for as each one arrives
+    void requestHistoryRange(std::uint64_t fromTimestamp, std::uint64_t toTimestamp);
+
+    // sends message to targetId alone, whatever rooms either of us is in
+    void sendDirect(const std::string& targetId, const std::string& message);
+
+    // asks for the most recent direct messages between us and peerId that the server kept
+    void requestDirectHistory(const std::string& peerId);
     
     void agent();
     
@@ -44,6 +70,75 @@ public:
     std::string d_clientId;
     const std::string d_serverAddr;
 
+    // history paging state
+    std::mutex d_roomMutex;
+    std::string d_roomId; // guarded by d_roomMutex, the room we talk in, empty if none
+    std::set<std::string> d_joinedRooms; // guarded by d_roomMutex, d_roomId included
+    std::atomic<std::uint64_t> d_oldestSequence;
+    std::atomic_bool d_hasOlderHistory;
+    std::atomic_bool d_historyRequested;
+    // sequence tracking for the current room, used to spot gaps and to resume after a reconnect
+    std::atomic<std::uint64_t> d_nextSequence; // 0 until we have seen something from the room
+    std::atomic<std::uint64_t> d_unseenOwnMessages; // our own messages are not sent back to us
+    std::atomic_bool d_resuming;
+
+    // search paging state
+    std::string d_searchQuery; // guarded by d_roomMutex
+    std::atomic<std::uint32_t> d_searchOffset; // of the next page
+    std::atomic_bool d_hasMoreResults;
+
+    // publish mode state, only touched by the agent thread
+    std::string d_publishAddress; // empty until the server tells us to subscribe
+    std::set<std::string> d_publishTopics; // unsubscribed when chat arrives for a room we have left
+    bool d_catchingUp = false;
+    std::vector<ServerChatMessage> d_pendingChat; // published chat held back while catching up
+
+    static const std::uint32_t s_historyPageSize;
+    static const std::uint32_t s_searchPageSize;
+    static const std::chrono::milliseconds s_heartbeatInterval;
+
+    std::string historyLine(const ServerChatMessage& message) const;
+
     void putHistoryOnConsole(const std::vector<ServerChatMessage>& history);
 
+    void putOlderHistoryOnConsole(const std::vector<ServerChatMessage>& history);
+
+    void putSearchResultsOnConsole(const ServerSearchResponse& response);
+
+    void sendSearchRequest(const std::string& query, std::uint32_t offset);
+
+    // a history range response's messages, each with the time it was sent
+    void putHistoryRangeOnConsole(const ServerHistoryRangeResponse& response);
+
+    // a direct message line, marked with who it is between
+    std::string directLine(const std::string& peerId, const ServerChatMessage& message) const;
+
+    // advances d_nextSequence past a received message, noting on the console if anything was skipped
+    void trackSequence(std::uint64_t sequence);
+
+    std::string currentRoom();
+
+    // makes roomId the room we talk in, joined along with the rooms we are already in
+    void setRoom(const std::string& roomId);
+
+    bool isJoined(const std::string& roomId);
+
+    // puts chat from any room we are in on the console, the current room's goes through receiveChat
+    void receiveRoomChat(ServerRoomChatMessage&& chat, zmq::socket_t& dealer);
+
+    // puts a chat message of the current room on the console, in publish mode a gap starts a catch up instead
+    void receiveChat(ServerChatMessage&& message, zmq::socket_t& dealer);
+
+    // asks the server for everything after d_nextSequence (a resume), holding back published chat until it arrives
+    void startCatchUp(zmq::socket_t& dealer);
+
+    // asks for the page of a history range after response, on the agent's own dealer (d_sender is the UI thread's)
+    void continueHistoryRange(zmq::socket_t& dealer, const ServerHistoryRangeResponse& response);
+
+    // joins the rooms the server took us out of again, the current one resuming from d_nextSequence
+    void rejoinRooms(zmq::socket_t& dealer, const ServerSessionExpired& notice);
+
+    // subscribes to the room's topic (as well as those of the other rooms we are in) if the server publishes room chat
+    void subscribe(zmq::socket_t& subscriber, const std::optional<RoomPublish>& publish);
+
 };
\ No newline at end of file
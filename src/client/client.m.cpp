@@ -1,6 +1,9 @@
 #include "client.h"
 #include "spdlog/spdlog.h"
 
+#include <chrono>
+#include <limits>
+#include <cstdlib>
 #include <iostream>
 #include <string>
 #include <zmq.hpp>
@@ -37,9 +40,32 @@ int main(int argc, const char *argv[]){
             std::string roomId = message.substr(6);
             client.connectToServer(roomId);
 
+        } else if (message.find("/leave ") == 0) {
+            client.leaveRoom(message.substr(7));
         } else if (message.find("/create") == 0) {
             std::string roomId = message.substr(8);
             client.sendCreateRoomRequest(roomId);
+        } else if (message == "/history") {
+            client.requestOlderHistory();
+        } else if (message.find("/search ") == 0) {
+            client.search(message.substr(8));
+        } else if (message == "/more") {
+            client.requestMoreResults();
+        } else if (message.find("/dm ") == 0) {
+            // "/dm <client id> <message>"
+            auto split = message.find(' ', 4);
+            if (split != std::string::npos) {
+                client.sendDirect(message.substr(4, split - 4), message.substr(split + 1));
+            }
+        } else if (message.find("/dmhistory ") == 0) {
+            client.requestDirectHistory(message.substr(11));
+        } else if (message.find("/since ") == 0) {
+            // "/since <minutes>" shows what was said in the last few minutes
+            auto minutes = std::chrono::minutes(std::strtoul(message.c_str() + 7, nullptr, 10));
+            auto from = std::chrono::system_clock::now() - minutes;
+            client.requestHistoryRange(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(from.time_since_epoch()).count(),
+                std::numeric_limits<std::uint64_t>::max());
         } else if (message == "/exit") {
             break;
         } else { 
@@ -12,15 +12,22 @@
 #include <functional>
 
 using CallbackFunc = std::function<void(const std::string&)>;
+using LoadCallbackFunc = std::function<void()>;
 
 class Console {
 public:
 
     
-    Console(CallbackFunc sendMsgCallback, CallbackFunc joinRoomCallback, CallbackFunc createRoomCallback)
+    Console(CallbackFunc sendMsgCallback, CallbackFunc joinRoomCallback, CallbackFunc createRoomCallback,
+            CallbackFunc leaveRoomCallback, LoadCallbackFunc loadOlderCallback, CallbackFunc searchCallback,
+            LoadCallbackFunc moreResultsCallback)
     : sendMsgCallback_(sendMsgCallback)
     , joinRoomCallback_(joinRoomCallback)
     , createRoomCallback_(createRoomCallback)
+    , leaveRoomCallback_(leaveRoomCallback)
+    , loadOlderCallback_(loadOlderCallback)
+    , searchCallback_(searchCallback)
+    , moreResultsCallback_(moreResultsCallback)
     {}
 
     void AddLog(const std::string& message) {
@@ -28,6 +35,11 @@ public:
         scrollToBottom_ = true;  // Automatically scroll to the bottom when a message is added
     }
 
+    // older history goes above everything already in the log
+    void PrependLog(const std::vector<std::string>& messages) {
+        log_.insert(log_.begin(), messages.begin(), messages.end());
+    }
+
     void Draw(const std::string& title, bool* open) {
         ImGui::SetNextWindowSize(ImGui::GetIO().DisplaySize);
         ImGui::SetNextWindowPos(ImVec2(0, 0));
@@ -46,6 +58,12 @@ public:
             if (ImGui::MenuItem("Create Room")) {
                 showRoomCreateWindow_ = true;
             }
+            if (ImGui::MenuItem("Leave Room")) {
+                showRoomLeaveWindow_ = true;
+            }
+            if (ImGui::MenuItem("Search")) {
+                showSearchWindow_ = true;
+            }
             ImGui::EndMenuBar();
         }
 
@@ -73,10 +91,40 @@ public:
             ImGui::End();
         }
 
+        if (showRoomLeaveWindow_) {
+            ImGui::SetNextWindowSize(ImVec2(240, 100), ImGuiCond_Appearing);
+            ImGui::Begin("Leave Room", &showRoomLeaveWindow_, ImGuiWindowFlags_NoCollapse | ImGuiWindowFlags_NoScrollbar);
+            ImGui::InputText("Room Name", &roomNameBuffer_, ImGuiInputTextFlags_EnterReturnsTrue);
+            if (ImGui::Button("Leave")) {
+                leaveRoomCallback_(roomNameBuffer_);
+                showRoomLeaveWindow_ = false;
+                roomNameBuffer_ = ""; // Clear the input buffer
+            }
+            ImGui::End();
+        }
+
+        if (showSearchWindow_) {
+            ImGui::SetNextWindowSize(ImVec2(300, 100), ImGuiCond_Appearing);
+            ImGui::Begin("Search Room", &showSearchWindow_, ImGuiWindowFlags_NoCollapse | ImGuiWindowFlags_NoScrollbar);
+            ImGui::InputText("Words", &searchBuffer_, ImGuiInputTextFlags_EnterReturnsTrue);
+            if (ImGui::Button("Search")) {
+                searchCallback_(searchBuffer_);
+            }
+            ImGui::SameLine();
+            if (ImGui::Button("More results")) {
+                moreResultsCallback_();
+            }
+            ImGui::End();
+        }
+
         // --- the console text region and input box ---
 
         // Scrollable region for the log
         if (ImGui::BeginChild("ScrollingRegion", ImVec2(0, -ImGui::GetFrameHeightWithSpacing()), true)) {
+            if (ImGui::Button("Load older messages")) {
+                loadOlderCallback_();
+            }
+
             for (const std::string& message : log_) {
                 ImGui::TextUnformatted(message.c_str());
             }
@@ -121,4 +169,14 @@ private:
 
     bool showRoomCreateWindow_ = false;         // Flag to show the create join window
     CallbackFunc createRoomCallback_; // Functor to handle room creation action
+
+    bool showRoomLeaveWindow_ = false;        // Flag to show the room leave window
+    CallbackFunc leaveRoomCallback_;          // Functor to handle leaving a room
+
+    LoadCallbackFunc loadOlderCallback_; // Functor to request an older page of history
+
+    bool showSearchWindow_ = false;           // Flag to show the search window
+    std::string searchBuffer_;                // Buffer for the search words
+    CallbackFunc searchCallback_;             // Functor to search the current room
+    LoadCallbackFunc moreResultsCallback_;    // Functor to request the next page of search results
 };
\ No newline at end of file
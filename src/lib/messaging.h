@@ -10,9 +10,49 @@ Base Client Message:
 Messages Clients can send:
 1. Connection Request
 - room ID (string)
+- optional sequence of the last message the client has from the room, the
+  server then only replies with the messages after it
+- a client can be in any number of rooms at once, joining one never leaves another
 
 2. Chat Message
--  message
+- room ID (string), one of the rooms the client is in
+- message
+
+3. Create Room Request
+- room ID (string)
+
+4. History Request
+- room ID (string)
+- before sequence (page ends just before this message)
+- count
+
+5. Heartbeat
+- no payload, tells the server the client is still there
+
+6. Search Request
+- room ID (string)
+- query, the words a message must all contain (case insensitive)
+- offset into the ranked hits and how many to return
+- only the history the server retains for the room is searched, older
+  messages (even if logged) never match
+
+7. History Range Request
+- room ID (string)
+- from and to timestamps, asks for the messages stamped in [from, to)
+- count, the most messages to return
+
+8. Leave Room Request
+- room ID (string)
+
+9. Direct Message
+- target ID, the client to send the message to
+- message
+- goes to the target alone, no room is involved
+
+10. Direct History Request
+- peer ID, the other client of the conversation
+- before sequence (page ends just before this message)
+- count
 
 --- Messages Server can send ---
 
@@ -20,17 +60,79 @@ Base Server Message:
 - payload (variant)
 
 1. Connection Response
+- room ID
 - bool (accepted or not)
 - optional reason message
+- the most recent history and the sequence of its first message
+- optional publish endpoint and topic, set when the server publishes room chat
+  on a PUB socket instead of sending it to each member
 
 2. Chat Message
+- room ID
 - sender ID
 - message
+- sequence
+- timestamp
+
+3. Create Room Response
+- room ID
+- bool (accepted or not)
+- optional reason message
+- optional publish endpoint and topic (as in the Connection Response)
+
+4. History Response
+- room ID
+- a page of history, the sequence of its first message
+- whether older messages are still available
+
+5. Search Response
+- room ID and the query searched for
+- a page of the matching messages, best match first
+- the offset the page starts at and how many messages matched in total
+
+6. History Range Response
+- room ID and the range asked for
+- the messages stamped in the range, oldest first, up to the count asked for
+- whether the range holds more (ask again from the last timestamp + 1)
+
+7. Direct Message
+- peer ID, the client that sent it
+- the message, stamped like a room's but with the sequence of the pair's conversation
+
+8. Direct History Response
+- peer ID
+- a page of the pair's history, the sequence of its first message
+- whether older messages are still available
+
+9. Rate Limited
+- how many of the client's messages were dropped for going over its rate
+  since the last notice (they were never delivered to anyone)
+- how long until the next message would be let through, in milliseconds
+
+10. Session Expired
+- the rooms the server removed the client from without being asked (it
+  stopped sending heartbeats, or stopped reading what it was sent)
+- the reason
+- sent again in answer to the client's next heartbeat, the client joins the
+  rooms again (resuming from the last sequence it has)
+
+A message's sequence is its position in the room's history (0 is the first
+message ever sent in the room). Sequences are stamped by the server and go up
+by exactly one per message, so a client that sees a jump has missed messages.
+
+A timestamp is the time the server added the message to the room, in
+nanoseconds since the Unix epoch. They only go up within a room.
+
+Direct messages between two clients are numbered and stamped the same way
+within their conversation, when the server keeps direct history (otherwise
+their sequence is always 0).
 */
 
 #pragma once
 
 #include <string>
+#include <vector>
+#include <cstdint>
 #include <optional>
 #include <variant>
 
@@ -39,52 +141,222 @@ Base Server Message:
 // --- Client Messages ---
 
 struct ClientChatMessage {
+    // 2 members to serialize
+    using serialize = zpp::bits::members<2>;
+
+    std::string roomId;
     std::string message;
 };
 
 struct ClientConnectionRequest { 
+    // 2 members to serialize
+    using serialize = zpp::bits::members<2>;
+
     std::string roomId;
+    // set when resuming a room, the response then only carries what came after it
+    std::optional<std::uint64_t> lastSequence;
 };
 
 struct ClientCreateRoomRequest {
     std::string roomId;
 };
 
+struct ClientHistoryRequest {
+    // 3 members to serialize
+    using serialize = zpp::bits::members<3>;
+
+    std::string roomId;
+    std::uint64_t beforeSequence;
+    std::uint32_t count;
+};
+
+struct ClientHeartbeat {
+};
+
+struct ClientSearchRequest {
+    // 4 members to serialize
+    using serialize = zpp::bits::members<4>;
+
+    std::string roomId;
+    std::string query;
+    std::uint32_t offset;
+    std::uint32_t count;
+};
+
+struct ClientHistoryRangeRequest {
+    // 4 members to serialize
+    using serialize = zpp::bits::members<4>;
+
+    std::string roomId;
+    std::uint64_t fromTimestamp;
+    std::uint64_t toTimestamp;
+    std::uint32_t count;
+};
+
+struct ClientLeaveRoomRequest {
+    std::string roomId;
+};
+
+struct ClientDirectMessage {
+    // 2 members to serialize
+    using serialize = zpp::bits::members<2>;
+
+    std::string targetId;
+    std::string message;
+};
+
+struct ClientDirectHistoryRequest {
+    // 3 members to serialize
+    using serialize = zpp::bits::members<3>;
+
+    std::string peerId;
+    std::uint64_t beforeSequence;
+    std::uint32_t count;
+};
+
 struct ClientBaseMessage {
     // 2 members to serialize
     using serialize = zpp::bits::members<2>;
     
     std::string senderId;
-    std::variant<ClientConnectionRequest, ClientChatMessage, ClientCreateRoomRequest> payload;
+    std::variant<ClientConnectionRequest, ClientChatMessage, ClientCreateRoomRequest, ClientHistoryRequest,
+                 ClientHeartbeat, ClientSearchRequest, ClientHistoryRangeRequest, ClientLeaveRoomRequest,
+                 ClientDirectMessage, ClientDirectHistoryRequest> payload;
 };
 
 
 // --- server Messages ---
 
 struct ServerChatMessage {
+    // 4 members to serialize
+    using serialize = zpp::bits::members<4>;
+
     std::string senderId;
     std::string message;
+    // stamped by the server when the message is added to the room's history
+    std::uint64_t sequence = 0;
+    // ns since the Unix epoch, stamped along with the sequence
+    std::uint64_t timestamp = 0;
+};
+
+// where a room's chat is published when the server runs in publish mode, chat
+// messages then arrive on a SUB socket as [topic][ServerBaseMessage] instead of
+// over the DEALER socket
+struct RoomPublish {
+    // as bound by the server, a * host means the host the client connected to
+    std::string address;
+    std::string topic;
+};
+
+// a message said in one of the rooms the client is in, as it is sent to the room's members
+struct ServerRoomChatMessage {
+    // 2 members to serialize
+    using serialize = zpp::bits::members<2>;
+
+    std::string roomId;
+    ServerChatMessage message;
 };
 
 struct ServerConnectionResponse {
-    // 3 members to serialize
-    using serialize = zpp::bits::members<3>;
+    // 6 members to serialize
+    using serialize = zpp::bits::members<6>;
 
+    std::string roomId;
     bool accepted;
     std::optional<std::string> reason;
+    // only the tail of the room's history, older pages are fetched with ClientHistoryRequest
     std::vector<ServerChatMessage> chatHistory; 
+    std::uint64_t historyStart;
+    std::optional<RoomPublish> publish;
 };
 
 struct ServerCreateRoomResponse {
-    // 2 members to serialize
-    using serialize = zpp::bits::members<2>;
+    // 4 members to serialize
+    using serialize = zpp::bits::members<4>;
 
+    std::string roomId;
     bool accepted;
     std::optional<std::string> reason;
+    std::optional<RoomPublish> publish;
+};
+
+struct ServerHistoryResponse {
+    // 4 members to serialize
+    using serialize = zpp::bits::members<4>;
+
+    std::string roomId;
+    std::vector<ServerChatMessage> messages;
+    std::uint64_t firstSequence;
+    bool hasMore;
+};
+
+struct ServerSearchResponse {
+    // 5 members to serialize
+    using serialize = zpp::bits::members<5>;
+
+    std::string roomId;
+    std::string query;
+    // only messages still in the room's retained history are searched
+    std::vector<ServerChatMessage> hits;
+    std::uint32_t offset;
+    std::uint64_t totalHits;
+};
+
+struct ServerHistoryRangeResponse {
+    // 5 members to serialize
+    using serialize = zpp::bits::members<5>;
+
+    std::string roomId;
+    std::uint64_t fromTimestamp;
+    std::uint64_t toTimestamp;
+    // only messages still in the room's retained history
+    std::vector<ServerChatMessage> messages;
+    bool hasMore;
+};
+
+// a message another client sent this one directly
+struct ServerDirectMessage {
+    // 2 members to serialize
+    using serialize = zpp::bits::members<2>;
+
+    std::string peerId;
+    ServerChatMessage message;
+};
+
+struct ServerDirectHistoryResponse {
+    // 4 members to serialize
+    using serialize = zpp::bits::members<4>;
+
+    std::string peerId;
+    // both clients' messages, oldest first
+    std::vector<ServerChatMessage> messages;
+    std::uint64_t firstSequence;
+    bool hasMore;
+};
+
+// sent (at most about once a second) to a client whose messages are being dropped for going over its rate
+struct ServerRateLimited {
+    // 2 members to serialize
+    using serialize = zpp::bits::members<2>;
+
+    std::uint64_t dropped;
+    std::uint32_t retryAfterMs;
+};
+
+// sent to a client the server took out of its rooms without being asked (its session timed out, or it
+// stopped reading what it was sent), and again in answer to its next heartbeat. The client joins them again
+struct ServerSessionExpired {
+    // 2 members to serialize
+    using serialize = zpp::bits::members<2>;
+
+    std::vector<std::string> roomIds;
+    std::string reason;
 };
 
 struct ServerBaseMessage {
-    std::variant<ServerChatMessage, ServerConnectionResponse, ServerCreateRoomResponse> payload;
+    std::variant<ServerRoomChatMessage, ServerConnectionResponse, ServerCreateRoomResponse, ServerHistoryResponse,
+                 ServerSearchResponse, ServerHistoryRangeResponse, ServerDirectMessage,
+                 ServerDirectHistoryResponse, ServerRateLimited, ServerSessionExpired> payload;
 };
 
 // --- Serialization/Deserialization Of Base Messages ---
@@ -0,0 +1,175 @@
+#pragma once
+
+#include "messaging.h"
+
+#include <string>
+#include <variant>
+#include <tuple>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <type_traits>
+
+// --- Decoding Straight From A Received Buffer ---
+// Decodes from a view of the received bytes (e.g. a zmq::message_t's
+// to_string_view()) instead of copying the frame into a std::string first.
+
+template <typename Message>
+std::optional<Message> deserialize_from(std::string_view data) {
+    auto in = zpp::bits::in(data);
+
+    Message message;
+    auto res = in(message);
+    if (failure(res)) {
+        return std::nullopt;
+    }
+
+    return message;
+}
+
+inline
+std::optional<ClientBaseMessage> deserialize_clientbasemsg(std::string_view data) {
+    return deserialize_from<ClientBaseMessage>(data);
+}
+
+inline
+std::optional<ServerBaseMessage> deserialize_serverbasemsg(std::string_view data) {
+    return deserialize_from<ServerBaseMessage>(data);
+}
+
+// --- Borrowed Client Messages ---
+// The client messages with every string a view into the buffer they were
+// decoded from, so decoding allocates and copies nothing. Only valid while that
+// buffer is, anything kept past it has to be copied out. They must stay field
+// for field the same as the owning types above (they decode the same bytes).
+
+struct ClientChatMessageView {
+    using serialize = zpp::bits::members<2>;
+
+    std::string_view roomId;
+    std::string_view message;
+};
+
+struct ClientConnectionRequestView {
+    using serialize = zpp::bits::members<2>;
+
+    std::string_view roomId;
+    std::optional<std::uint64_t> lastSequence;
+};
+
+struct ClientCreateRoomRequestView {
+    std::string_view roomId;
+};
+
+struct ClientHistoryRequestView {
+    using serialize = zpp::bits::members<3>;
+
+    std::string_view roomId;
+    std::uint64_t beforeSequence;
+    std::uint32_t count;
+};
+
+struct ClientSearchRequestView {
+    using serialize = zpp::bits::members<4>;
+
+    std::string_view roomId;
+    std::string_view query;
+    std::uint32_t offset;
+    std::uint32_t count;
+};
+
+struct ClientHistoryRangeRequestView {
+    using serialize = zpp::bits::members<4>;
+
+    std::string_view roomId;
+    std::uint64_t fromTimestamp;
+    std::uint64_t toTimestamp;
+    std::uint32_t count;
+};
+
+struct ClientLeaveRoomRequestView {
+    std::string_view roomId;
+};
+
+struct ClientDirectMessageView {
+    using serialize = zpp::bits::members<2>;
+
+    std::string_view targetId;
+    std::string_view message;
+};
+
+struct ClientDirectHistoryRequestView {
+    using serialize = zpp::bits::members<3>;
+
+    std::string_view peerId;
+    std::uint64_t beforeSequence;
+    std::uint32_t count;
+};
+
+struct ClientBaseMessageView {
+    using serialize = zpp::bits::members<2>;
+
+    std::string_view senderId;
+    std::variant<ClientConnectionRequestView, ClientChatMessageView, ClientCreateRoomRequestView,
+                 ClientHistoryRequestView, ClientHeartbeat, ClientSearchRequestView,
+                 ClientHistoryRangeRequestView, ClientLeaveRoomRequestView, ClientDirectMessageView,
+                 ClientDirectHistoryRequestView> payload;
+};
+
+inline
+std::optional<ClientBaseMessageView> deserialize_clientbasemsg_view(std::string_view data) {
+    return deserialize_from<ClientBaseMessageView>(data);
+}
+
+// --- Keeping The Views In Step With The Owning Types ---
+// Owned<View>::type is the owning type a view decodes the same bytes as, a
+// compile error below means a view's fields (count, order or types) no longer
+// match its owning type's, so it would decode something else.
+
+template <typename View>
+struct Owned { using type = View; };
+
+template <>
+struct Owned<std::string_view> { using type = std::string; };
+
+template <typename View>
+struct Owned<std::optional<View>> { using type = std::optional<typename Owned<View>::type>; };
+
+template <typename... Views>
+struct Owned<std::variant<Views...>> { using type = std::variant<typename Owned<Views>::type...>; };
+
+template <> struct Owned<ClientChatMessageView> { using type = ClientChatMessage; };
+template <> struct Owned<ClientConnectionRequestView> { using type = ClientConnectionRequest; };
+template <> struct Owned<ClientCreateRoomRequestView> { using type = ClientCreateRoomRequest; };
+template <> struct Owned<ClientHistoryRequestView> { using type = ClientHistoryRequest; };
+template <> struct Owned<ClientSearchRequestView> { using type = ClientSearchRequest; };
+template <> struct Owned<ClientHistoryRangeRequestView> { using type = ClientHistoryRangeRequest; };
+template <> struct Owned<ClientLeaveRoomRequestView> { using type = ClientLeaveRoomRequest; };
+template <> struct Owned<ClientDirectMessageView> { using type = ClientDirectMessage; };
+template <> struct Owned<ClientDirectHistoryRequestView> { using type = ClientDirectHistoryRequest; };
+template <> struct Owned<ClientBaseMessageView> { using type = ClientBaseMessage; };
+
+template <typename View>
+constexpr bool decodesAsOwned() {
+    using Owning = typename Owned<View>::type;
+    return zpp::bits::number_of_members<View>() == zpp::bits::number_of_members<Owning>() &&
+           // the visitor's result is only returned as a default constructed value of its type, so the answer is the type
+           decltype(zpp::bits::visit_members_types<View>([]<typename... ViewFields>() {
+               return zpp::bits::visit_members_types<Owning>([]<typename... OwningFields>() {
+                   return std::is_same<std::tuple<typename Owned<std::remove_cvref_t<ViewFields>>::type...>,
+                                       std::tuple<std::remove_cvref_t<OwningFields>...>>{};
+               });
+           }))::value;
+}
+
+static_assert(decodesAsOwned<ClientChatMessageView>());
+static_assert(decodesAsOwned<ClientConnectionRequestView>());
+static_assert(decodesAsOwned<ClientCreateRoomRequestView>());
+static_assert(decodesAsOwned<ClientHistoryRequestView>());
+static_assert(decodesAsOwned<ClientSearchRequestView>());
+static_assert(decodesAsOwned<ClientHistoryRangeRequestView>());
+static_assert(decodesAsOwned<ClientLeaveRoomRequestView>());
+static_assert(decodesAsOwned<ClientDirectMessageView>());
+static_assert(decodesAsOwned<ClientDirectHistoryRequestView>());
+// the payload alternatives too, in the same order (the variant encodes the index)
+static_assert(decodesAsOwned<ClientBaseMessageView>());
@@ -0,0 +1,376 @@
+#include "server.h"
+#include "metrics.h"
+#include "messaging_view.h"
+#include "spdlog/spdlog.h"
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <charconv>
+#include <optional>
+#include <algorithm>
+#include <thread>
+#include <vector>
+#include <zmq.hpp>
+
+/*
+Usage: ./loadgen [--address <addr>] [--clients <n>] [--threads <n>] [--rooms <name[:weight],...>] [--rate <msgs/s>]
+                 [--duration <s>] [--size <bytes>] [--spawn <server worker threads>]
+
+--address   server to load (default tcp://127.0.0.1:8888)
+--clients   DEALER connections to open (default 1000)
+--threads   threads the connections are spread across (default 4)
+--rooms     rooms to spread the clients over, weighted, e.g. general:3,games:1 (default general)
+            rooms that do not exist yet are created by the first client assigned to them
+--rate      chat messages per second sent across all clients (default 10000)
+--duration  seconds to send for (default 10)
+--size      bytes per chat message (default 64)
+--spawn     run a server in this process on --address instead of using an external one
+
+Every chat message carries the time it was sent, every client that receives it
+records the end-to-end delivery latency. Opening thousands of connections needs
+a raised file descriptor limit (ulimit -n).
+*/
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct LoadConfig {
+    std::string address = "tcp://127.0.0.1:8888";
+    std::size_t clients = 1000;
+    std::size_t threads = 4;
+    std::string rooms = "general";
+    double rate = 10000;
+    std::chrono::seconds duration{10};
+    std::size_t size = 64;
+    std::optional<std::size_t> spawnWorkers;
+};
+
+struct RoomShare {
+    std::string id;
+    double weight;
+};
+
+struct LoadClient {
+    std::string id;
+    std::string room;
+    zmq::socket_t socket;
+    Clock::time_point lastSent;
+};
+
+// written by one load thread, read once it has been joined
+struct ThreadResult {
+    LatencyHistogram latencyNs;
+    std::uint64_t sent = 0;
+    std::uint64_t backpressured = 0;
+    std::uint64_t delivered = 0;
+};
+
+const std::chrono::milliseconds s_heartbeatInterval(2000);
+const std::chrono::milliseconds s_replyTimeout(5000);
+const std::chrono::seconds s_drainTime(1);
+
+std::uint64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+std::vector<RoomShare> parseRooms(const std::string& spec) {
+    std::vector<RoomShare> rooms;
+    std::size_t start = 0;
+    while (start <= spec.size()) {
+        auto end = spec.find(',', start);
+        if (end == std::string::npos) {
+            end = spec.size();
+        }
+
+        auto entry = spec.substr(start, end - start);
+        auto colon = entry.find(':');
+        if (!entry.empty()) {
+            rooms.push_back(colon == std::string::npos
+                                ? RoomShare{entry, 1.0}
+                                : RoomShare{entry.substr(0, colon), std::stod(entry.substr(colon + 1))});
+        }
+        start = end + 1;
+    }
+    return rooms;
+}
+
+// the room of each client, in proportion to the weights
+std::vector<std::string> assignRooms(const std::vector<RoomShare>& rooms, std::size_t clients) {
+    double total = 0;
+    for (const auto& room : rooms) {
+        total += room.weight;
+    }
+
+    std::vector<std::string> assignment;
+    assignment.reserve(clients);
+    double cumulative = 0;
+    for (const auto& room : rooms) {
+        cumulative += room.weight;
+        auto upTo = static_cast<std::size_t>(cumulative / total * clients + 0.5);
+        while (assignment.size() < std::min(upTo, clients)) {
+            assignment.push_back(room.id);
+        }
+    }
+    while (assignment.size() < clients) {
+        assignment.push_back(rooms.back().id);
+    }
+    return assignment;
+}
+
+bool sendMessage(zmq::socket_t& socket, const ClientBaseMessage& message) {
+    auto serialized = serialize_clientbasemsg(message);
+    if (!serialized.has_value()) {
+        return false;
+    }
+    zmq::message_t msg(*serialized);
+    return socket.send(msg, zmq::send_flags::dontwait).has_value();
+}
+
+std::optional<ServerBaseMessage> awaitReply(zmq::socket_t& socket) {
+    zmq::message_t reply;
+    if (!socket.recv(reply, zmq::recv_flags::none).has_value()) {
+        return std::nullopt;
+    }
+    return deserialize_serverbasemsg(reply.to_string_view());
+}
+
+// the first client of each room creates it (or joins it if it already exists), then everyone else joins
+std::size_t joinRooms(std::vector<LoadClient>& clients) {
+    std::vector<bool> joined(clients.size(), false);
+    std::vector<std::string> seenRooms;
+
+    for (std::size_t i = 0; i < clients.size(); ++i) {
+        auto& client = clients[i];
+        if (std::find(seenRooms.begin(), seenRooms.end(), client.room) != seenRooms.end()) {
+            continue;
+        }
+        seenRooms.push_back(client.room);
+
+        sendMessage(client.socket, ClientBaseMessage{client.id, ClientCreateRoomRequest{client.room}});
+        auto reply = awaitReply(client.socket);
+        if (reply.has_value() && std::holds_alternative<ServerCreateRoomResponse>(reply->payload)
+            && std::get<ServerCreateRoomResponse>(reply->payload).accepted) {
+            joined[i] = true;
+        }
+    }
+
+    // everyone else asks at once, then the replies are collected
+    for (std::size_t i = 0; i < clients.size(); ++i) {
+        if (!joined[i]) {
+            sendMessage(clients[i].socket, ClientBaseMessage{clients[i].id, ClientConnectionRequest{clients[i].room, std::nullopt}});
+        }
+    }
+
+    std::size_t accepted = 0;
+    for (std::size_t i = 0; i < clients.size(); ++i) {
+        if (!joined[i]) {
+            auto reply = awaitReply(clients[i].socket);
+            joined[i] = reply.has_value() && std::holds_alternative<ServerConnectionResponse>(reply->payload)
+                        && std::get<ServerConnectionResponse>(reply->payload).accepted;
+        }
+        accepted += joined[i];
+    }
+    return accepted;
+}
+
+void recordDeliveries(zmq::socket_t& socket, ThreadResult& result) {
+    while (true) {
+        zmq::message_t msg;
+        if (!socket.recv(msg, zmq::recv_flags::dontwait).has_value()) {
+            return;
+        }
+
+        auto base = deserialize_serverbasemsg(msg.to_string_view());
+        if (!base.has_value() || !std::holds_alternative<ServerRoomChatMessage>(base->payload)) {
+            continue;
+        }
+
+        // the text starts with the send time in ns
+        const auto& text = std::get<ServerRoomChatMessage>(base->payload).message.message;
+        std::uint64_t sentNs = 0;
+        auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), sentNs);
+        if (ec == std::errc{}) {
+            result.latencyNs.record(nowNs() - sentNs);
+            ++result.delivered;
+        }
+    }
+}
+
+// paces this thread's share of the rate round robin over its clients, receiving in between
+void runLoad(std::vector<LoadClient>& clients, const LoadConfig& config, double rate, ThreadResult& result) {
+    std::vector<zmq::pollitem_t> items;
+    for (auto& client : clients) {
+        items.push_back({client.socket.handle(), 0, ZMQ_POLLIN, 0});
+    }
+
+    auto start = Clock::now();
+    auto sendUntil = start + config.duration;
+    auto runUntil = sendUntil + s_drainTime;
+    auto interval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(rate > 0 ? 1.0 / rate : 1e9));
+    auto nextSend = start;
+    auto nextHeartbeatCheck = start + s_heartbeatInterval;
+    auto heartbeat = [](const std::string& id) { return ClientBaseMessage{id, ClientHeartbeat{}}; };
+    std::size_t next = 0;
+
+    while (true) {
+        auto now = Clock::now();
+        if (now >= runUntil) {
+            break;
+        }
+
+        // catch up on sends that are due, but never in a burst big enough to starve receiving
+        for (int burst = 0; now < sendUntil && now >= nextSend && burst < 256 && rate > 0; ++burst) {
+            auto& client = clients[next++ % clients.size()];
+            std::string text = std::to_string(nowNs()) + "|";
+            text.resize(std::max(config.size, text.size()), 'x');
+            if (sendMessage(client.socket, ClientBaseMessage{client.id, ClientChatMessage{client.room, std::move(text)}})) {
+                ++result.sent;
+                client.lastSent = now;
+            } else {
+                ++result.backpressured;
+            }
+            nextSend += interval;
+        }
+
+        // clients that only listen still have to keep their session alive
+        if (now >= nextHeartbeatCheck) {
+            for (auto& client : clients) {
+                if (now - client.lastSent >= s_heartbeatInterval) {
+                    sendMessage(client.socket, heartbeat(client.id));
+                    client.lastSent = now;
+                }
+            }
+            nextHeartbeatCheck = now + s_heartbeatInterval / 2;
+        }
+
+        auto wakeAt = now < sendUntil ? std::min(nextSend, nextHeartbeatCheck) : runUntil;
+        auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(wakeAt - now);
+        zmq::poll(items.data(), items.size(), std::clamp(timeout, std::chrono::milliseconds(0), std::chrono::milliseconds(100)));
+
+        for (std::size_t i = 0; i < items.size(); ++i) {
+            if (items[i].revents & ZMQ_POLLIN) {
+                recordDeliveries(clients[i].socket, result);
+            }
+        }
+    }
+}
+
+} // namespace
+
+int main(int argc, const char *argv[]){
+
+    spdlog::set_level(spdlog::level::warn);
+
+    LoadConfig config;
+    for (int i = 1; i < argc; i += 2) {
+        std::string flag = argv[i];
+        if (i + 1 >= argc) {
+            spdlog::warn("Missing value for argument: {}", flag);
+            break;
+        }
+        if (flag == "--address") {
+            config.address = argv[i + 1];
+        } else if (flag == "--clients") {
+            config.clients = std::stoul(argv[i + 1]);
+        } else if (flag == "--threads") {
+            config.threads = std::stoul(argv[i + 1]);
+        } else if (flag == "--rooms") {
+            config.rooms = argv[i + 1];
+        } else if (flag == "--rate") {
+            config.rate = std::stod(argv[i + 1]);
+        } else if (flag == "--duration") {
+            config.duration = std::chrono::seconds(std::stoul(argv[i + 1]));
+        } else if (flag == "--size") {
+            config.size = std::stoul(argv[i + 1]);
+        } else if (flag == "--spawn") {
+            config.spawnWorkers = std::stoul(argv[i + 1]);
+        } else {
+            spdlog::warn("Unknown argument: {}", flag);
+        }
+    }
+
+    auto rooms = parseRooms(config.rooms);
+    if (rooms.empty() || config.clients == 0 || config.threads == 0) {
+        spdlog::error("Need at least one room, client and thread");
+        return 1;
+    }
+    config.threads = std::min(config.threads, config.clients);
+
+    std::unique_ptr<Server> server;
+    std::thread serverThread;
+    if (config.spawnWorkers.has_value()) {
+        ServerConfig serverConfig;
+        serverConfig.workerThreads = *config.spawnWorkers;
+        server = std::make_unique<Server>(config.address, serverConfig);
+        serverThread = std::thread(&Server::run, server.get());
+    }
+
+    zmq::context_t context(static_cast<int>(config.threads));
+    context.set(zmq::ctxopt::max_sockets, static_cast<int>(config.clients + 16));
+
+    // every socket is set up here, then handed to the thread that drives it
+    auto assignment = assignRooms(rooms, config.clients);
+    std::vector<std::vector<LoadClient>> perThread(config.threads);
+    for (std::size_t i = 0; i < config.clients; ++i) {
+        LoadClient client{"load-" + std::to_string(i), assignment[i], zmq::socket_t(context, ZMQ_DEALER), Clock::now()};
+        client.socket.set(zmq::sockopt::routing_id, client.id);
+        client.socket.set(zmq::sockopt::linger, 0);
+        client.socket.set(zmq::sockopt::rcvtimeo, static_cast<int>(s_replyTimeout.count()));
+        client.socket.connect(config.address);
+        perThread[i % config.threads].push_back(std::move(client));
+    }
+
+    std::size_t accepted = 0;
+    for (auto& clients : perThread) {
+        accepted += joinRooms(clients);
+    }
+    std::printf("%zu of %zu clients joined %zu rooms\n", accepted, config.clients, rooms.size());
+
+    std::vector<ThreadResult> results(config.threads);
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t < config.threads; ++t) {
+        // each thread owns a share of the rate in proportion to its clients
+        double rate = config.rate * perThread[t].size() / config.clients;
+        threads.emplace_back(runLoad, std::ref(perThread[t]), std::cref(config), rate, std::ref(results[t]));
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    LatencyHistogram::Buckets buckets{};
+    std::uint64_t sum = 0;
+    std::uint64_t max = 0;
+    std::uint64_t sent = 0;
+    std::uint64_t backpressured = 0;
+    std::uint64_t delivered = 0;
+    for (const auto& result : results) {
+        result.latencyNs.mergeInto(buckets);
+        sum += result.latencyNs.sum();
+        max = std::max(max, result.latencyNs.max());
+        sent += result.sent;
+        backpressured += result.backpressured;
+        delivered += result.delivered;
+    }
+    auto latency = LatencyHistogram::snapshotOf(buckets, sum, max);
+    double seconds = static_cast<double>(config.duration.count());
+
+    std::printf("%10s %12s %12s %14s %14s %10s %10s %10s %10s\n",
+                "target/s", "sent/s", "blocked", "delivered", "delivered/s", "p50_us", "p99_us", "p999_us", "max_us");
+    std::printf("%10.0f %12.0f %12llu %14llu %14.0f %10.1f %10.1f %10.1f %10.1f\n",
+                config.rate, sent / seconds, static_cast<unsigned long long>(backpressured),
+                static_cast<unsigned long long>(delivered), delivered / seconds,
+                latency.p50 / 1e3, latency.p99 / 1e3, latency.p999 / 1e3, latency.max / 1e3);
+
+    for (auto& clients : perThread) {
+        clients.clear();
+    }
+    if (server) {
+        server->stop();
+        serverThread.join();
+    }
+
+    return 0;
+}
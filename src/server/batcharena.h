@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cstddef>
+#include <algorithm>
+#include <memory>
+#include <optional>
+#include <memory_resource>
+
+/*
+Monotonic arena for everything that only lives for one pass of the server's
+receive loop (one receive batch and the room tasks it produces). Allocating is
+a pointer bump and nothing is freed until reset() drops it all at once.
+
+The arena starts out with one block. A batch that needs more spills over into
+heap blocks, and the next reset() grows the block to what the batch asked for
+(up to maxBytes, bigger batches keep spilling), so after a warm-up a batch never
+reaches the global allocator. After s_shrinkAfter batches in a row that used
+under a quarter of the block, it shrinks back to twice the most any of them used,
+so one oversized batch does not pin a big block forever.
+
+Only to be used from one thread.
+*/
+class BatchArena {
+
+public:
+    explicit BatchArena(std::size_t initialBytes = 64 * 1024, std::size_t maxBytes = 4 << 20);
+
+    std::pmr::memory_resource* resource();
+
+    // frees everything allocated since the last reset, returns true if that resized the block
+    // (grown for a batch that outgrew it, or shrunk back after small ones)
+    bool reset();
+
+    // size of the block a batch is served from
+    std::size_t capacity() const;
+
+    private:
+    static constexpr std::size_t s_shrinkAfter = 1024;
+
+    // passes allocations through to upstream, counting the bytes asked for
+    class Counting : public std::pmr::memory_resource {
+
+    public:
+        std::pmr::memory_resource* upstream = nullptr;
+        std::size_t bytes = 0;
+
+        private:
+        void* do_allocate(std::size_t bytes, std::size_t alignment) override;
+        void do_deallocate(void* ptr, std::size_t bytes, std::size_t alignment) override;
+        bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+    };
+
+    std::size_t d_initialBytes;
+    std::size_t d_maxBytes;
+    std::size_t d_capacity;
+    std::unique_ptr<std::byte[]> d_block;
+    Counting d_spill;    // between the arena and the heap, counts what spilled out of the block
+    std::optional<std::pmr::monotonic_buffer_resource> d_arena; // re-made whenever the block is
+    Counting d_used;     // in front of the arena, counts what the batch used
+    std::size_t d_smallBatches = 0; // in a row, since the block last changed
+    std::size_t d_smallPeak = 0;    // the most any of them used
+
+    void remake(std::size_t capacity);
+};
+
+inline
+BatchArena::BatchArena(std::size_t initialBytes, std::size_t maxBytes)
+: d_initialBytes(initialBytes)
+, d_maxBytes(std::max(initialBytes, maxBytes))
+, d_capacity(0)
+{
+    d_spill.upstream = std::pmr::new_delete_resource();
+    remake(initialBytes);
+}
+
+inline
+std::pmr::memory_resource* BatchArena::resource() {
+    return &d_used;
+}
+
+inline
+bool BatchArena::reset() {
+    d_arena->release();
+    auto used = d_used.bytes;
+    bool spilled = d_spill.bytes > 0;
+    d_used.bytes = 0;
+    d_spill.bytes = 0;
+
+    if (spilled) {
+        // what the batch asked for plus room for alignment (not the sum of the ever bigger blocks
+        // monotonic_buffer_resource asked the heap for), and at least a step up in case that was not enough
+        auto wanted = std::min(std::max(used + used / 4, d_capacity + d_capacity / 4), d_maxBytes);
+        d_smallBatches = 0;
+        d_smallPeak = 0;
+        if (wanted <= d_capacity) {
+            // already at maxBytes, the batch just spills
+            return false;
+        }
+        remake(wanted);
+        return true;
+    }
+
+    if (used >= d_capacity / 4 || d_capacity == d_initialBytes) {
+        d_smallBatches = 0;
+        d_smallPeak = 0;
+        return false;
+    }
+
+    d_smallPeak = std::max(d_smallPeak, used);
+    if (++d_smallBatches < s_shrinkAfter) {
+        return false;
+    }
+    // always smaller, the block is bigger than d_initialBytes and every batch used under a quarter of it
+    remake(std::max(d_initialBytes, 2 * d_smallPeak));
+    return true;
+}
+
+inline
+void BatchArena::remake(std::size_t capacity) {
+    d_arena.reset();
+    d_capacity = capacity;
+    d_block = std::make_unique<std::byte[]>(d_capacity);
+    d_arena.emplace(d_block.get(), d_capacity, &d_spill);
+    d_used.upstream = &*d_arena;
+    d_smallBatches = 0;
+    d_smallPeak = 0;
+}
+
+inline
+std::size_t BatchArena::capacity() const {
+    return d_capacity;
+}
+
+inline
+void* BatchArena::Counting::do_allocate(std::size_t size, std::size_t alignment) {
+    bytes += size;
+    return upstream->allocate(size, alignment);
+}
+
+inline
+void BatchArena::Counting::do_deallocate(void* ptr, std::size_t size, std::size_t alignment) {
+    upstream->deallocate(ptr, size, alignment);
+}
+
+inline
+bool BatchArena::Counting::do_is_equal(const std::pmr::memory_resource& other) const noexcept {
+    return this == &other;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "registry.h"
+#include "roomhistory.h"
+
+#include <list>
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+
+// The recent direct messages of pairs of clients that have messaged each
+// other, keyed by the pair's handles so finding a conversation is one hash
+// lookup with no strings involved. Each conversation is a RoomHistory of its
+// own (so it is bounded, numbered and stamped like a room's) but nothing else a
+// room has: no members, no shard, no log. At most maxConversations are kept,
+// the one written to least recently goes to make room for a new one, so memory
+// stays under maxConversations times the retention's byte limit.
+class DirectHistories {
+
+public:
+    DirectHistories(const HistoryRetention& retention, std::size_t maxConversations);
+
+    // adds a message between a and b (either order) and returns the stored copy, which carries
+    // the conversation's sequence
+    const ServerChatMessage& push(ClientHandle a, ClientHandle b, std::string_view senderId, std::string_view message,
+                                  std::uint64_t timestamp);
+
+    // nullptr if a and b have never messaged each other
+    const RoomHistory* find(ClientHandle a, ClientHandle b) const;
+
+    // conversations kept
+    std::size_t size() const;
+
+    private:
+    struct Conversation {
+        RoomHistory history;
+        std::list<std::uint64_t>::iterator recent; // its place in d_recent
+    };
+
+    HistoryRetention d_retention;
+    std::size_t d_maxConversations;
+    std::unordered_map<std::uint64_t, Conversation> d_histories;
+    std::list<std::uint64_t> d_recent; // pair keys, most recently written first
+
+    // the same for (a, b) and (b, a)
+    static std::uint64_t pairKey(ClientHandle a, ClientHandle b);
+};
+
+inline
+DirectHistories::DirectHistories(const HistoryRetention& retention, std::size_t maxConversations)
+: d_retention(retention)
+, d_maxConversations(std::max<std::size_t>(maxConversations, 1))
+{
+}
+
+inline
+const ServerChatMessage& DirectHistories::push(ClientHandle a, ClientHandle b, std::string_view senderId,
+                                               std::string_view message, std::uint64_t timestamp) {
+    auto key = pairKey(a, b);
+    auto it = d_histories.find(key);
+    if (it != d_histories.end()) {
+        d_recent.splice(d_recent.begin(), d_recent, it->second.recent);
+    } else {
+        if (d_histories.size() >= d_maxConversations) {
+            d_histories.erase(d_recent.back());
+            d_recent.pop_back();
+        }
+        d_recent.push_front(key);
+        it = d_histories.emplace(key, Conversation{RoomHistory(d_retention), d_recent.begin()}).first;
+    }
+
+    auto& history = it->second.history;
+    history.push(senderId, message, timestamp);
+    return history[history.size() - 1];
+}
+
+inline
+const RoomHistory* DirectHistories::find(ClientHandle a, ClientHandle b) const {
+    auto it = d_histories.find(pairKey(a, b));
+    return it == d_histories.end() ? nullptr : &it->second.history;
+}
+
+inline
+std::size_t DirectHistories::size() const {
+    return d_histories.size();
+}
+
+inline
+std::uint64_t DirectHistories::pairKey(ClientHandle a, ClientHandle b) {
+    auto [low, high] = std::minmax(a, b);
+    return static_cast<std::uint64_t>(low) << 32 | high;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <zmq.hpp>
+
+// Wakes a thread sleeping in zmq::poll when another thread hands it work
+// through an SpscRing, so a stage can wait on its sockets and its rings at once.
+//
+// The sleeper polls socket() along with its other sockets, announcing it is
+// about to with prepareSleep() and then checking its rings one last time. A
+// producer calls ring() after pushing, which only sends (an empty message on
+// the producer's own inproc socket) if the sleeper announced it was going to
+// sleep and nobody has woken it since, so a busy pipeline rings no bells.
+class Doorbell {
+
+public:
+    // binds the sleeper's end at address (inproc)
+    Doorbell(zmq::context_t& context, const std::string& address);
+
+    // for the sleeper to poll for ZMQ_POLLIN
+    zmq::socket_t& socket();
+
+    // sleeper, before its last look for work
+    void prepareSleep();
+
+    // sleeper, after the poll (or instead of it if there was work after all)
+    void woke();
+
+    // a socket for one producer thread to ring() with, only ever used by that thread
+    zmq::socket_t connectRinger(zmq::context_t& context) const;
+
+    // producer, after pushing
+    void ring(zmq::socket_t& ringer);
+
+    private:
+    std::string d_address;
+    zmq::socket_t d_socket;
+    std::atomic_bool d_asleep{false};
+};
+
+inline
+Doorbell::Doorbell(zmq::context_t& context, const std::string& address)
+: d_address(address)
+, d_socket(context, ZMQ_PULL)
+{
+    d_socket.set(zmq::sockopt::linger, 0);
+    d_socket.bind(d_address);
+}
+
+inline
+zmq::socket_t& Doorbell::socket() {
+    return d_socket;
+}
+
+inline
+void Doorbell::prepareSleep() {
+    d_asleep.store(true);
+    // pairs with the fence in ring(): either the producer sees we are asleep or we see what it pushed
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+inline
+void Doorbell::woke() {
+    d_asleep.store(false, std::memory_order_relaxed);
+    zmq::message_t bell;
+    while (d_socket.recv(bell, zmq::recv_flags::dontwait).has_value()) {
+    }
+}
+
+inline
+zmq::socket_t Doorbell::connectRinger(zmq::context_t& context) const {
+    zmq::socket_t ringer(context, ZMQ_PUSH);
+    ringer.set(zmq::sockopt::linger, 0);
+    ringer.connect(d_address);
+    return ringer;
+}
+
+inline
+void Doorbell::ring(zmq::socket_t& ringer) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (d_asleep.load(std::memory_order_relaxed) && d_asleep.exchange(false)) {
+        // a full pipe means a bell is already waiting to be heard
+        ringer.send(zmq::message_t(), zmq::send_flags::dontwait);
+    }
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+#include <string_view>
+
+/*
+Consistent hash ring mapping keys (room ids) to nodes.
+
+Every node is placed on the ring at virtualNodes points, a key belongs to the
+first node point at or after its own hash. Adding a node only takes over the
+keys that now fall just before its points, about 1/n of them, and every other
+key keeps its owner. Nodes are identified by their index in the list given to
+the constructor, so every process must be given the same list in the same order.
+*/
+class HashRing {
+
+public:
+    explicit HashRing(const std::vector<std::string>& nodes, std::size_t virtualNodes = 128);
+
+    // index of the node owning key
+    std::uint32_t owner(std::string_view key) const;
+
+    std::size_t nodeCount() const;
+
+    private:
+    // (hash, node) sorted by hash
+    std::vector<std::pair<std::uint64_t, std::uint32_t>> d_points;
+    std::size_t d_nodeCount;
+
+    // FNV-1a with a final mix so similar keys (room-1, room-2) spread around the ring
+    static std::uint64_t hash(std::string_view key);
+};
+
+inline
+HashRing::HashRing(const std::vector<std::string>& nodes, std::size_t virtualNodes)
+: d_nodeCount(nodes.size())
+{
+    d_points.reserve(nodes.size() * virtualNodes);
+    for (std::uint32_t node = 0; node < nodes.size(); ++node) {
+        for (std::size_t v = 0; v < virtualNodes; ++v) {
+            d_points.emplace_back(hash(nodes[node] + "#" + std::to_string(v)), node);
+        }
+    }
+    std::sort(d_points.begin(), d_points.end());
+}
+
+inline
+std::uint32_t HashRing::owner(std::string_view key) const {
+    if (d_points.empty()) {
+        return 0;
+    }
+
+    auto point = std::lower_bound(d_points.begin(), d_points.end(), std::make_pair(hash(key), std::uint32_t{0}));
+    if (point == d_points.end()) {
+        // wrap around
+        point = d_points.begin();
+    }
+    return point->second;
+}
+
+inline
+std::size_t HashRing::nodeCount() const {
+    return d_nodeCount;
+}
+
+inline
+std::uint64_t HashRing::hash(std::string_view key) {
+    std::uint64_t h = 14695981039346656037ull;
+    for (unsigned char c : key) {
+        h ^= c;
+        h *= 1099511628211ull;
+    }
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb3f99e1b1a87ull;
+    h ^= h >> 33;
+    return h;
+}
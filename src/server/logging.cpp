@@ -0,0 +1,119 @@
+#include "logging.h"
+#include "spdlog/async.h"
+#include "spdlog/sinks/stdout_color_sinks.h"
+
+#include <chrono>
+#include <memory>
+
+namespace {
+
+std::array<LogSampler, k_logCategoryCount> s_samplers;
+
+// owned here rather than by spdlog's registry so a new setup can replace it,
+// the async logger only holds a weak_ptr to it
+std::shared_ptr<spdlog::details::thread_pool> s_threadPool;
+
+spdlog::async_overflow_policy toSpdlog(LogOverflow overflow) {
+    switch (overflow) {
+        case LogOverflow::e_BLOCK:
+            return spdlog::async_overflow_policy::block;
+        case LogOverflow::e_DROP_OLDEST:
+            return spdlog::async_overflow_policy::overrun_oldest;
+        case LogOverflow::e_DROP_NEW:
+            return spdlog::async_overflow_policy::discard_new;
+    }
+    return spdlog::async_overflow_policy::discard_new;
+}
+
+std::int64_t steadyNowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+} // namespace
+
+void LogSampler::configure(const LogSampling& sampling) {
+    d_sampling = sampling;
+    d_seen.store(0, std::memory_order_relaxed);
+    d_sampledOut.store(0, std::memory_order_relaxed);
+    d_windowStart.store(0, std::memory_order_relaxed);
+    d_windowCount.store(0, std::memory_order_relaxed);
+}
+
+bool LogSampler::sample() {
+    auto seen = d_seen.fetch_add(1, std::memory_order_relaxed);
+    if (d_sampling.every == 0 || seen % d_sampling.every != 0) {
+        d_sampledOut.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    if (d_sampling.perSecond == 0) {
+        return true;
+    }
+
+    // one second windows, threads racing over a window boundary may let a few extra through
+    auto now = steadyNowNs();
+    auto start = d_windowStart.load(std::memory_order_relaxed);
+    if (now - start >= 1'000'000'000 && d_windowStart.compare_exchange_strong(start, now, std::memory_order_relaxed)) {
+        d_windowCount.store(0, std::memory_order_relaxed);
+    }
+    if (d_windowCount.fetch_add(1, std::memory_order_relaxed) < d_sampling.perSecond) {
+        return true;
+    }
+    d_sampledOut.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+void setupLogging(const LogConfig& config, spdlog::sink_ptr sink) {
+    for (std::size_t i = 0; i < k_logCategoryCount; ++i) {
+        s_samplers[i].configure(config.sampling[i]);
+    }
+    if (!sink) {
+        sink = std::make_shared<spdlog::sinks::stdout_color_sink_mt>();
+    }
+
+    std::shared_ptr<spdlog::details::thread_pool> threadPool;
+    std::shared_ptr<spdlog::logger> logger;
+    if (config.async) {
+        threadPool = std::make_shared<spdlog::details::thread_pool>(config.queueSize, 1);
+        logger = std::make_shared<spdlog::async_logger>("", sink, threadPool, toSpdlog(config.overflow));
+    } else {
+        logger = std::make_shared<spdlog::logger>("", sink);
+    }
+    logger->set_level(spdlog::default_logger_raw()->level());
+    spdlog::set_default_logger(std::move(logger));
+
+    // joins the old writer thread once it has written what it still had queued
+    s_threadPool = std::move(threadPool);
+}
+
+void shutdownLogging() {
+    auto logger = std::make_shared<spdlog::logger>("", std::make_shared<spdlog::sinks::stdout_color_sink_mt>());
+    logger->set_level(spdlog::default_logger_raw()->level());
+    spdlog::set_default_logger(std::move(logger));
+    s_threadPool.reset();
+}
+
+LogStats logStats() {
+    LogStats stats;
+    for (const auto& sampler : s_samplers) {
+        stats.sampledOut += sampler.sampledOut();
+    }
+    if (s_threadPool) {
+        stats.dropped = s_threadPool->overrun_counter() + s_threadPool->discard_counter();
+    }
+    return stats;
+}
+
+LogSampler& logSampler(LogCategory category) {
+    return s_samplers[static_cast<std::size_t>(category)];
+}
+
+std::optional<LogCategory> logCategoryFromName(std::string_view name) {
+    if (name == "chat") {
+        return LogCategory::e_CHAT;
+    }
+    if (name == "session") {
+        return LogCategory::e_SESSION;
+    }
+    return std::nullopt;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "spdlog/spdlog.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <utility>
+#include <optional>
+#include <string_view>
+
+/*
+Logging setup for the server.
+
+setupLogging() replaces spdlog's default logger, so the plain spdlog::info()
+calls everywhere keep working. In async mode records are formatted on the
+calling thread and handed to a bounded queue that one background thread
+writes out, so writing to stdout is off the hot path. When the queue is full
+the overflow policy decides between waiting, dropping the oldest queued record
+or dropping the new one.
+
+Records that happen per message go through logSampled() with a category, each
+category keeps 1 in `every` of its records and at most `perSecond` a second.
+Warnings and errors are logged with spdlog directly and never sampled.
+*/
+
+enum class LogCategory {
+    e_CHAT,     // every chat message received
+    e_SESSION   // clients connecting, joining, creating rooms and timing out
+};
+
+constexpr std::size_t k_logCategoryCount = 2;
+
+// what the async logger does with a record when its queue is full
+enum class LogOverflow {
+    e_BLOCK,        // wait for the writer, the caller is slowed to the sink's speed
+    e_DROP_OLDEST,  // overwrite the oldest queued record
+    e_DROP_NEW      // drop the new record
+};
+
+struct LogSampling {
+    // log 1 in every this many records, 0 logs none
+    std::size_t every = 1;
+    // at most this many of those a second, 0 is unlimited
+    std::size_t perSecond = 0;
+};
+
+struct LogConfig {
+    bool async = true;
+    // records the async queue holds before the overflow policy applies
+    std::size_t queueSize = 8192;
+    LogOverflow overflow = LogOverflow::e_DROP_NEW;
+    // by LogCategory. Chat is sampled 1 in 100 by default, a record per message would put the
+    // queue's lock on every message's path (--log-sample chat=1 logs them all)
+    std::array<LogSampling, k_logCategoryCount> sampling{LogSampling{100, 0}, LogSampling{}};
+};
+
+struct LogStats {
+    // records a sampler left out
+    std::uint64_t sampledOut = 0;
+    // records the async queue dropped because it was full
+    std::uint64_t dropped = 0;
+};
+
+// decides which records of one category are logged, safe to call from any thread
+class LogSampler {
+
+public:
+    // resets the counts, not to be called while other threads are sampling
+    void configure(const LogSampling& sampling);
+
+    bool sample();
+
+    std::uint64_t sampledOut() const;
+
+    private:
+    LogSampling d_sampling;
+    std::atomic<std::uint64_t> d_seen{0};
+    std::atomic<std::uint64_t> d_sampledOut{0};
+    // start (steady clock ns) and records logged of the current one second window
+    std::atomic<std::int64_t> d_windowStart{0};
+    std::atomic<std::uint64_t> d_windowCount{0};
+};
+
+// replaces spdlog's default logger (keeping its level), call before other threads log
+// sink defaults to stdout, benchmarks pass their own
+void setupLogging(const LogConfig& config, spdlog::sink_ptr sink = nullptr);
+
+// writes out everything still queued and goes back to a synchronous logger
+void shutdownLogging();
+
+LogStats logStats();
+
+LogSampler& logSampler(LogCategory category);
+
+std::optional<LogCategory> logCategoryFromName(std::string_view name);
+
+// logs the record if the level is enabled and the category's sampler keeps it,
+// a record that is left out is never formatted
+template <typename... Args>
+void logSampled(LogCategory category, spdlog::level::level_enum level, spdlog::format_string_t<Args...> format, Args&&... args);
+
+inline
+std::uint64_t LogSampler::sampledOut() const {
+    return d_sampledOut.load(std::memory_order_relaxed);
+}
+
+template <typename... Args>
+void logSampled(LogCategory category, spdlog::level::level_enum level, spdlog::format_string_t<Args...> format, Args&&... args) {
+    auto* logger = spdlog::default_logger_raw();
+    if (!logger->should_log(level) || !logSampler(category).sample()) {
+        return;
+    }
+    logger->log(level, format, std::forward<Args>(args)...);
+}
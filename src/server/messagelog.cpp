@@ -0,0 +1,543 @@
+#include "messagelog.h"
+#include "spdlog/spdlog.h"
+
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <fstream>
+#include <charconv>
+#include <iterator>
+#include <algorithm>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const std::size_t k_headerSize = 2 * sizeof(std::uint32_t);
+const std::string k_roomPrefix = "room-";
+const std::string k_segmentSuffix = ".log";
+
+// the layout of a segment's records, in its name as <first sequence>.v<version>.log
+// 1: {senderId, message}, the original records (their segments have no version in the name)
+// 2: ServerChatMessage
+const std::uint32_t k_firstRecordVersion = 1;
+const std::uint32_t k_recordVersion = 2;
+
+struct RecordV1 {
+    using serialize = zpp::bits::members<2>;
+
+    std::string senderId;
+    std::string message;
+};
+
+std::uint32_t crc32(const char* data, std::size_t size) {
+    static const auto table = [] {
+        std::array<std::uint32_t, 256> t{};
+        for (std::uint32_t i = 0; i < 256; ++i) {
+            std::uint32_t c = i;
+            for (int k = 0; k < 8; ++k) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            t[i] = c;
+        }
+        return t;
+    }();
+
+    std::uint32_t c = 0xFFFFFFFFu;
+    for (std::size_t i = 0; i < size; ++i) {
+        c = table[(c ^ static_cast<unsigned char>(data[i])) & 0xFF] ^ (c >> 8);
+    }
+    return c ^ 0xFFFFFFFFu;
+}
+
+// room ids are user supplied so they are hex encoded before going anywhere near a path
+std::string toHex(const std::string& value) {
+    static const char* digits = "0123456789abcdef";
+    std::string hex;
+    hex.reserve(value.size() * 2);
+    for (unsigned char c : value) {
+        hex.push_back(digits[c >> 4]);
+        hex.push_back(digits[c & 0xF]);
+    }
+    return hex;
+}
+
+std::optional<std::string> fromHex(const std::string& hex) {
+    if (hex.size() % 2 != 0) {
+        return std::nullopt;
+    }
+
+    std::string value;
+    value.reserve(hex.size() / 2);
+    for (std::size_t i = 0; i < hex.size(); i += 2) {
+        try {
+            value.push_back(static_cast<char>(std::stoi(hex.substr(i, 2), nullptr, 16)));
+        } catch (const std::exception&) {
+            return std::nullopt;
+        }
+    }
+    return value;
+}
+
+std::string segmentName(std::uint64_t sequence) {
+    char name[48];
+    std::snprintf(name, sizeof(name), "%020llu.v%u", static_cast<unsigned long long>(sequence), k_recordVersion);
+    return name + k_segmentSuffix;
+}
+
+// 0 if the name has a version we cannot make sense of
+std::uint32_t segmentVersion(const fs::path& path) {
+    auto version = path.stem().extension().string();
+    if (version.empty()) {
+        return k_firstRecordVersion;
+    }
+    if (version.rfind(".v", 0) != 0) {
+        return 0;
+    }
+    try {
+        return static_cast<std::uint32_t>(std::stoul(version.substr(2)));
+    } catch (const std::exception&) {
+        return 0;
+    }
+}
+
+// the sequence of a segment's first message, nothing if the name does not start with one
+std::optional<std::uint64_t> segmentStart(const std::string& name) {
+    auto digits = name.substr(0, name.find('.'));
+    std::uint64_t start;
+    auto [end, ec] = std::from_chars(digits.data(), digits.data() + digits.size(), start);
+    if (digits.empty() || ec != std::errc() || end != digits.data() + digits.size()) {
+        return std::nullopt;
+    }
+    return start;
+}
+
+bool readable(std::uint32_t version) {
+    return version == k_firstRecordVersion || version == k_recordVersion;
+}
+
+int syncFile(int fd) {
+#ifdef __APPLE__
+    return fsync(fd);
+#else
+    return fdatasync(fd);
+#endif
+}
+
+void syncDirectory(const std::string& directory) {
+    int fd = ::open(directory.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    fsync(fd);
+    ::close(fd);
+}
+
+std::string readFile(const fs::path& path) {
+    std::ifstream file(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+struct Segment {
+    std::uint64_t start;
+    std::uint32_t version;
+    fs::path path;
+    std::string data;
+    std::vector<std::size_t> offsets; // of each complete record
+};
+
+// finds the complete records in a segment, returns where the last one ends
+std::size_t scanSegment(Segment& segment) {
+    const auto& data = segment.data;
+    std::size_t pos = 0;
+    while (pos + k_headerSize <= data.size()) {
+        std::uint32_t size;
+        std::memcpy(&size, data.data() + pos, sizeof(size));
+        if (pos + k_headerSize + size > data.size()) {
+            break;
+        }
+        segment.offsets.push_back(pos);
+        pos += k_headerSize + size;
+    }
+    return pos;
+}
+
+bool recordValid(const std::string& data, std::size_t offset) {
+    std::uint32_t size;
+    std::uint32_t crc;
+    std::memcpy(&size, data.data() + offset, sizeof(size));
+    std::memcpy(&crc, data.data() + offset + sizeof(size), sizeof(crc));
+    return crc32(data.data() + offset + k_headerSize, size) == crc;
+}
+
+std::optional<ServerChatMessage> decodeRecord(const std::string& data, std::size_t offset, std::uint32_t version) {
+    if (!recordValid(data, offset)) {
+        return std::nullopt;
+    }
+
+    std::uint32_t size;
+    std::memcpy(&size, data.data() + offset, sizeof(size));
+
+    std::span<const char> record(data.data() + offset + k_headerSize, size);
+    auto in = zpp::bits::in(record);
+    if (version == k_recordVersion) {
+        ServerChatMessage message;
+        if (failure(in(message))) {
+            return std::nullopt;
+        }
+        return message;
+    }
+
+    if (version == k_firstRecordVersion) {
+        // the sequence is where the record is in the log (RoomHistory numbers replayed messages from
+        // startAt on) and RoomHistory stamps it 1ns after the message before it
+        RecordV1 legacy;
+        if (failure(in(legacy))) {
+            return std::nullopt;
+        }
+        return ServerChatMessage{std::move(legacy.senderId), std::move(legacy.message), 0, 0};
+    }
+    return std::nullopt;
+}
+
+} // namespace
+
+const std::size_t MessageLog::s_flushThreshold = 1 << 20;
+
+MessageLog::MessageLog(const MessageLogConfig& config)
+: d_config(config)
+{
+    fs::create_directories(d_config.directory);
+    d_flusher = std::thread(&MessageLog::runFlusher, this);
+}
+
+MessageLog::~MessageLog() {
+    {
+        std::lock_guard<std::mutex> lock(d_mutex);
+        d_stopping = true;
+    }
+    d_cv.notify_all();
+    if (d_flusher.joinable()) {
+        d_flusher.join();
+    }
+
+    writePending();
+    for (auto& [roomId, log] : d_rooms) {
+        if (log->fd >= 0) {
+            ::close(log->fd);
+        }
+    }
+}
+
+std::vector<std::string> MessageLog::roomIds() const {
+    std::vector<std::string> ids;
+    for (const auto& entry : fs::directory_iterator(d_config.directory)) {
+        auto name = entry.path().filename().string();
+        if (!entry.is_directory() || name.rfind(k_roomPrefix, 0) != 0) {
+            continue;
+        }
+        if (auto id = fromHex(name.substr(k_roomPrefix.size())); id.has_value()) {
+            ids.push_back(*id);
+        }
+    }
+    return ids;
+}
+
+std::optional<std::uint64_t> MessageLog::moveRoom(const std::string& room_id, const std::string& directory) {
+    fs::path from = roomDirectory(room_id);
+    fs::path to = fs::path(directory) / from.filename();
+    if (!fs::is_directory(from)) {
+        return std::nullopt;
+    }
+    if (fs::exists(to)) {
+        spdlog::error("Not moving the log of room {} to {}, it already has one", room_id, directory);
+        return std::nullopt;
+    }
+
+    std::uint64_t bytes = 0;
+    for (const auto& entry : fs::directory_iterator(from)) {
+        if (entry.is_regular_file()) {
+            bytes += entry.file_size();
+        }
+    }
+
+    fs::create_directories(directory);
+    std::error_code error;
+    fs::rename(from, to, error);
+    if (error) {
+        // another file system, the copy is made durable before the original goes
+        fs::copy(from, to, fs::copy_options::recursive);
+        for (const auto& entry : fs::directory_iterator(to)) {
+            int fd = ::open(entry.path().c_str(), O_RDONLY);
+            if (fd >= 0) {
+                fsync(fd);
+                ::close(fd);
+            }
+        }
+        syncDirectory(to.string());
+        fs::remove_all(from);
+    }
+    syncDirectory(directory);
+    syncDirectory(d_config.directory);
+    return bytes;
+}
+
+bool MessageLog::open(const std::string& room_id, RoomHistory& history) {
+    auto log = std::make_unique<RoomLog>();
+    log->directory = roomDirectory(room_id);
+    fs::create_directories(log->directory);
+
+    std::vector<Segment> segments;
+    for (const auto& entry : fs::directory_iterator(log->directory)) {
+        auto name = entry.path().filename().string();
+        if (entry.path().extension() != k_segmentSuffix) {
+            continue;
+        }
+        auto start = segmentStart(name);
+        if (!start.has_value()) {
+            spdlog::warn("Ignoring {} in the log of room {}, it is not named like a segment", name, room_id);
+            continue;
+        }
+        segments.push_back(Segment{*start, segmentVersion(entry.path()), entry.path(), {}, {}});
+    }
+    // an older segment can start where a newer format one does if it holds no records
+    std::sort(segments.begin(), segments.end(), [](const Segment& a, const Segment& b) {
+        return a.start != b.start ? a.start < b.start : a.version < b.version;
+    });
+
+    if (segments.empty()) {
+        log->writtenSequence = history.nextSequence();
+        std::lock_guard<std::mutex> lock(d_mutex);
+        d_rooms[room_id] = std::move(log);
+        return true;
+    }
+
+    // written by a newer server: where the room's sequences continue is unknown, so it is not logged
+    // at all rather than appended to with sequences the segment may already hold
+    if (!readable(segments.back().version)) {
+        spdlog::error("Not logging room {}, its newest segment {} has a record format this server cannot read",
+                      room_id, segments.back().path.string());
+        return false;
+    }
+
+    // read segments newest first, only as far back as the history can retain
+    const auto wanted = history.retention().maxMessages;
+    std::size_t found = 0;
+    std::vector<Segment*> loaded;
+    for (auto it = segments.rbegin(); it != segments.rend() && found < wanted; ++it) {
+        if (!readable(it->version)) {
+            // the history starts after it, the older messages are left on disk unread
+            spdlog::error("Log segment {} has a record format this server cannot read, replaying only what follows it",
+                          it->path.string());
+            break;
+        }
+        it->data = readFile(it->path);
+        auto end = scanSegment(*it);
+
+        if (loaded.empty()) {
+            // the newest segment may end in a torn write, drop it so appends continue cleanly
+            if (!it->offsets.empty() && !recordValid(it->data, it->offsets.back())) {
+                end = it->offsets.back();
+                it->offsets.pop_back();
+            }
+            if (end != it->data.size()) {
+                spdlog::warn("Truncating torn tail of {} at byte {}", it->path.string(), end);
+                fs::resize_file(it->path, end);
+                it->data.resize(end);
+            }
+            log->writtenSequence = it->start + it->offsets.size();
+            log->segmentSize = end;
+            // a segment in an older format is left as it is, the first write rolls a new one
+            if (it->version == k_recordVersion) {
+                log->fd = ::open(it->path.c_str(), O_WRONLY | O_APPEND);
+            }
+        }
+
+        found += it->offsets.size();
+        loaded.push_back(&*it);
+    }
+
+    // replay oldest first, skipping whatever the retention would evict anyway
+    std::size_t skip = found > wanted ? found - wanted : 0;
+    history.startAt(loaded.back()->start + skip);
+    for (auto it = loaded.rbegin(); it != loaded.rend(); ++it) {
+        for (auto offset : (*it)->offsets) {
+            if (skip > 0) {
+                --skip;
+                continue;
+            }
+
+            auto message = decodeRecord((*it)->data, offset, (*it)->version);
+            if (!message.has_value()) {
+                // keep the sequence numbering intact even though the record is lost
+                spdlog::error("Corrupt record in {} at byte {}", (*it)->path.string(), offset);
+                message = ServerChatMessage{"ALERT", "[message lost: corrupt log record]", 0};
+            }
+            history.push(*message);
+        }
+        (*it)->data.clear();
+    }
+
+    spdlog::info("Recovered room {} from log, next sequence {}", room_id, log->writtenSequence);
+
+    std::lock_guard<std::mutex> lock(d_mutex);
+    d_rooms[room_id] = std::move(log);
+    return true;
+}
+
+void MessageLog::append(const std::string& room_id, const ServerChatMessage& message) {
+    std::string payload;
+    auto out = zpp::bits::out(payload);
+    if (failure(out(message))) {
+        spdlog::warn("Failed to serialize message in MessageLog::append");
+        return;
+    }
+
+    std::uint32_t header[2] = {static_cast<std::uint32_t>(payload.size()), crc32(payload.data(), payload.size())};
+
+    bool wake = false;
+    {
+        std::lock_guard<std::mutex> lock(d_mutex);
+        auto it = d_rooms.find(room_id);
+        if (it == d_rooms.end()) {
+            spdlog::error("Append to room {} that has not been opened in the log", room_id);
+            return;
+        }
+
+        auto& pending = it->second->pending;
+        pending.append(reinterpret_cast<const char*>(header), k_headerSize);
+        pending.append(payload);
+        ++it->second->pendingCount;
+
+        d_pendingBytes += k_headerSize + payload.size();
+        wake = d_pendingBytes >= s_flushThreshold;
+    }
+
+    if (wake) {
+        d_cv.notify_one();
+    }
+}
+
+void MessageLog::flush() {
+    writePending();
+}
+
+void MessageLog::runFlusher() {
+    std::unique_lock<std::mutex> lock(d_mutex);
+    while (!d_stopping) {
+        d_cv.wait_for(lock, d_config.syncInterval,
+                      [this] { return d_stopping || d_pendingBytes >= s_flushThreshold; });
+        if (d_pendingBytes == 0) {
+            continue;
+        }
+
+        lock.unlock();
+        writePending();
+        lock.lock();
+    }
+}
+
+void MessageLog::writePending() {
+    std::lock_guard<std::mutex> writeLock(d_writeMutex);
+
+    struct Batch {
+        RoomLog* log;
+        std::string data;
+        std::uint64_t count;
+    };
+
+    std::vector<Batch> batches;
+    {
+        std::lock_guard<std::mutex> lock(d_mutex);
+        for (auto& [roomId, log] : d_rooms) {
+            if (log->pending.empty()) {
+                continue;
+            }
+            batches.push_back(Batch{log.get(), std::move(log->pending), log->pendingCount});
+            log->pending.clear();
+            log->pendingCount = 0;
+        }
+        d_pendingBytes = 0;
+    }
+
+    // one write and one fsync per room per batch, however many messages it holds
+    std::vector<Batch> failed;
+    for (auto& batch : batches) {
+        auto& log = *batch.log;
+        if (log.fd < 0 || log.segmentSize >= d_config.segmentBytes) {
+            rollSegment(log);
+        }
+        if (log.fd < 0) {
+            continue;
+        }
+
+        const char* data = batch.data.data();
+        std::size_t remaining = batch.data.size();
+        while (remaining > 0) {
+            auto written = ::write(log.fd, data, remaining);
+            if (written < 0) {
+                spdlog::error("Failed to write to log in {}: {}", log.directory, std::strerror(errno));
+                break;
+            }
+            data += written;
+            remaining -= written;
+        }
+
+        if (remaining > 0) {
+            // recovery stops at a torn record, so nothing appended after it would ever be read back.
+            // Cut it off (or give up on the segment if even that fails) and try the batch again next time
+            if (::ftruncate(log.fd, log.segmentSize) != 0) {
+                spdlog::error("Failed to truncate log in {}: {}", log.directory, std::strerror(errno));
+                ::close(log.fd);
+                log.fd = -1;
+            }
+            failed.push_back(std::move(batch));
+            continue;
+        }
+
+        if (syncFile(log.fd) != 0) {
+            spdlog::error("Failed to sync log in {}: {}", log.directory, std::strerror(errno));
+        }
+
+        log.segmentSize += batch.data.size();
+        log.writtenSequence += batch.count;
+    }
+
+    if (failed.empty()) {
+        return;
+    }
+
+    // ahead of anything appended since, so the records stay in sequence order
+    std::lock_guard<std::mutex> lock(d_mutex);
+    for (auto& batch : failed) {
+        auto& log = *batch.log;
+        d_pendingBytes += batch.data.size();
+        log.pending.insert(0, batch.data);
+        log.pendingCount += batch.count;
+    }
+}
+
+void MessageLog::rollSegment(RoomLog& log) {
+    if (log.fd >= 0) {
+        ::close(log.fd);
+    }
+
+    // a segment already named after writtenSequence can only hold a torn record we gave up on
+    auto path = (fs::path(log.directory) / segmentName(log.writtenSequence)).string();
+    log.fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_TRUNC, 0644);
+    log.segmentSize = 0;
+    if (log.fd < 0) {
+        spdlog::error("Failed to open log segment {}: {}", path, std::strerror(errno));
+        return;
+    }
+
+    // make the new segment's directory entry durable too
+    syncDirectory(log.directory);
+}
+
+std::string MessageLog::roomDirectory(const std::string& room_id) const {
+    return (fs::path(d_config.directory) / (k_roomPrefix + toHex(room_id))).string();
+}
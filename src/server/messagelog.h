@@ -0,0 +1,107 @@
+#pragma once
+
+#include "messaging.h"
+#include "roomhistory.h"
+
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+#include <condition_variable>
+
+struct MessageLogConfig {
+    // root directory of the log, empty disables it
+    std::string directory;
+    // a room's current segment is rolled once it grows past this
+    std::size_t segmentBytes = 64 << 20;
+    // group commit window: appends are written and fsync'd together at most this long after they are made
+    std::chrono::milliseconds syncInterval{5};
+};
+
+/*
+Durable, append-only log of every room's chat messages.
+
+Each room gets its own directory of segments, named after the sequence of the
+first message they hold and the version of the record format they are written
+in. A record is [u32 size][u32 crc32][serialized ServerChatMessage]. Segments
+from before the format had a version (their records are {senderId, message})
+still replay, and appends go to a new segment in the current format.
+
+Appends only copy the record into a pending buffer. A background thread writes
+everything pending and fsyncs each touched segment once per syncInterval, so the
+cost of the syscalls is shared by every message in the batch.
+
+append and open are safe to call from any thread.
+*/
+class MessageLog {
+
+public:
+    explicit MessageLog(const MessageLogConfig& config);
+
+    // flushes anything still pending
+    ~MessageLog();
+
+    MessageLog(const MessageLog&) = delete;
+    MessageLog& operator=(const MessageLog&) = delete;
+
+    // every room that has a log on disk
+    std::vector<std::string> roomIds() const;
+
+    // moves room_id's log on disk into the log rooted at directory, handing the room to the node
+    // logging there. Neither log may have the room open. Returns the bytes moved, or nothing if the
+    // room has no log here or the other log already has it
+    std::optional<std::uint64_t> moveRoom(const std::string& room_id, const std::string& directory);
+
+    // starts logging room_id. If the room already has a log its most recent
+    // messages are replayed into history (as far as its retention allows) and
+    // history continues from the last logged sequence. Segments in a record format
+    // this server cannot read are never replayed: only what follows the newest such
+    // segment is, and if it is the room's newest segment the room is not logged and
+    // false is returned.
+    bool open(const std::string& room_id, RoomHistory& history);
+
+    void append(const std::string& room_id, const ServerChatMessage& message);
+
+    // writes and fsyncs everything appended so far before returning
+    void flush();
+
+    private:
+    struct RoomLog {
+        std::string directory;
+        // appended records not yet handed to the writer, guarded by d_mutex
+        std::string pending;
+        std::uint64_t pendingCount = 0;
+        // only touched by whoever holds d_writeMutex
+        int fd = -1;
+        std::uint64_t writtenSequence = 0;
+        std::size_t segmentSize = 0;
+    };
+
+    MessageLogConfig d_config;
+
+    mutable std::mutex d_mutex;
+    std::condition_variable d_cv;
+    std::unordered_map<std::string, std::unique_ptr<RoomLog>> d_rooms;
+    std::size_t d_pendingBytes = 0;
+    bool d_stopping = false;
+
+    std::mutex d_writeMutex;
+    std::thread d_flusher;
+
+    void runFlusher();
+
+    // takes every room's pending records and writes them out, called without d_mutex held
+    void writePending();
+
+    void rollSegment(RoomLog& log);
+
+    std::string roomDirectory(const std::string& room_id) const;
+
+    // pending bytes that wake the flusher before the sync interval is up
+    static const std::size_t s_flushThreshold;
+};
@@ -0,0 +1,59 @@
+#include "metrics.h"
+#include "spdlog/fmt/fmt.h"
+
+#include <algorithm>
+#include <iterator>
+
+LatencyHistogram::Snapshot LatencyHistogram::snapshot() const {
+    Buckets buckets{};
+    mergeInto(buckets);
+    return snapshotOf(buckets, sum(), max());
+}
+
+void LatencyHistogram::mergeInto(Buckets& buckets) const {
+    for (std::size_t i = 0; i < s_bucketCount; ++i) {
+        buckets[i] += d_buckets[i].load(std::memory_order_relaxed);
+    }
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::snapshotOf(const Buckets& buckets, std::uint64_t sum, std::uint64_t max) {
+    Snapshot snapshot;
+    snapshot.sum = sum;
+    snapshot.max = max;
+    for (auto count : buckets) {
+        snapshot.count += count;
+    }
+    if (snapshot.count == 0) {
+        return snapshot;
+    }
+
+    // walk the buckets once, filling each percentile as its rank is passed
+    const std::pair<double, std::uint64_t*> targets[] = {
+        {0.50, &snapshot.p50}, {0.90, &snapshot.p90}, {0.99, &snapshot.p99}, {0.999, &snapshot.p999}
+    };
+    std::size_t next = 0;
+    std::uint64_t seen = 0;
+    for (std::size_t i = 0; i < s_bucketCount && next < std::size(targets); ++i) {
+        seen += buckets[i];
+        while (next < std::size(targets) && seen >= targets[next].first * snapshot.count) {
+            *targets[next].second = std::min(bucketValue(i), max);
+            ++next;
+        }
+    }
+    return snapshot;
+}
+
+std::uint64_t LatencyHistogram::bucketValue(std::size_t bucket) {
+    if (bucket < s_subBuckets) {
+        return bucket;
+    }
+    unsigned shift = bucket / s_subBuckets - 1;
+    std::uint64_t lower = static_cast<std::uint64_t>(s_subBuckets + bucket % s_subBuckets) << shift;
+    return lower + ((std::uint64_t{1} << shift) - 1);
+}
+
+std::string toJson(const LatencyHistogram::Snapshot& snapshot) {
+    return fmt::format(R"({{"count":{},"mean":{},"p50":{},"p90":{},"p99":{},"p999":{},"max":{}}})",
+                       snapshot.count, snapshot.count ? snapshot.sum / snapshot.count : 0,
+                       snapshot.p50, snapshot.p90, snapshot.p99, snapshot.p999, snapshot.max);
+}
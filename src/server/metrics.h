@@ -0,0 +1,194 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <cstdint>
+
+// a monotonically increasing count, safe to bump from one thread while others read it
+class Counter {
+
+public:
+    void add(std::uint64_t n = 1);
+
+    std::uint64_t value() const;
+
+    private:
+    std::atomic<std::uint64_t> d_value{0};
+};
+
+/*
+HDR style histogram of non-negative values (nanoseconds for latencies).
+
+Values below 16 get a bucket each, above that every power of two is split into
+16 linear sub-buckets, so a reported percentile is within ~6% of the real value
+whatever its magnitude, in a fixed 8KiB of buckets. Recording is one relaxed
+increment; it is meant to be written by a single thread and read (snapshotted)
+by any other without locking.
+*/
+class LatencyHistogram {
+
+public:
+    static constexpr std::size_t s_bucketCount = 1024;
+    using Buckets = std::array<std::uint64_t, s_bucketCount>;
+
+    struct Snapshot {
+        std::uint64_t count = 0;
+        std::uint64_t sum = 0;
+        std::uint64_t max = 0;
+        std::uint64_t p50 = 0;
+        std::uint64_t p90 = 0;
+        std::uint64_t p99 = 0;
+        std::uint64_t p999 = 0;
+    };
+
+    void record(std::uint64_t value);
+
+    void record(std::chrono::steady_clock::duration elapsed);
+
+    // percentiles of everything recorded so far, a reader racing with record()
+    // may see a few values in the buckets that are not in the count yet
+    Snapshot snapshot() const;
+
+    // adds this histogram's counts into buckets, used to combine per-thread histograms
+    void mergeInto(Buckets& buckets) const;
+
+    static Snapshot snapshotOf(const Buckets& buckets, std::uint64_t sum, std::uint64_t max);
+
+    std::uint64_t sum() const;
+
+    std::uint64_t max() const;
+
+    private:
+    static constexpr unsigned s_subBucketBits = 4;
+    static constexpr std::size_t s_subBuckets = 1 << s_subBucketBits;
+
+    std::array<std::atomic<std::uint64_t>, s_bucketCount> d_buckets{};
+    std::atomic<std::uint64_t> d_sum{0};
+    std::atomic<std::uint64_t> d_max{0};
+
+    static std::size_t bucketOf(std::uint64_t value);
+
+    // the largest value that lands in the bucket
+    static std::uint64_t bucketValue(std::size_t bucket);
+};
+
+// times a scope into a histogram
+class ScopedTimer {
+
+public:
+    explicit ScopedTimer(LatencyHistogram& histogram);
+
+    ~ScopedTimer();
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+    private:
+    LatencyHistogram& d_histogram;
+    std::chrono::steady_clock::time_point d_start;
+};
+
+// recorded by a RoomShard on whichever thread owns it
+struct ShardMetrics {
+    LatencyHistogram serializeNs;
+    LatencyHistogram fanoutSize;    // recipients per broadcast
+    LatencyHistogram searchNs;      // looking a query up in a room's index
+    LatencyHistogram indexNs;       // catching a room's index up with its history after a batch
+    Counter broadcasts;
+    Counter historyRequests;
+    Counter joins;
+    Counter joinCacheHits;          // joins answered with the room's last encoded response
+    Counter searches;
+    Counter searchesDeferred;       // left for a later pass once its search budget was spent, once per pass waited
+};
+
+// recorded by the server's I/O thread (by the stage doing the work when pipelined,
+// each histogram still only ever has one writer)
+struct ServerMetrics {
+    Counter messagesReceived;
+    Counter bytesReceived;
+    Counter decodeFailures;
+    Counter messagesSent;
+    Counter bytesSent;
+    Counter messagesPublished;
+    Counter peerMessagesSent;       // to other cluster nodes
+    Counter peerMessagesReceived;
+    Counter peerMessagesDropped;    // peer link full or down
+    Counter arenaResizes;           // passes of the run loop that grew or shrank the batch arena's block
+    Counter directMessages;
+    Counter rateLimitedMessages;    // dropped on arrival, the sender was over its rate
+    Counter rateLimitedBytes;
+    Counter pipelineStalls;         // reads held back because the next decoder was full
+
+    LatencyHistogram receiveToDispatchNs;
+    LatencyHistogram chatHandlerNs;
+    LatencyHistogram connectionHandlerNs;
+    LatencyHistogram createRoomHandlerNs;
+    LatencyHistogram historyHandlerNs;
+    LatencyHistogram searchHandlerNs;
+    LatencyHistogram directHandlerNs;
+    LatencyHistogram flushNs;          // one pass writing every queued send
+    LatencyHistogram messagesPerFlush;
+};
+
+// {"count":..,"mean":..,"p50":..,...} for the stats endpoint
+std::string toJson(const LatencyHistogram::Snapshot& snapshot);
+
+inline
+void Counter::add(std::uint64_t n) {
+    d_value.fetch_add(n, std::memory_order_relaxed);
+}
+
+inline
+std::uint64_t Counter::value() const {
+    return d_value.load(std::memory_order_relaxed);
+}
+
+inline
+void LatencyHistogram::record(std::uint64_t value) {
+    d_buckets[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+    d_sum.fetch_add(value, std::memory_order_relaxed);
+    if (value > d_max.load(std::memory_order_relaxed)) {
+        // only one thread records, so a plain store cannot lose a larger max
+        d_max.store(value, std::memory_order_relaxed);
+    }
+}
+
+inline
+void LatencyHistogram::record(std::chrono::steady_clock::duration elapsed) {
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    record(static_cast<std::uint64_t>(ns < 0 ? 0 : ns));
+}
+
+inline
+std::uint64_t LatencyHistogram::sum() const {
+    return d_sum.load(std::memory_order_relaxed);
+}
+
+inline
+std::uint64_t LatencyHistogram::max() const {
+    return d_max.load(std::memory_order_relaxed);
+}
+
+inline
+std::size_t LatencyHistogram::bucketOf(std::uint64_t value) {
+    if (value < s_subBuckets) {
+        return value;
+    }
+    unsigned shift = 63 - __builtin_clzll(value) - s_subBucketBits;
+    return (shift + 1) * s_subBuckets + ((value >> shift) & (s_subBuckets - 1));
+}
+
+inline
+ScopedTimer::ScopedTimer(LatencyHistogram& histogram)
+: d_histogram(histogram)
+, d_start(std::chrono::steady_clock::now())
+{
+}
+
+inline
+ScopedTimer::~ScopedTimer() {
+    d_histogram.record(std::chrono::steady_clock::now() - d_start);
+}
@@ -0,0 +1,280 @@
+#pragma once
+
+#include "registry.h"
+
+#include <deque>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <zmq.hpp>
+
+// what to do with a client whose outbound queue backs up, chosen per room. Only room chat
+// is ever dropped, a queue backed up with nothing but control replies is disconnected.
+// Ordered from least to most strict, a client in several rooms gets the strictest of theirs
+enum class SlowConsumerPolicy {
+    e_DROP_OLDEST,  // drop the oldest queued chat to make room
+    e_CONFLATE,     // keep only the newest chat
+    e_DISCONNECT    // drop everything queued and remove the client from its rooms
+};
+
+// "drop-oldest", "conflate" or "disconnect"
+std::optional<SlowConsumerPolicy> slowConsumerPolicyFromName(std::string_view name);
+
+// what a queued message is to the slow consumer policy
+enum class OutboundKind {
+    e_CONTROL,  // a reply the client is waiting on (join, history, search, rate limited...), never dropped
+    e_CHAT      // room chat, the client can do without some of it
+};
+
+struct OutboundQueueConfig {
+    // messages queued for one client before it counts as a slow consumer
+    std::size_t highWaterMark = 1000;
+    // age of the oldest queued message before the client counts as a slow consumer
+    std::chrono::milliseconds maxAge{5000};
+};
+
+/*
+Per client queues sitting between the server logic and the ROUTER socket.
+
+Sends are queued here and written out by flush(), which stops writing to a
+client as soon as the socket would block on it instead of dropping or
+blocking. A client whose queue goes over the high-water mark, or whose oldest
+message is older than maxAge, has its room's SlowConsumerPolicy applied, so
+one stalled client only ever costs its own queue. The policy drops chat but
+keeps control replies in order, and disconnects the client if what is left is
+still over the limits.
+*/
+class OutboundQueues {
+
+public:
+    using Clock = std::chrono::steady_clock;
+
+    enum class SendResult {
+        e_SENT,
+        e_WOULD_BLOCK,  // the client's pipe is full, try again next flush
+        e_UNROUTABLE    // the client is gone, drop what is queued for it
+    };
+
+    struct Stats {
+        std::size_t depth = 0;
+        std::size_t peakDepth = 0;
+        std::uint64_t sent = 0;
+        std::uint64_t dropped = 0;
+    };
+
+    explicit OutboundQueues(const OutboundQueueConfig& config);
+
+    // returns false if the policy says the client has to be disconnected (nothing is queued then)
+    bool push(ClientHandle client, zmq::message_t&& payload, Clock::time_point now, SlowConsumerPolicy policy,
+              OutboundKind kind);
+
+    // trySend(client, payload) -> SendResult, payload is only consumed when e_SENT
+    // policyFor(client) -> SlowConsumerPolicy
+    // clients to disconnect (slow under e_DISCONNECT, or unroutable) are appended to disconnects
+    template <typename TrySend, typename PolicyFor>
+    void flush(Clock::time_point now, TrySend&& trySend, PolicyFor&& policyFor, std::vector<ClientHandle>& disconnects);
+
+    // drops everything queued for the client
+    void clear(ClientHandle client);
+
+    const Stats& stats(ClientHandle client) const;
+
+    // every client that has ever had something queued, indexed by handle
+    const std::vector<Stats>& allStats() const;
+
+    private:
+    struct Entry {
+        zmq::message_t payload;
+        Clock::time_point enqueued;
+        OutboundKind kind;
+    };
+
+    struct Queue {
+        std::deque<Entry> entries;
+        bool active = false;
+    };
+
+    OutboundQueueConfig d_config;
+    std::deque<Queue> d_queues; // a deque so growing it never moves the queues
+    std::vector<Stats> d_stats;
+    // clients with something queued
+    std::vector<ClientHandle> d_active;
+
+    // drops up to limit queued chat messages enqueued before cutoff, oldest first, returns how many
+    std::size_t dropChat(ClientHandle client, std::size_t limit, Clock::time_point cutoff);
+
+    // applies policy to a client that is over its limits, false means disconnect
+    bool relieve(ClientHandle client, Clock::time_point now, SlowConsumerPolicy policy);
+};
+
+inline
+std::optional<SlowConsumerPolicy> slowConsumerPolicyFromName(std::string_view name) {
+    if (name == "drop-oldest") {
+        return SlowConsumerPolicy::e_DROP_OLDEST;
+    }
+    if (name == "conflate") {
+        return SlowConsumerPolicy::e_CONFLATE;
+    }
+    if (name == "disconnect") {
+        return SlowConsumerPolicy::e_DISCONNECT;
+    }
+    return std::nullopt;
+}
+
+inline
+OutboundQueues::OutboundQueues(const OutboundQueueConfig& config)
+: d_config(config)
+{
+    if (d_config.highWaterMark == 0) {
+        d_config.highWaterMark = 1;
+    }
+}
+
+inline
+bool OutboundQueues::push(ClientHandle client, zmq::message_t&& payload, Clock::time_point now, SlowConsumerPolicy policy,
+                          OutboundKind kind) {
+    if (client >= d_queues.size()) {
+        d_queues.resize(client + 1);
+        d_stats.resize(client + 1);
+    }
+
+    auto& queue = d_queues[client];
+    if (queue.entries.size() >= d_config.highWaterMark) {
+        if (policy == SlowConsumerPolicy::e_DISCONNECT) {
+            return false;
+        }
+        auto limit = policy == SlowConsumerPolicy::e_CONFLATE ? queue.entries.size() : 1;
+        if (dropChat(client, limit, Clock::time_point::max()) == 0) {
+            // nothing but control replies, none of which can go
+            return false;
+        }
+    }
+
+    queue.entries.push_back(Entry{std::move(payload), now, kind});
+    if (!queue.active) {
+        queue.active = true;
+        d_active.push_back(client);
+    }
+
+    auto& stats = d_stats[client];
+    stats.depth = queue.entries.size();
+    stats.peakDepth = std::max(stats.peakDepth, stats.depth);
+    return true;
+}
+
+template <typename TrySend, typename PolicyFor>
+void OutboundQueues::flush(Clock::time_point now, TrySend&& trySend, PolicyFor&& policyFor, std::vector<ClientHandle>& disconnects) {
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < d_active.size(); ++i) {
+        auto client = d_active[i];
+        auto& queue = d_queues[client];
+        auto& stats = d_stats[client];
+
+        bool unroutable = false;
+        while (!queue.entries.empty()) {
+            auto result = trySend(client, queue.entries.front().payload);
+            if (result == SendResult::e_WOULD_BLOCK) {
+                break;
+            }
+            if (result == SendResult::e_UNROUTABLE) {
+                unroutable = true;
+                break;
+            }
+            queue.entries.pop_front();
+            ++stats.sent;
+        }
+
+        if (unroutable || (!queue.entries.empty() && !relieve(client, now, policyFor(client)))) {
+            clear(client);
+            disconnects.push_back(client);
+        }
+
+        stats.depth = queue.entries.size();
+        if (queue.entries.empty()) {
+            queue.active = false;
+        } else {
+            d_active[kept++] = client;
+        }
+    }
+    d_active.resize(kept);
+}
+
+inline
+void OutboundQueues::clear(ClientHandle client) {
+    if (client >= d_queues.size()) {
+        return;
+    }
+    d_stats[client].dropped += d_queues[client].entries.size();
+    d_queues[client].entries.clear();
+    d_stats[client].depth = 0;
+}
+
+inline
+const OutboundQueues::Stats& OutboundQueues::stats(ClientHandle client) const {
+    static const Stats s_empty;
+    return client < d_stats.size() ? d_stats[client] : s_empty;
+}
+
+inline
+const std::vector<OutboundQueues::Stats>& OutboundQueues::allStats() const {
+    return d_stats;
+}
+
+inline
+std::size_t OutboundQueues::dropChat(ClientHandle client, std::size_t limit, Clock::time_point cutoff) {
+    auto& entries = d_queues[client].entries;
+    std::size_t dropped = 0;
+    auto kept = entries.begin();
+    for (auto it = entries.begin(); it != entries.end(); ++it) {
+        if (dropped < limit && it->kind == OutboundKind::e_CHAT && it->enqueued < cutoff) {
+            ++dropped;
+            continue;
+        }
+        if (kept != it) {
+            *kept = std::move(*it);
+        }
+        ++kept;
+    }
+    entries.erase(kept, entries.end());
+    d_stats[client].dropped += dropped;
+    return dropped;
+}
+
+inline
+bool OutboundQueues::relieve(ClientHandle client, Clock::time_point now, SlowConsumerPolicy policy) {
+    auto& entries = d_queues[client].entries;
+    bool stale = now - entries.front().enqueued > d_config.maxAge;
+    if (!stale && entries.size() < d_config.highWaterMark) {
+        return true;
+    }
+
+    switch (policy) {
+        case SlowConsumerPolicy::e_DISCONNECT:
+            return false;
+        case SlowConsumerPolicy::e_CONFLATE: {
+            auto chat = std::count_if(entries.begin(), entries.end(),
+                                      [](const Entry& entry) { return entry.kind == OutboundKind::e_CHAT; });
+            if (chat > 1) {
+                dropChat(client, static_cast<std::size_t>(chat - 1), Clock::time_point::max());
+            }
+            break;
+        }
+        case SlowConsumerPolicy::e_DROP_OLDEST:
+            dropChat(client, entries.size(), now - d_config.maxAge);
+            break;
+    }
+
+    // control replies alone over the limits means the client is not reading them
+    std::size_t control = 0;
+    bool staleControl = false;
+    for (const auto& entry : entries) {
+        if (entry.kind == OutboundKind::e_CONTROL) {
+            ++control;
+            staleControl = staleControl || now - entry.enqueued > d_config.maxAge;
+        }
+    }
+    return !staleControl && control < d_config.highWaterMark;
+}
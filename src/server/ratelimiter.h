@@ -0,0 +1,149 @@
+#pragma once
+
+#include "registry.h"
+
+#include <chrono>
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include <optional>
+#include <algorithm>
+
+struct RateLimitConfig {
+    // sustained rates one client may send at, 0 disables that limit (both 0 disables rate limiting)
+    double messagesPerSecond = 0;
+    double bytesPerSecond = 0;
+    // how far ahead of its rate a client can burst, in seconds of that rate
+    double burstSeconds = 2;
+    // tells a client whose messages are being dropped with a ServerRateLimited
+    bool notify = true;
+};
+
+/*
+Per client token buckets, checked for every message as it comes off the socket.
+
+Each client has a bucket of messages and one of bytes, filled at the
+configured rates up to burstSeconds worth and starting full. A message takes
+one message and its size in bytes, and is dropped (taking nothing) if either
+bucket is short, so a client flooding chat is cut back to its rate before
+any room fans its messages out. A message bigger than the bytes bucket can
+ever hold is always dropped.
+*/
+class RateLimiter {
+
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // notices to one client are at least this far apart, whatever it keeps sending
+    static constexpr Clock::duration s_noticeInterval = std::chrono::seconds(1);
+
+    explicit RateLimiter(const RateLimitConfig& config);
+
+    bool enabled() const;
+
+    // takes a message of bytes from the client's buckets, false if it has to be dropped
+    bool admit(ClientHandle client, std::size_t bytes, Clock::time_point now);
+
+    // messages dropped since the last notice if the client is due one, nullopt otherwise
+    std::optional<std::uint64_t> takeNotice(ClientHandle client, Clock::time_point now);
+
+    // how long until the client's buckets hold a message of bytes again
+    Clock::duration retryAfter(ClientHandle client, std::size_t bytes) const;
+
+    private:
+    struct Bucket {
+        double messages;
+        double bytes;
+        Clock::time_point refilled;
+        Clock::time_point noticed;
+        std::uint64_t dropped = 0; // since the last notice
+    };
+
+    RateLimitConfig d_config;
+    double d_messageCapacity;
+    double d_byteCapacity;
+    std::vector<Bucket> d_buckets; // indexed by ClientHandle
+
+    // creates the client's bucket full, and refills it for the time since it was last used
+    Bucket& refill(ClientHandle client, Clock::time_point now);
+};
+
+inline
+RateLimiter::RateLimiter(const RateLimitConfig& config)
+: d_config(config)
+, d_messageCapacity(config.messagesPerSecond * config.burstSeconds)
+, d_byteCapacity(config.bytesPerSecond * config.burstSeconds)
+{
+    // a bucket that can never hold one message would drop everything
+    d_messageCapacity = std::max(d_messageCapacity, 1.0);
+}
+
+inline
+bool RateLimiter::enabled() const {
+    return d_config.messagesPerSecond > 0 || d_config.bytesPerSecond > 0;
+}
+
+inline
+bool RateLimiter::admit(ClientHandle client, std::size_t bytes, Clock::time_point now) {
+    auto& bucket = refill(client, now);
+    bool messagesLeft = d_config.messagesPerSecond <= 0 || bucket.messages >= 1;
+    bool bytesLeft = d_config.bytesPerSecond <= 0 || bucket.bytes >= static_cast<double>(bytes);
+    if (!messagesLeft || !bytesLeft) {
+        ++bucket.dropped;
+        return false;
+    }
+
+    if (d_config.messagesPerSecond > 0) {
+        bucket.messages -= 1;
+    }
+    if (d_config.bytesPerSecond > 0) {
+        bucket.bytes -= static_cast<double>(bytes);
+    }
+    return true;
+}
+
+inline
+std::optional<std::uint64_t> RateLimiter::takeNotice(ClientHandle client, Clock::time_point now) {
+    if (client >= d_buckets.size()) {
+        return std::nullopt;
+    }
+    auto& bucket = d_buckets[client];
+    if (bucket.dropped == 0 || now - bucket.noticed < s_noticeInterval) {
+        return std::nullopt;
+    }
+
+    bucket.noticed = now;
+    return std::exchange(bucket.dropped, 0);
+}
+
+inline
+RateLimiter::Clock::duration RateLimiter::retryAfter(ClientHandle client, std::size_t bytes) const {
+    if (client >= d_buckets.size()) {
+        return Clock::duration::zero();
+    }
+    const auto& bucket = d_buckets[client];
+    double seconds = 0;
+    if (d_config.messagesPerSecond > 0) {
+        seconds = std::max(seconds, (1 - bucket.messages) / d_config.messagesPerSecond);
+    }
+    if (d_config.bytesPerSecond > 0) {
+        seconds = std::max(seconds, (static_cast<double>(bytes) - bucket.bytes) / d_config.bytesPerSecond);
+    }
+    return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+}
+
+inline
+RateLimiter::Bucket& RateLimiter::refill(ClientHandle client, Clock::time_point now) {
+    if (client >= d_buckets.size()) {
+        d_buckets.resize(client + 1, Bucket{d_messageCapacity, d_byteCapacity, now, now - s_noticeInterval});
+    }
+
+    auto& bucket = d_buckets[client];
+    if (now > bucket.refilled) {
+        double seconds = std::chrono::duration<double>(now - bucket.refilled).count();
+        bucket.messages = std::min(d_messageCapacity, bucket.messages + seconds * d_config.messagesPerSecond);
+        bucket.bytes = std::min(d_byteCapacity, bucket.bytes + seconds * d_config.bytesPerSecond);
+        bucket.refilled = now;
+    }
+    return bucket;
+}
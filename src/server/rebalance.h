@@ -0,0 +1,62 @@
+#pragma once
+
+#include "hashring.h"
+#include "messagelog.h"
+#include "spdlog/spdlog.h"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/*
+Hands room logs to the nodes owning them after a cluster's node list changed.
+
+Cluster membership is fixed while the nodes run: adding a node means stopping
+every node, running rebalanceLogs with the new node list and every node's log
+directory, then starting the nodes with the new list. Each room's log moves to
+the node the new ring gives it (about 1/n of the rooms when a node is added),
+which restores the room from it on startup. Clients resume their rooms by
+sequence once they reconnect.
+*/
+
+struct RebalanceStats {
+    std::size_t rooms = 0;       // rooms with a log in any of the directories
+    std::size_t moved = 0;       // rooms whose log moved to another node
+    std::uint64_t bytesMoved = 0;
+};
+
+// logDirectories[n] is the log directory of node n in nodes, none of the nodes may be running
+RebalanceStats rebalanceLogs(const std::vector<std::string>& nodes, const std::vector<std::string>& logDirectories);
+
+inline
+RebalanceStats rebalanceLogs(const std::vector<std::string>& nodes, const std::vector<std::string>& logDirectories) {
+    RebalanceStats stats;
+    if (nodes.size() != logDirectories.size()) {
+        spdlog::error("Rebalancing needs a log directory for each of the {} nodes, got {}",
+                      nodes.size(), logDirectories.size());
+        return stats;
+    }
+
+    // every room is listed before any moves, so a moved room is not seen again at its new owner
+    HashRing ring(nodes);
+    std::vector<std::vector<std::string>> roomIds;
+    for (const auto& directory : logDirectories) {
+        roomIds.push_back(MessageLog(MessageLogConfig{directory}).roomIds());
+        stats.rooms += roomIds.back().size();
+    }
+
+    for (std::uint32_t node = 0; node < nodes.size(); ++node) {
+        MessageLog log(MessageLogConfig{logDirectories[node]});
+        for (const auto& roomId : roomIds[node]) {
+            auto owner = ring.owner(roomId);
+            if (owner == node) {
+                continue;
+            }
+            if (auto bytes = log.moveRoom(roomId, logDirectories[owner]); bytes.has_value()) {
+                stats.bytesMoved += *bytes;
+                ++stats.moved;
+            }
+        }
+    }
+    return stats;
+}
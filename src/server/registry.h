@@ -0,0 +1,209 @@
+#pragma once
+
+#include <limits>
+#include <string>
+#include <algorithm>
+#include <vector>
+#include <cstdint>
+#include <optional>
+#include <functional>
+#include <string_view>
+#include <unordered_map>
+
+// dense integer stand-ins for client and room ids, handed out once when the id is first seen
+using ClientHandle = std::uint32_t;
+using RoomHandle = std::uint32_t;
+
+inline constexpr std::uint32_t k_invalidHandle = std::numeric_limits<std::uint32_t>::max();
+
+// Interns string ids into dense handles (0, 1, 2, ...) so hot paths can index
+// vectors and compare integers instead of hashing strings.
+class IdRegistry {
+
+public:
+    // returns the existing handle for id or assigns the next one
+    std::uint32_t intern(std::string_view id);
+
+    // looks id up without building a std::string
+    std::optional<std::uint32_t> find(std::string_view id) const;
+
+    const std::string& name(std::uint32_t handle) const;
+
+    // handles are always < size()
+    std::size_t size() const;
+
+    private:
+    // lets d_handles be searched with a string_view
+    struct Hash {
+        using is_transparent = void;
+
+        std::size_t operator()(std::string_view id) const {
+            return std::hash<std::string_view>{}(id);
+        }
+    };
+
+    std::unordered_map<std::string, std::uint32_t, Hash, std::equal_to<>> d_handles;
+    std::vector<std::string> d_names;
+};
+
+// A room's members: dense so fan-out is a linear walk, with an index for O(1) insert/erase.
+class MemberSet {
+
+public:
+    bool insert(ClientHandle client);
+
+    bool erase(ClientHandle client);
+
+    bool contains(ClientHandle client) const;
+
+    std::size_t size() const;
+
+    std::vector<ClientHandle>::const_iterator begin() const;
+    std::vector<ClientHandle>::const_iterator end() const;
+
+    private:
+    std::vector<ClientHandle> d_members;
+    std::unordered_map<ClientHandle, std::uint32_t> d_positions;
+};
+
+// Which rooms every client is in, the server's side of membership. Which clients
+// a room has belongs to the shard owning the room (Room::clients), so it is not
+// kept here too. Joining is O(1), leaving and checking membership walk the
+// client's own rooms (a handful at most), so a client can be in any number of rooms.
+class Membership {
+
+public:
+    // false if client was already in room
+    bool join(ClientHandle client, RoomHandle room);
+
+    // false if client was not in room
+    bool leave(ClientHandle client, RoomHandle room);
+
+    bool contains(ClientHandle client, RoomHandle room) const;
+
+    // the rooms client is in, in the order they were joined
+    const std::vector<RoomHandle>& roomsOf(ClientHandle client) const;
+
+    private:
+    std::vector<std::vector<RoomHandle>> d_rooms; // indexed by ClientHandle
+
+    static const std::vector<RoomHandle> s_noRooms;
+};
+
+inline
+std::uint32_t IdRegistry::intern(std::string_view id) {
+    if (auto it = d_handles.find(id); it != d_handles.end()) {
+        return it->second;
+    }
+
+    auto handle = static_cast<std::uint32_t>(d_names.size());
+    d_handles.emplace(id, handle);
+    d_names.emplace_back(id);
+    return handle;
+}
+
+inline
+std::optional<std::uint32_t> IdRegistry::find(std::string_view id) const {
+    auto it = d_handles.find(id);
+    if (it == d_handles.end()) {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+inline
+const std::string& IdRegistry::name(std::uint32_t handle) const {
+    return d_names[handle];
+}
+
+inline
+std::size_t IdRegistry::size() const {
+    return d_names.size();
+}
+
+inline
+bool MemberSet::insert(ClientHandle client) {
+    auto [it, inserted] = d_positions.try_emplace(client, static_cast<std::uint32_t>(d_members.size()));
+    if (inserted) {
+        d_members.push_back(client);
+    }
+    return inserted;
+}
+
+inline
+bool MemberSet::erase(ClientHandle client) {
+    auto it = d_positions.find(client);
+    if (it == d_positions.end()) {
+        return false;
+    }
+
+    // swap the last member into the hole
+    auto position = it->second;
+    auto last = d_members.back();
+    d_members[position] = last;
+    d_positions[last] = position;
+    d_members.pop_back();
+    d_positions.erase(client);
+    return true;
+}
+
+inline
+bool MemberSet::contains(ClientHandle client) const {
+    return d_positions.contains(client);
+}
+
+inline
+std::size_t MemberSet::size() const {
+    return d_members.size();
+}
+
+inline
+std::vector<ClientHandle>::const_iterator MemberSet::begin() const {
+    return d_members.begin();
+}
+
+inline
+std::vector<ClientHandle>::const_iterator MemberSet::end() const {
+    return d_members.end();
+}
+
+inline const std::vector<RoomHandle> Membership::s_noRooms{};
+
+inline
+bool Membership::join(ClientHandle client, RoomHandle room) {
+    if (contains(client, room)) {
+        return false;
+    }
+
+    if (client >= d_rooms.size()) {
+        d_rooms.resize(client + 1);
+    }
+    d_rooms[client].push_back(room);
+    return true;
+}
+
+inline
+bool Membership::leave(ClientHandle client, RoomHandle room) {
+    if (client >= d_rooms.size()) {
+        return false;
+    }
+
+    auto& rooms = d_rooms[client];
+    auto it = std::find(rooms.begin(), rooms.end(), room);
+    if (it == rooms.end()) {
+        return false;
+    }
+    rooms.erase(it);
+    return true;
+}
+
+inline
+bool Membership::contains(ClientHandle client, RoomHandle room) const {
+    const auto& rooms = roomsOf(client);
+    return std::find(rooms.begin(), rooms.end(), room) != rooms.end();
+}
+
+inline
+const std::vector<RoomHandle>& Membership::roomsOf(ClientHandle client) const {
+    return client < d_rooms.size() ? d_rooms[client] : s_noRooms;
+}
@@ -0,0 +1,304 @@
+#pragma once
+
+#include "messaging.h"
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <string_view>
+#include <cstddef>
+#include <algorithm>
+#include <cstdint>
+
+// how much chat history a room keeps, whichever limit is hit first evicts the oldest message
+struct HistoryRetention {
+    std::size_t maxMessages = 1000;
+    // counted as senderId + message bytes
+    std::size_t maxBytes = 1 << 20;
+};
+
+// Bounded ring buffer of a room's most recent messages. Slots are allocated as
+// the history fills, doubling up to maxMessages, so a quiet room (or a direct
+// conversation of a few lines) only pays for what it holds. Appends are O(1)
+// amortized and a slot being overwritten reuses the capacity of the strings it
+// already holds.
+//
+// Every slot also keeps its message already encoded (as an element of a
+// serialized std::vector<ServerChatMessage>), so responses carrying history
+// are built by concatenating bytes instead of re-serializing each message.
+//
+// Timestamps only ever go up within a room (a push is stamped at least 1ns
+// after the one before it, whatever the clock did), and every
+// s_timeIndexStride-th message is kept in a sparse time index, so finding
+// where a point in time falls is a binary search over the index and then over
+// at most one stride of the history.
+class RoomHistory {
+
+public:
+    static constexpr std::uint64_t s_timeIndexStride = 64;
+    // slots allocated by the first push
+    static constexpr std::size_t s_initialSlots = 8;
+
+    explicit RoomHistory(const HistoryRetention& retention = HistoryRetention{});
+
+    // the stored copy is stamped with nextSequence() and keeps message's timestamp (moved up if needed)
+    void push(const ServerChatMessage& message);
+
+    // timestamp is in ns since the Unix epoch
+    void push(std::string_view senderId, std::string_view message, std::uint64_t timestamp);
+
+    // index 0 is the oldest retained message
+    const ServerChatMessage& operator[](std::size_t index) const;
+
+    // (*this)[index] encoded
+    std::string_view encoded(std::size_t index) const;
+
+    std::size_t size() const;
+
+    std::size_t bytes() const;
+
+    bool empty() const;
+
+    const HistoryRetention& retention() const;
+
+    // sequence of the oldest retained message, every push is given the next sequence
+    std::uint64_t firstSequence() const;
+
+    std::uint64_t nextSequence() const;
+
+    // numbers the next push as sequence, only valid while the history is empty (used by recovery)
+    void startAt(std::uint64_t sequence);
+
+    // copies the newest count messages, oldest first
+    std::vector<ServerChatMessage> tail(std::size_t count) const;
+
+    // copies the retained messages with a sequence in [begin, end), oldest first
+    std::vector<ServerChatMessage> range(std::uint64_t begin, std::uint64_t end) const;
+
+    // appends the encodings of the retained messages with a sequence in [begin, end)
+    // to out, oldest first, and returns how many were appended
+    std::size_t appendEncoded(std::uint64_t begin, std::uint64_t end, std::string& out) const;
+
+    // sequence of the oldest retained message stamped at or after timestamp, nextSequence() if there is none
+    std::uint64_t sequenceAt(std::uint64_t timestamp) const;
+
+    private:
+    HistoryRetention d_retention;
+    std::vector<ServerChatMessage> d_slots;
+    std::vector<std::string> d_encoded; // d_slots[i] encoded
+    std::size_t d_head = 0;   // slot of the oldest message
+    std::size_t d_size = 0;
+    std::size_t d_bytes = 0;
+    std::uint64_t d_nextSequence = 0;
+    std::uint64_t d_lastTimestamp = 0;
+    // (timestamp, sequence) of every retained message whose sequence is a multiple of s_timeIndexStride
+    std::deque<std::pair<std::uint64_t, std::uint64_t>> d_timeIndex;
+
+    static std::size_t messageBytes(const ServerChatMessage& message);
+
+    static void encode(const ServerChatMessage& message, std::string& out);
+
+    void popOldest();
+};
+
+inline
+RoomHistory::RoomHistory(const HistoryRetention& retention)
+: d_retention(retention)
+{
+    if (d_retention.maxMessages == 0) {
+        d_retention.maxMessages = 1;
+    }
+}
+
+inline
+void RoomHistory::push(const ServerChatMessage& message) {
+    push(message.senderId, message.message, message.timestamp);
+}
+
+inline
+void RoomHistory::push(std::string_view senderId, std::string_view message, std::uint64_t timestamp) {
+    auto bytes = senderId.size() + message.size();
+    std::size_t index;
+
+    // make room by bytes first, the newest message is always kept even if it is over budget
+    while (d_size > 0 && d_bytes + bytes > d_retention.maxBytes) {
+        popOldest();
+    }
+
+    if (d_size == d_retention.maxMessages) {
+        // full: overwrite the oldest slot in place
+        index = d_head;
+        auto& slot = d_slots[index];
+        d_bytes -= messageBytes(slot);
+        slot.senderId.assign(senderId);
+        slot.message.assign(message);
+        d_head = (d_head + 1) % d_retention.maxMessages;
+    } else {
+        index = (d_head + d_size) % d_retention.maxMessages;
+        if (index == d_slots.size()) {
+            // not at the cap yet, grow by doubling but never past it
+            if (d_slots.size() == d_slots.capacity()) {
+                auto capacity = std::min(d_retention.maxMessages, std::max<std::size_t>(s_initialSlots, 2 * d_slots.size()));
+                d_slots.reserve(capacity);
+                d_encoded.reserve(capacity);
+            }
+            d_slots.push_back(ServerChatMessage{std::string(senderId), std::string(message), 0, 0});
+            d_encoded.emplace_back();
+        } else {
+            d_slots[index].senderId.assign(senderId);
+            d_slots[index].message.assign(message);
+        }
+        ++d_size;
+    }
+
+    timestamp = std::max(timestamp, d_lastTimestamp + 1);
+    d_lastTimestamp = timestamp;
+    d_slots[index].timestamp = timestamp;
+    d_slots[index].sequence = d_nextSequence++;
+    encode(d_slots[index], d_encoded[index]);
+    d_bytes += bytes;
+
+    if (d_slots[index].sequence % s_timeIndexStride == 0) {
+        d_timeIndex.emplace_back(timestamp, d_slots[index].sequence);
+    }
+    while (!d_timeIndex.empty() && d_timeIndex.front().second < firstSequence()) {
+        d_timeIndex.pop_front();
+    }
+}
+
+inline
+const ServerChatMessage& RoomHistory::operator[](std::size_t index) const {
+    return d_slots[(d_head + index) % d_retention.maxMessages];
+}
+
+inline
+std::string_view RoomHistory::encoded(std::size_t index) const {
+    return d_encoded[(d_head + index) % d_retention.maxMessages];
+}
+
+inline
+std::size_t RoomHistory::size() const {
+    return d_size;
+}
+
+inline
+std::size_t RoomHistory::bytes() const {
+    return d_bytes;
+}
+
+inline
+bool RoomHistory::empty() const {
+    return d_size == 0;
+}
+
+inline
+const HistoryRetention& RoomHistory::retention() const {
+    return d_retention;
+}
+
+inline
+std::uint64_t RoomHistory::firstSequence() const {
+    return d_nextSequence - d_size;
+}
+
+inline
+std::uint64_t RoomHistory::nextSequence() const {
+    return d_nextSequence;
+}
+
+inline
+void RoomHistory::startAt(std::uint64_t sequence) {
+    if (d_size == 0) {
+        d_nextSequence = sequence;
+    }
+}
+
+inline
+std::vector<ServerChatMessage> RoomHistory::tail(std::size_t count) const {
+    if (count > d_size) {
+        count = d_size;
+    }
+    return range(d_nextSequence - count, d_nextSequence);
+}
+
+inline
+std::vector<ServerChatMessage> RoomHistory::range(std::uint64_t begin, std::uint64_t end) const {
+    begin = std::max(begin, firstSequence());
+    end = std::min(end, d_nextSequence);
+
+    std::vector<ServerChatMessage> messages;
+    if (begin >= end) {
+        return messages;
+    }
+
+    messages.reserve(end - begin);
+    for (auto sequence = begin; sequence < end; ++sequence) {
+        messages.push_back((*this)[sequence - firstSequence()]);
+    }
+    return messages;
+}
+
+inline
+std::size_t RoomHistory::appendEncoded(std::uint64_t begin, std::uint64_t end, std::string& out) const {
+    begin = std::max(begin, firstSequence());
+    end = std::min(end, d_nextSequence);
+    if (begin >= end) {
+        return 0;
+    }
+
+    std::size_t bytes = 0;
+    for (auto sequence = begin; sequence < end; ++sequence) {
+        bytes += d_encoded[(d_head + (sequence - firstSequence())) % d_retention.maxMessages].size();
+    }
+    out.reserve(out.size() + bytes);
+    for (auto sequence = begin; sequence < end; ++sequence) {
+        out += d_encoded[(d_head + (sequence - firstSequence())) % d_retention.maxMessages];
+    }
+    return end - begin;
+}
+
+inline
+std::uint64_t RoomHistory::sequenceAt(std::uint64_t timestamp) const {
+    // the answer is after the last sampled message stamped before timestamp and at most the first one after
+    auto sample = std::lower_bound(d_timeIndex.begin(), d_timeIndex.end(), timestamp,
+                                   [](const auto& entry, std::uint64_t t) { return entry.first < t; });
+    auto low = sample == d_timeIndex.begin() ? firstSequence() : std::prev(sample)->second;
+    auto high = sample == d_timeIndex.end() ? d_nextSequence : sample->second;
+
+    // then a binary search of the stride between the two samples
+    while (low < high) {
+        auto middle = low + (high - low) / 2;
+        if ((*this)[middle - firstSequence()].timestamp < timestamp) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+inline
+std::size_t RoomHistory::messageBytes(const ServerChatMessage& message) {
+    return message.senderId.size() + message.message.size();
+}
+
+inline
+void RoomHistory::popOldest() {
+    // evicted by bytes, so release the strings rather than keeping their capacity around
+    auto& slot = d_slots[d_head];
+    d_bytes -= messageBytes(slot);
+    slot = ServerChatMessage{};
+    d_encoded[d_head] = std::string{};
+    d_head = (d_head + 1) % d_retention.maxMessages;
+    --d_size;
+}
+
+inline
+void RoomHistory::encode(const ServerChatMessage& message, std::string& out) {
+    // keeps the slot's capacity, so steady state appends do not allocate
+    out.clear();
+    auto archive = zpp::bits::out(out);
+    if (failure(archive(message))) {
+        out.clear();
+    }
+}
@@ -0,0 +1,444 @@
+#include "roomshard.h"
+#include "spdlog/spdlog.h"
+
+#include <chrono>
+#include <cstring>
+#include <variant>
+#include <type_traits>
+
+namespace {
+
+// takes ownership of the serialized bytes without copying them, the buffer is
+// freed by zmq once the last message referencing it has been sent
+zmq::message_t makeSharedPayload(std::string&& serialized) {
+    auto* buffer = new std::string(std::move(serialized));
+    return zmq::message_t(buffer->data(), buffer->size(),
+                          [](void*, void* hint) { delete static_cast<std::string*>(hint); },
+                          buffer);
+}
+
+// ServerBaseMessage::payload is encoded as its index followed by the alternative
+constexpr std::byte k_roomChatMessageId{0};
+constexpr std::byte k_connectionResponseId{1};
+constexpr std::byte k_historyResponseId{3};
+constexpr std::byte k_historyRangeResponseId{5};
+static_assert(std::is_same_v<std::variant_alternative_t<0, decltype(ServerBaseMessage::payload)>, ServerRoomChatMessage>);
+static_assert(std::is_same_v<std::variant_alternative_t<1, decltype(ServerBaseMessage::payload)>, ServerConnectionResponse>);
+static_assert(std::is_same_v<std::variant_alternative_t<3, decltype(ServerBaseMessage::payload)>, ServerHistoryResponse>);
+static_assert(std::is_same_v<std::variant_alternative_t<5, decltype(ServerBaseMessage::payload)>, ServerHistoryRangeResponse>);
+
+// The encoders below produce exactly what serialize_serverbasemsg would for the response, but
+// write the fields around the history themselves and splice the history in from the encodings
+// RoomHistory keeps, so no message is serialized again. begin and end must be within the history.
+
+// ServerRoomChatMessage{room_id, message} up to the message, which follows it as the history encoded it
+std::string encodeRoomChatPrefix(const std::string& room_id) {
+    std::string data;
+    auto out = zpp::bits::out(data);
+    if (failure(out(k_roomChatMessageId, room_id))) {
+        data.clear();
+    }
+    return data;
+}
+
+// ServerConnectionResponse{room_id, true, none, history [begin, end), begin, publish}
+std::optional<std::string> encodeConnectionResponse(const std::string& room_id, const RoomHistory& history,
+                                                    std::uint64_t begin, std::uint64_t end,
+                                                    const std::optional<RoomPublish>& publish) {
+    std::string data;
+    auto out = zpp::bits::out(data);
+    const std::optional<std::string> noReason;
+    if (failure(out(k_connectionResponseId, room_id, true, noReason, static_cast<std::uint32_t>(end - begin)))) {
+        return std::nullopt;
+    }
+    history.appendEncoded(begin, end, data);
+    out.position() = data.size();
+    if (failure(out(begin, publish))) {
+        return std::nullopt;
+    }
+    return data;
+}
+
+// ServerHistoryResponse{room_id, history [begin, end), begin, hasMore}
+std::optional<std::string> encodeHistoryResponse(const std::string& room_id, const RoomHistory& history,
+                                                 std::uint64_t begin, std::uint64_t end, bool hasMore) {
+    std::string data;
+    auto out = zpp::bits::out(data);
+    if (failure(out(k_historyResponseId, room_id, static_cast<std::uint32_t>(end - begin)))) {
+        return std::nullopt;
+    }
+    history.appendEncoded(begin, end, data);
+    out.position() = data.size();
+    if (failure(out(begin, hasMore))) {
+        return std::nullopt;
+    }
+    return data;
+}
+
+// ServerHistoryRangeResponse{room_id, from, to, history [begin, end), hasMore}
+std::optional<std::string> encodeHistoryRangeResponse(const std::string& room_id, std::uint64_t from, std::uint64_t to,
+                                                      const RoomHistory& history, std::uint64_t begin, std::uint64_t end,
+                                                      bool hasMore) {
+    std::string data;
+    auto out = zpp::bits::out(data);
+    if (failure(out(k_historyRangeResponseId, room_id, from, to, static_cast<std::uint32_t>(end - begin)))) {
+        return std::nullopt;
+    }
+    history.appendEncoded(begin, end, data);
+    out.position() = data.size();
+    if (failure(out(hasMore))) {
+        return std::nullopt;
+    }
+    return data;
+}
+
+std::uint64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+} // namespace
+
+const std::size_t RoomShard::s_maxHistoryPage = 500;
+const std::size_t RoomShard::s_maxSearchPage = 100;
+const std::size_t RoomShard::s_maxSearchDepth = 1000;
+const std::chrono::microseconds RoomShard::s_searchBudget(2000);
+
+RoomShard::RoomShard(SendFunc send, MessageLog* log)
+: d_send(std::move(send))
+, d_log(log)
+{
+}
+
+void RoomShard::enablePublishing(PublishFunc publish, const std::string& address) {
+    d_publish = std::move(publish);
+    d_publishAddress = address;
+}
+
+std::string RoomShard::topicOf(const std::string& room_id) {
+    // subscriptions match by prefix, the terminator stops "gen" matching "general"
+    return room_id + '\0';
+}
+
+void RoomShard::process(const RoomTask& task) {
+    switch (task.type) {
+        case RoomTask::Type::e_CREATE:
+            handleCreate(task);
+            break;
+        case RoomTask::Type::e_JOIN:
+            handleJoin(task);
+            break;
+        case RoomTask::Type::e_LEAVE:
+            handleLeave(task);
+            break;
+        case RoomTask::Type::e_CHAT:
+            handleChat(task);
+            break;
+        case RoomTask::Type::e_HISTORY:
+            handleHistory(task);
+            break;
+        case RoomTask::Type::e_SEARCH:
+            d_searches.push_back(task);
+            break;
+        case RoomTask::Type::e_HISTORY_RANGE:
+            handleHistoryRange(task);
+            break;
+    }
+}
+
+bool RoomShard::runDeferred() {
+    for (auto* room : d_unindexed) {
+        catchUpIndex(*room);
+    }
+    d_unindexed.clear();
+
+    if (d_searches.empty()) {
+        return false;
+    }
+    auto deadline = std::chrono::steady_clock::now() + s_searchBudget;
+    do {
+        handleSearch(d_searches.front());
+        d_searches.pop_front();
+    } while (!d_searches.empty() && std::chrono::steady_clock::now() < deadline);
+    d_metrics.searchesDeferred.add(d_searches.size());
+    return true;
+}
+
+// BUSINESS LOGIC FUNCTIONS
+
+void RoomShard::handleCreate(const RoomTask& task) {
+    if (d_rooms.contains(task.room)) {
+        spdlog::error("Attempted to create room that already exists: {}", task.roomId);
+        return;
+    }
+
+    auto& room = d_rooms.emplace(task.room, Room{std::string(task.roomId), {}, RoomHistory(task.retention)}).first->second;
+    room.chatPrefix = encodeRoomChatPrefix(room.id);
+    if (d_log) {
+        // restores the history if the room was logged by a previous run
+        room.logged = d_log->open(room.id, room.history);
+        markUnindexed(room);
+    }
+
+    // rooms created by the server itself have no owner
+    if (task.client == k_invalidHandle) {
+        return;
+    }
+
+    room.clients.insert(task.client);
+    sendCreateRoomResponse(room, task.client);
+}
+
+void RoomShard::handleJoin(const RoomTask& task) {
+    auto it = d_rooms.find(task.room);
+    if (it == d_rooms.end()) {
+        spdlog::error("Join for room {} that is not owned by this shard", task.room);
+        return;
+    }
+
+    it->second.clients.insert(task.client);
+    // only the tail goes in the response so joining a big room stays cheap,
+    // the client pages back through the rest with ClientHistoryRequest
+    const auto& history = it->second.history;
+    auto next = history.nextSequence();
+    std::uint64_t begin;
+    if (task.lastSequence.has_value()) {
+        // a resuming client only gets what it missed, a page at most. A last sequence at or past the end
+        // (a client ahead of a restored room, or UINT64_MAX, where + 1 would wrap to 0) gets nothing
+        auto after = *task.lastSequence >= next ? next : *task.lastSequence + 1;
+        begin = std::max(after, next - std::min<std::uint64_t>(next, s_maxHistoryPage));
+    } else {
+        begin = next - std::min<std::uint64_t>(history.size(), task.count);
+    }
+    sendConnectionResponse(it->second, task.client, std::min(std::max(begin, history.firstSequence()), next), next);
+    //TODO: should broadcast to all clients in the room that a new client has connected
+}
+
+void RoomShard::handleLeave(const RoomTask& task) {
+    auto it = d_rooms.find(task.room);
+    if (it == d_rooms.end()) {
+        return;
+    }
+
+    it->second.clients.erase(task.client);
+}
+
+void RoomShard::handleChat(const RoomTask& task) {
+    auto it = d_rooms.find(task.room);
+    if (it == d_rooms.end() || !it->second.clients.contains(task.client)) {
+        spdlog::warn("Dropping chat from {} for a room they are not in", task.clientId);
+        return;
+    }
+
+    broadcastMessage(it->second, task.clientId, task.message, task.client);
+}
+
+void RoomShard::handleHistory(const RoomTask& task) {
+    auto it = d_rooms.find(task.room);
+    if (it == d_rooms.end() || !it->second.clients.contains(task.client)) {
+        spdlog::warn("Dropping history request for a room the client is not in");
+        return;
+    }
+
+    d_metrics.historyRequests.add();
+    const auto& history = it->second.history;
+    auto count = std::min(task.count, s_maxHistoryPage);
+    auto end = std::min(task.beforeSequence, history.nextSequence());
+    auto begin = std::max(end - std::min<std::uint64_t>(end, count), history.firstSequence());
+
+    // a page from before everything retained is empty
+    sendHistoryResponse(task.client, it->second, std::min(begin, end), end);
+}
+
+void RoomShard::handleSearch(const RoomTask& task) {
+    auto it = d_rooms.find(task.room);
+    if (it == d_rooms.end() || !it->second.clients.contains(task.client)) {
+        spdlog::warn("Dropping search request for a room the client is not in");
+        return;
+    }
+
+    d_metrics.searches.add();
+    const auto& room = it->second;
+    auto offset = std::min(task.offset, s_maxSearchDepth);
+    auto count = std::min({task.count, s_maxSearchPage, s_maxSearchDepth - offset});
+
+    SearchResult result;
+    {
+        ScopedTimer timer(d_metrics.searchNs);
+        result = room.index.search(task.message, offset, count);
+    }
+
+    ServerSearchResponse response{room.id, std::string(task.message), {}, static_cast<std::uint32_t>(offset), result.total};
+    response.hits.reserve(result.hits.size());
+    for (const auto& hit : result.hits) {
+        response.hits.push_back(room.history[hit.sequence - room.history.firstSequence()]);
+    }
+
+    auto serialized = serialize(ServerBaseMessage{std::move(response)});
+    if (!serialized.has_value()) {
+        spdlog::error("Failed to serialize message in RoomShard::handleSearch");
+        return;
+    }
+    d_send(task.client, makeSharedPayload(std::move(*serialized)), OutboundKind::e_CONTROL);
+}
+
+void RoomShard::handleHistoryRange(const RoomTask& task) {
+    auto it = d_rooms.find(task.room);
+    if (it == d_rooms.end() || !it->second.clients.contains(task.client)) {
+        spdlog::warn("Dropping history range request for a room the client is not in");
+        return;
+    }
+
+    d_metrics.historyRequests.add();
+    const auto& history = it->second.history;
+    auto begin = history.sequenceAt(task.fromTimestamp);
+    auto end = task.toTimestamp > task.fromTimestamp ? history.sequenceAt(task.toTimestamp) : begin;
+    auto count = std::min(task.count, s_maxHistoryPage);
+    bool hasMore = end - begin > count;
+    if (hasMore) {
+        end = begin + count;
+    }
+
+    sendHistoryRangeResponse(task.client, it->second, task, begin, end, hasMore);
+}
+
+void RoomShard::markUnindexed(Room& room) {
+    if (!room.indexPending) {
+        room.indexPending = true;
+        d_unindexed.push_back(&room);
+    }
+}
+
+void RoomShard::catchUpIndex(Room& room) {
+    ScopedTimer timer(d_metrics.indexNs);
+    const auto& history = room.history;
+    auto first = history.firstSequence();
+    for (auto sequence = std::max(room.index.nextSequence(), first); sequence < history.nextSequence(); ++sequence) {
+        room.index.add(sequence, history[sequence - first].message);
+    }
+    room.index.evictBefore(first);
+    room.indexPending = false;
+}
+
+// NETWORKING FUNCTIONS
+
+std::optional<std::string> RoomShard::serialize(const ServerBaseMessage& message) {
+    ScopedTimer timer(d_metrics.serializeNs);
+    return serialize_serverbasemsg(message);
+}
+
+void RoomShard::broadcastNewConnection(Room& room, const std::string& id) {
+    broadcastMessage(room, "ALERT", "New client connected: " + id, k_invalidHandle);
+}
+
+void RoomShard::broadcastMessage(Room& room, std::string_view senderId, std::string_view message, ClientHandle sender) {
+    // the history copies the strings into a slot that reuses their capacity and encodes it once
+    room.history.push(senderId, message, nowNs());
+    const auto& stored = room.history[room.history.size() - 1];
+    markUnindexed(room);
+
+    // every member send shares the one payload, copy() only bumps zmq's refcount
+    zmq::message_t payload;
+    {
+        ScopedTimer timer(d_metrics.serializeNs);
+        auto encoded = room.history.encoded(room.history.size() - 1);
+        const auto& prefix = room.chatPrefix;
+        payload = zmq::message_t(prefix.size() + encoded.size());
+        auto* data = static_cast<char*>(payload.data());
+        std::memcpy(data, prefix.data(), prefix.size());
+        std::memcpy(data + prefix.size(), encoded.data(), encoded.size());
+    }
+    d_metrics.broadcasts.add();
+    d_metrics.fanoutSize.record(room.clients.size());
+    if (d_publish) {
+        // zmq does the fan-out, subscribers (the sender too) filter on the topic
+        d_publish(topicOf(room.id), std::move(payload));
+    } else {
+        for (auto client : room.clients) {
+            if (client == sender) {
+                continue;
+            }
+            zmq::message_t msg;
+            msg.copy(payload);
+            d_send(client, std::move(msg), OutboundKind::e_CHAT);
+        }
+    }
+
+    if (d_log && room.logged) {
+        d_log->append(room.id, stored);
+    }
+}
+
+void RoomShard::sendConnectionResponse(Room& room, ClientHandle client, std::uint64_t begin, std::uint64_t end) {
+    d_metrics.joins.add();
+    auto& cache = room.joinCache;
+    if (cache.payload.size() == 0 || cache.begin != begin || cache.end != end) {
+        std::optional<std::string> serialized;
+        {
+            ScopedTimer timer(d_metrics.serializeNs);
+            serialized = encodeConnectionResponse(room.id, room.history, begin, end, publishInfo(room));
+        }
+        if (!serialized.has_value()) {
+            spdlog::error("Failed to serialize message in RoomShard::sendConnectionResponse");
+            return;
+        }
+        cache.begin = begin;
+        cache.end = end;
+        cache.payload = makeSharedPayload(std::move(*serialized));
+    } else {
+        d_metrics.joinCacheHits.add();
+    }
+
+    zmq::message_t msg;
+    msg.copy(cache.payload);
+    d_send(client, std::move(msg), OutboundKind::e_CONTROL);
+}
+
+void RoomShard::sendCreateRoomResponse(const Room& room, ClientHandle client) {
+    ServerCreateRoomResponse response{room.id, true, std::nullopt, publishInfo(room)};
+    ServerBaseMessage baseMessage{response};
+    auto serialized = serialize(baseMessage);
+    if (!serialized.has_value()) {
+        spdlog::error("Failed to serialize message in RoomShard::sendCreateRoomResponse");
+        return;
+    }
+
+    d_send(client, zmq::message_t(*serialized), OutboundKind::e_CONTROL);
+}
+
+void RoomShard::sendHistoryResponse(ClientHandle client, const Room& room, std::uint64_t begin, std::uint64_t end) {
+    std::optional<std::string> serialized;
+    {
+        ScopedTimer timer(d_metrics.serializeNs);
+        serialized = encodeHistoryResponse(room.id, room.history, begin, end, begin > room.history.firstSequence());
+    }
+    if (!serialized.has_value()) {
+        spdlog::error("Failed to serialize message in RoomShard::sendHistoryResponse");
+        return;
+    }
+
+    d_send(client, makeSharedPayload(std::move(*serialized)), OutboundKind::e_CONTROL);
+}
+
+void RoomShard::sendHistoryRangeResponse(ClientHandle client, const Room& room, const RoomTask& task,
+                                         std::uint64_t begin, std::uint64_t end, bool hasMore) {
+    std::optional<std::string> serialized;
+    {
+        ScopedTimer timer(d_metrics.serializeNs);
+        serialized = encodeHistoryRangeResponse(room.id, task.fromTimestamp, task.toTimestamp, room.history,
+                                                begin, end, hasMore);
+    }
+    if (!serialized.has_value()) {
+        spdlog::error("Failed to serialize message in RoomShard::sendHistoryRangeResponse");
+        return;
+    }
+
+    d_send(client, makeSharedPayload(std::move(*serialized)), OutboundKind::e_CONTROL);
+}
+
+std::optional<RoomPublish> RoomShard::publishInfo(const Room& room) const {
+    if (!d_publish) {
+        return std::nullopt;
+    }
+    return RoomPublish{d_publishAddress, topicOf(room.id)};
+}
@@ -0,0 +1,175 @@
+#pragma once
+
+#include "messaging.h"
+#include "roomhistory.h"
+#include "searchindex.h"
+#include "messagelog.h"
+#include "registry.h"
+#include "outboundqueue.h"
+#include "metrics.h"
+
+#include <deque>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <zmq.hpp>
+#include <optional>
+#include <functional>
+#include <string_view>
+#include <unordered_map>
+#include <memory_resource>
+
+// the last join response a room encoded, a join storm (many clients asking for the
+// same history while nothing new is said) gets the one payload by refcount
+struct JoinResponseCache {
+    std::uint64_t begin = 0;  // the history it carries, [begin, end)
+    std::uint64_t end = 0;
+    zmq::message_t payload;   // empty until the first join
+};
+
+struct Room {
+    std::string id;
+    MemberSet clients;
+    RoomHistory history;
+    JoinResponseCache joinCache{};
+    SearchIndex index{};      // over the messages in history, caught up after each batch
+    bool indexPending = false; // history has messages the index has not seen
+    std::string chatPrefix{}; // a ServerRoomChatMessage of this room encoded up to the message
+    bool logged = false;      // the message log took the room (it refuses one it cannot continue)
+};
+
+// a unit of room work handed from the I/O thread to the shard that owns the room. Its strings
+// use whatever memory resource they were built with, a task processed right away can live
+// in the I/O thread's BatchArena
+struct RoomTask {
+    enum class Type {
+        e_CREATE,   // create the room named roomId, then add client (if valid) to it
+        e_JOIN,     // add client to the room and send it the last count messages (or those after lastSequence)
+        e_LEAVE,    // remove client from the room
+        e_CHAT,     // broadcast message from client (named clientId) to the room
+        e_HISTORY,  // send client up to count messages from before beforeSequence
+        e_SEARCH,   // send client up to count of the messages matching message, skipping the best offset
+        e_HISTORY_RANGE // send client up to count messages stamped in [fromTimestamp, toTimestamp)
+    };
+
+    Type type;
+    ClientHandle client;
+    RoomHandle room;
+    std::pmr::string clientId{}; // only used by e_CHAT
+    std::pmr::string roomId{};   // only used by e_CREATE
+    std::pmr::string message{};  // the chat message, or the query of an e_SEARCH
+    HistoryRetention retention{}; // only used by e_CREATE
+    std::uint64_t beforeSequence = 0;
+    std::size_t count = 0;
+    std::size_t offset = 0; // only used by e_SEARCH
+    std::uint64_t fromTimestamp = 0; // only used by e_HISTORY_RANGE
+    std::uint64_t toTimestamp = 0;   // only used by e_HISTORY_RANGE
+    std::optional<std::uint64_t> lastSequence{}; // only used by e_JOIN, set when the client is resuming
+};
+
+// Owns a subset of the server's rooms. All calls on a shard must come from the
+// single thread that owns it (the I/O thread, or its worker thread in sharded mode).
+class RoomShard {
+
+public:
+    // used to hand an encoded ServerBaseMessage back to the I/O thread for client, kind is
+    // e_CHAT for room chat and e_CONTROL for everything else
+    using SendFunc = std::function<void(ClientHandle client, zmq::message_t&& payload, OutboundKind kind)>;
+
+    // used to hand an encoded ServerBaseMessage back to the I/O thread for everyone subscribed to topic
+    using PublishFunc = std::function<void(const std::string& topic, zmq::message_t&& payload)>;
+
+    // log may be null, otherwise every room is opened in it and every broadcast appended to it
+    explicit RoomShard(SendFunc send, MessageLog* log = nullptr);
+
+    // searches are only queued here, they run in runDeferred()
+    void process(const RoomTask& task);
+
+    // indexes the messages broadcast since the last call, then runs the queued searches until
+    // s_searchBudget is spent (at least one), the rest wait for the next call. Called once a batch
+    // of tasks is done (and its chat sent) so neither holds up chat, nor do many searches hold up
+    // the next batch. Returns false if no search ran, so nothing was sent
+    bool runDeferred();
+
+    // searches are still queued, runDeferred() should be called again without waiting for more tasks
+    bool hasDeferred() const;
+
+    // room chat is then published once per message on the room's topic instead of
+    // sent to each member, joins tell the client to subscribe at address
+    void enablePublishing(PublishFunc publish, const std::string& address);
+
+    // the topic a room's chat is published on
+    static std::string topicOf(const std::string& room_id);
+
+    // safe to read from any thread while the shard is running
+    const ShardMetrics& metrics() const;
+
+    private:
+    SendFunc d_send;
+    PublishFunc d_publish;
+    std::string d_publishAddress;
+    MessageLog* d_log;
+    std::unordered_map<RoomHandle, Room> d_rooms;
+    std::deque<RoomTask> d_searches;
+    std::vector<Room*> d_unindexed;  // rooms with indexPending set
+    ShardMetrics d_metrics;
+
+    // BUSINESS LOGIC FUNCTIONS
+
+    void handleCreate(const RoomTask& task);
+
+    void handleJoin(const RoomTask& task);
+
+    void handleLeave(const RoomTask& task);
+
+    void handleChat(const RoomTask& task);
+
+    void handleHistory(const RoomTask& task);
+
+    void handleSearch(const RoomTask& task);
+
+    void handleHistoryRange(const RoomTask& task);
+
+    // queues room for runDeferred to index
+    void markUnindexed(Room& room);
+
+    // adds the history the index has not seen yet and drops what the history evicted
+    void catchUpIndex(Room& room);
+
+    // NETWORKING FUNCTIONS
+
+    // serialize_serverbasemsg, timed into d_metrics
+    std::optional<std::string> serialize(const ServerBaseMessage& message);
+
+    void broadcastNewConnection(Room& room, const std::string& id);
+    // adds the message to the room's history (which stamps its sequence and time) and sends it to every
+    // member except sender, the payload is chatPrefix and the history's encoding of it so nothing is serialized
+    void broadcastMessage(Room& room, std::string_view senderId, std::string_view message, ClientHandle sender);
+    // sends the history in [begin, end), reusing the room's cached response when it carries the same
+    void sendConnectionResponse(Room& room, ClientHandle client, std::uint64_t begin, std::uint64_t end);
+    void sendCreateRoomResponse(const Room& room, ClientHandle client);
+    std::optional<RoomPublish> publishInfo(const Room& room) const;
+    void sendHistoryResponse(ClientHandle client, const Room& room, std::uint64_t begin, std::uint64_t end);
+    void sendHistoryRangeResponse(ClientHandle client, const Room& room, const RoomTask& task,
+                                  std::uint64_t begin, std::uint64_t end, bool hasMore);
+
+    // the most messages a single history page will carry
+    static const std::size_t s_maxHistoryPage;
+
+    // the most hits a search page carries, and the deepest a search can page (offset + count)
+    static const std::size_t s_maxSearchPage;
+    static const std::size_t s_maxSearchDepth;
+
+    // searching a runDeferred() does before leaving the rest for the next batch
+    static const std::chrono::microseconds s_searchBudget;
+};
+
+inline
+bool RoomShard::hasDeferred() const {
+    return !d_searches.empty();
+}
+
+inline
+const ShardMetrics& RoomShard::metrics() const {
+    return d_metrics;
+}
@@ -0,0 +1,284 @@
+#pragma once
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <functional>
+#include <string_view>
+#include <unordered_map>
+
+struct SearchHit {
+    std::uint64_t sequence;
+    double score;
+};
+
+struct SearchResult {
+    std::vector<SearchHit> hits;  // best first
+    std::uint64_t total = 0;      // every message that matched, not just the page in hits
+};
+
+// Inverted index over the retained messages of one room's history, updated as
+// messages are appended and evicted.
+//
+// Terms are runs of letters and digits (any non-ASCII byte counts as a letter so
+// UTF-8 words stay whole), lowercased and cut to s_maxTermBytes. Every term maps
+// to its postings, (sequence, occurrences), in sequence order since messages are
+// only ever added newest last. A query matches the messages containing all of its
+// terms: the rarest term's postings are walked and each other list is searched
+// forward from where it was last found, so a query costs about the size of its
+// rarest term's list. Hits are ranked by BM25 without length normalisation (the
+// idf of each term times its saturated count), newest first on ties.
+//
+// Evicted messages are dropped lazily: queries skip postings before the oldest
+// retained sequence and the lists are compacted once evicted postings outnumber
+// the live ones.
+class SearchIndex {
+
+public:
+    static constexpr std::size_t s_maxTermBytes = 32;
+
+    // indexes text as the message with sequence, sequences must come in increasing order
+    void add(std::uint64_t sequence, std::string_view text);
+
+    // forgets every message with a sequence before sequence
+    void evictBefore(std::uint64_t sequence);
+
+    // the messages containing every term of query, skipping the best offset and returning at most limit
+    SearchResult search(std::string_view query, std::size_t offset, std::size_t limit) const;
+
+    // messages currently searchable
+    std::size_t messageCount() const;
+
+    // one past the newest indexed sequence, where add() carries on from
+    std::uint64_t nextSequence() const;
+
+    // distinct terms, evicted ones included until the next compaction
+    std::size_t termCount() const;
+
+    private:
+    struct Posting {
+        std::uint64_t sequence;
+        std::uint32_t occurrences;
+    };
+
+    // lets d_postings be searched with a string_view
+    struct Hash {
+        using is_transparent = void;
+
+        std::size_t operator()(std::string_view term) const {
+            return std::hash<std::string_view>{}(term);
+        }
+    };
+
+    std::unordered_map<std::string, std::vector<Posting>, Hash, std::equal_to<>> d_postings;
+    std::uint64_t d_first = 0;  // oldest searchable sequence
+    std::uint64_t d_next = 0;   // one past the newest indexed sequence
+    std::size_t d_evicted = 0;  // evicted messages whose postings are still in the lists
+
+    // scratch for add, kept so indexing a message does not allocate once warmed up
+    std::string d_lowered;
+    std::vector<std::string_view> d_terms;
+
+    // lowercases text into lowered and collects its terms (views into lowered), sorted
+    static void tokenize(std::string_view text, std::string& lowered, std::vector<std::string_view>& terms);
+
+    static bool isTermByte(unsigned char c);
+
+    // BM25 term frequency saturation
+    static double termWeight(std::uint32_t occurrences);
+
+    void compact();
+};
+
+inline
+void SearchIndex::add(std::uint64_t sequence, std::string_view text) {
+    if (messageCount() == 0) {
+        d_first = sequence;
+    }
+    d_next = sequence + 1;
+
+    tokenize(text, d_lowered, d_terms);
+    for (std::size_t i = 0; i < d_terms.size();) {
+        // the terms are sorted, so repeats of a term are next to each other
+        std::size_t end = i + 1;
+        while (end < d_terms.size() && d_terms[end] == d_terms[i]) {
+            ++end;
+        }
+
+        auto it = d_postings.find(d_terms[i]);
+        if (it == d_postings.end()) {
+            it = d_postings.emplace(std::string(d_terms[i]), std::vector<Posting>{}).first;
+        }
+        it->second.push_back(Posting{sequence, static_cast<std::uint32_t>(end - i)});
+        i = end;
+    }
+}
+
+inline
+void SearchIndex::evictBefore(std::uint64_t sequence) {
+    sequence = std::min(sequence, d_next);
+    if (sequence <= d_first) {
+        return;
+    }
+
+    d_evicted += sequence - d_first;
+    d_first = sequence;
+    // amortised, every compaction is paid for by at least as many evictions as there are live messages
+    if (d_evicted > messageCount()) {
+        compact();
+    }
+}
+
+inline
+SearchResult SearchIndex::search(std::string_view query, std::size_t offset, std::size_t limit) const {
+    SearchResult result;
+
+    std::string lowered;
+    std::vector<std::string_view> terms;
+    tokenize(query, lowered, terms);
+    terms.erase(std::unique(terms.begin(), terms.end()), terms.end());
+    if (terms.empty()) {
+        return result;
+    }
+
+    // the live part of every term's postings, a term with none means nothing can match
+    struct List {
+        const Posting* begin;
+        const Posting* end;
+        double idf;
+    };
+    auto bySequence = [](const Posting& posting, std::uint64_t sequence) { return posting.sequence < sequence; };
+    double messages = static_cast<double>(messageCount());
+    std::vector<List> lists;
+    lists.reserve(terms.size());
+    for (auto term : terms) {
+        auto it = d_postings.find(term);
+        if (it == d_postings.end()) {
+            return result;
+        }
+        const auto* end = it->second.data() + it->second.size();
+        const auto* begin = std::lower_bound(it->second.data(), end, d_first, bySequence);
+        if (begin == end) {
+            return result;
+        }
+        double containing = static_cast<double>(end - begin);
+        lists.push_back(List{begin, end, std::log(1.0 + (messages - containing + 0.5) / (containing + 0.5))});
+    }
+    std::sort(lists.begin(), lists.end(), [](const List& a, const List& b) { return a.end - a.begin < b.end - b.begin; });
+
+    // min heap of the best offset + limit hits so far, the worst one on top
+    auto better = [](const SearchHit& a, const SearchHit& b) {
+        return a.score != b.score ? a.score > b.score : a.sequence > b.sequence;
+    };
+    std::size_t keep = offset + limit;
+    std::vector<SearchHit> best;
+    best.reserve(std::min<std::size_t>(keep, lists[0].end - lists[0].begin));
+
+    for (const auto* posting = lists[0].begin; posting != lists[0].end; ++posting) {
+        double score = lists[0].idf * termWeight(posting->occurrences);
+        bool matched = true;
+        bool exhausted = false;
+        for (std::size_t i = 1; i < lists.size() && matched; ++i) {
+            auto& list = lists[i];
+            list.begin = std::lower_bound(list.begin, list.end, posting->sequence, bySequence);
+            // a list that ran out cannot match anything later either
+            exhausted = list.begin == list.end;
+            matched = !exhausted && list.begin->sequence == posting->sequence;
+            if (matched) {
+                score += list.idf * termWeight(list.begin->occurrences);
+            }
+        }
+        if (exhausted) {
+            break;
+        }
+        if (!matched) {
+            continue;
+        }
+
+        ++result.total;
+        SearchHit hit{posting->sequence, score};
+        if (best.size() < keep) {
+            best.push_back(hit);
+            std::push_heap(best.begin(), best.end(), better);
+        } else if (keep > 0 && better(hit, best.front())) {
+            std::pop_heap(best.begin(), best.end(), better);
+            best.back() = hit;
+            std::push_heap(best.begin(), best.end(), better);
+        }
+    }
+
+    std::sort(best.begin(), best.end(), better);
+    if (offset < best.size()) {
+        result.hits.assign(best.begin() + offset, best.end());
+    }
+    return result;
+}
+
+inline
+std::size_t SearchIndex::messageCount() const {
+    return d_next - d_first;
+}
+
+inline
+std::uint64_t SearchIndex::nextSequence() const {
+    return d_next;
+}
+
+inline
+std::size_t SearchIndex::termCount() const {
+    return d_postings.size();
+}
+
+inline
+void SearchIndex::tokenize(std::string_view text, std::string& lowered, std::vector<std::string_view>& terms) {
+    // sized up front so the views taken below stay valid
+    lowered.resize(text.size());
+    terms.clear();
+
+    std::size_t termStart = 0;
+    std::size_t termBytes = 0;
+    for (std::size_t i = 0; i <= text.size(); ++i) {
+        unsigned char c = i < text.size() ? static_cast<unsigned char>(text[i]) : ' ';
+        if (isTermByte(c)) {
+            lowered[i] = static_cast<char>(c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c);
+            if (termBytes == 0) {
+                termStart = i;
+            }
+            ++termBytes;
+        } else if (termBytes > 0) {
+            terms.emplace_back(lowered.data() + termStart, std::min(termBytes, s_maxTermBytes));
+            termBytes = 0;
+        }
+    }
+    std::sort(terms.begin(), terms.end());
+}
+
+inline
+bool SearchIndex::isTermByte(unsigned char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c >= 0x80;
+}
+
+inline
+double SearchIndex::termWeight(std::uint32_t occurrences) {
+    constexpr double k1 = 1.2;
+    return occurrences * (k1 + 1) / (occurrences + k1);
+}
+
+inline
+void SearchIndex::compact() {
+    for (auto it = d_postings.begin(); it != d_postings.end();) {
+        auto& postings = it->second;
+        auto live = std::lower_bound(postings.begin(), postings.end(), d_first,
+                                     [](const Posting& posting, std::uint64_t sequence) { return posting.sequence < sequence; });
+        postings.erase(postings.begin(), live);
+        if (postings.empty()) {
+            it = d_postings.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    d_evicted = 0;
+}
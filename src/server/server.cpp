@@ -1,143 +1,1161 @@
 #include "server.h"
+#include "logging.h"
 #include "spdlog/spdlog.h"
 
-Server::Server(const std::string& address) 
-: context(1)
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <functional>
+
+const std::string Server::s_outboundAddr = "inproc://server-outbound";
+const std::chrono::milliseconds Server::s_pollTimeout(100);
+const std::size_t Server::s_timerWheelSlots = 512;
+const std::chrono::milliseconds Server::s_statsInterval(1000);
+const std::size_t Server::s_statsDeepestQueues = 10;
+const std::string Server::s_ioBellAddr = "inproc://server-io-bell";
+const std::string Server::s_logicBellAddr = "inproc://server-logic-bell";
+const std::size_t Server::s_pipelineSends = 1 << 16;
+const std::chrono::milliseconds Server::s_pipelineRetry(1);
+
+namespace {
+
+// d_roomOwners entry for a room whose owner has not been looked up yet
+constexpr std::uint32_t k_unknownOwner = UINT32_MAX;
+
+// what direct messages are stamped with, as rooms stamp theirs
+std::uint64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// what the ring places a direct conversation by, the same whichever of the two sent
+std::string directPairKey(std::string_view a, std::string_view b) {
+    if (b < a) {
+        std::swap(a, b);
+    }
+    std::string key;
+    key.reserve(a.size() + b.size() + 1);
+    key.append(a).append(1, '\0').append(b);
+    return key;
+}
+
+} // namespace
+
+Server::Worker::Worker(zmq::context_t& context, const std::string& outboundAddr, MessageLog* log)
+: pushSocket(context, ZMQ_PUSH)
+, shard([this](ClientHandle client, zmq::message_t&& payload, OutboundKind kind) {
+      OutboundHeader header{client, kind};
+      pushSocket.send(zmq::message_t(&header, sizeof(header)), zmq::send_flags::sndmore);
+      pushSocket.send(payload, zmq::send_flags::none);
+  }, log)
+{
+    pushSocket.set(zmq::sockopt::linger, 0);
+    pushSocket.connect(outboundAddr);
+}
+
+void Server::Worker::enablePublishing(const std::string& address) {
+    // published messages go back as [header with no client][topic][payload]
+    shard.enablePublishing([this](const std::string& topic, zmq::message_t&& payload) {
+        OutboundHeader none{k_invalidHandle, OutboundKind::e_CHAT};
+        pushSocket.send(zmq::message_t(&none, sizeof(none)), zmq::send_flags::sndmore);
+        pushSocket.send(zmq::message_t(topic), zmq::send_flags::sndmore);
+        pushSocket.send(payload, zmq::send_flags::none);
+    }, address);
+}
+
+Server::Decoder::Decoder(zmq::context_t& context, const Doorbell& logicBell, std::size_t depth)
+: in(depth)
+, out(depth)
+, logicRinger(logicBell.connectRinger(context))
+{
+}
+
+Server::Pipeline::Pipeline(zmq::context_t& context, std::size_t decoderCount, std::size_t depth)
+: ioBell(context, s_ioBellAddr)
+, logicBell(context, s_logicBellAddr)
+, spent(2 * depth * decoderCount)
+, sends(s_pipelineSends)
+, slowClients(depth)
+, ioRinger(logicBell.connectRinger(context))
+, logicRinger(ioBell.connectRinger(context))
+{
+    for (std::size_t i = 0; i < decoderCount; ++i) {
+        decoders.push_back(std::make_unique<Decoder>(context, logicBell, depth));
+    }
+}
+
+Server::Server(const std::string& address, const ServerConfig& config) 
+: d_config(config)
+, context(1)
 , routerSocket(context, ZMQ_ROUTER)
+, d_outboundSocket(context, ZMQ_PULL)
+, d_publishSocket(context, ZMQ_PUB)
+, d_self(static_cast<std::uint32_t>(config.clusterSelf))
+, d_peerInbound(context, ZMQ_PULL)
+, d_directHistories(config.directHistory, config.directConversations)
+, d_sessionTimers(config.sessionTimeout / s_pollTimeout, s_timerWheelSlots)
+, d_startTime(std::chrono::steady_clock::now())
+, d_running(false)
+, d_rateLimiter(config.rateLimit)
+, d_outbound(config.outbound)
+, d_statsSocket(context, ZMQ_REP)
+, d_statsDone(false)
 {
+    // makes sends to a client whose pipe is full fail instead of being dropped silently,
+    // they stay in its outbound queue until it catches up or its room policy kicks in
+    routerSocket.set(zmq::sockopt::router_mandatory, 1);
     routerSocket.bind(address);
+
+    if (d_config.receiveBatchSize == 0) {
+        d_config.receiveBatchSize = 1;
+    }
+
+    if (config.decoderThreads > 0) {
+        // the threads only start with run()
+        d_pipeline = std::make_unique<Pipeline>(context, config.decoderThreads, std::max<std::size_t>(config.pipelineDepth, 1));
+    }
+
+    if (!config.log.directory.empty()) {
+        d_log = std::make_unique<MessageLog>(config.log);
+    }
+
+    if (!config.clusterNodes.empty() && config.clusterSelf >= config.clusterNodes.size()) {
+        spdlog::error("Cluster node index {} is out of range for {} nodes, running standalone",
+                      config.clusterSelf, config.clusterNodes.size());
+    } else if (!config.clusterNodes.empty()) {
+        // set up before any room is created so only the rooms we own are
+        const auto& nodes = config.clusterNodes;
+        d_ring = std::make_unique<HashRing>(nodes);
+        d_peerInbound.set(zmq::sockopt::linger, 0);
+        d_peerInbound.bind(nodes[d_self]);
+        d_peerLinks.resize(nodes.size());
+        d_peerSends.resize(nodes.size());
+        for (std::uint32_t node = 0; node < nodes.size(); ++node) {
+            if (node == d_self) {
+                continue;
+            }
+            d_peerLinks[node] = zmq::socket_t(context, ZMQ_PUSH);
+            d_peerLinks[node].set(zmq::sockopt::linger, 0);
+            d_peerLinks[node].connect(nodes[node]);
+        }
+        spdlog::info("Cluster node {} of {}, peers connect to {}", d_self, nodes.size(), nodes[d_self]);
+    }
+
+    bool publishing = !config.publishAddress.empty();
+    if (publishing) {
+        d_publishSocket.set(zmq::sockopt::linger, 0);
+        d_publishSocket.bind(config.publishAddress);
+        spdlog::info("Publishing room chat on {}", config.publishAddress);
+    }
+
+    if (config.workerThreads == 0) {
+        d_localShard = std::make_unique<RoomShard>(
+            [this](ClientHandle client, zmq::message_t&& payload, OutboundKind kind) {
+                sendToClient(client, std::move(payload), kind);
+            }, d_log.get());
+        if (publishing) {
+            d_localShard->enablePublishing([this](const std::string& topic, zmq::message_t&& payload) {
+                publish(topic, std::move(payload));
+            }, config.publishAddress);
+        }
+    } else {
+        // the worker sockets are created here and then only ever used by their worker thread
+        d_outboundSocket.bind(s_outboundAddr);
+        for (std::size_t i = 0; i < config.workerThreads; ++i) {
+            d_workers.push_back(std::make_unique<Worker>(context, s_outboundAddr, d_log.get()));
+            if (publishing) {
+                d_workers.back()->enablePublishing(config.publishAddress);
+            }
+        }
+        for (auto& worker : d_workers) {
+            worker->thread = std::thread(&Server::runWorker, this, std::ref(*worker));
+        }
+        spdlog::info("Server sharding rooms across {} worker threads", d_workers.size());
+    }
+
+    if (d_log) {
+        // each shard replays the rooms it owns (in parallel when sharded)
+        for (const auto& roomId : d_log->roomIds()) {
+            createRoom(roomId);
+        }
+        spdlog::info("Restoring {} rooms from log {}", d_roomIds.size(), config.log.directory);
+    }
+
+    if (!config.statsAddress.empty()) {
+        d_statsSocket.set(zmq::sockopt::linger, 0);
+        d_statsSocket.bind(config.statsAddress);
+        d_statsThread = std::thread(&Server::runStats, this);
+        spdlog::info("Serving stats on {}", config.statsAddress);
+    }
+}
+
+Server::~Server() {
+    d_statsDone = true;
+    if (d_statsThread.joinable()) {
+        d_statsThread.join();
+    }
+    for (auto& worker : d_workers) {
+        worker->queue.close();
+    }
+    for (auto& worker : d_workers) {
+        if (worker->thread.joinable()) {
+            worker->thread.join();
+        }
+    }
 }
 
 void Server::run() {
-    while (true) {
-        auto msg = receiveMessage();
-        if (!msg.has_value()) {
-            continue;
+    d_running = true;
+
+    if (d_pipeline) {
+        runPipelined();
+        return;
+    }
+
+    // worker replies only arrive when sharded, peer messages only in a cluster
+    std::vector<zmq::pollitem_t> items = {
+        {routerSocket.handle(), 0, ZMQ_POLLIN, 0}
+    };
+    std::size_t outboundItem = 0;
+    std::size_t peerItem = 0;
+    if (!d_workers.empty()) {
+        outboundItem = items.size();
+        items.push_back({d_outboundSocket.handle(), 0, ZMQ_POLLIN, 0});
+    }
+    if (d_ring) {
+        peerItem = items.size();
+        items.push_back({d_peerInbound.handle(), 0, ZMQ_POLLIN, 0});
+    }
+
+    auto pollTimeout = s_pollTimeout;
+    while (d_running) {
+        zmq::poll(items.data(), items.size(), pollTimeout);
+
+        if (outboundItem != 0 && (items[outboundItem].revents & ZMQ_POLLIN)) {
+            forwardOutbound();
         }
 
-        if (std::holds_alternative<ClientChatMessage>(msg->payload)) {
-            handleClientChatMessage(*msg);
-        } else if (std::holds_alternative<ClientConnectionRequest>(msg->payload)) {
-            handleClientConnectionRequest(*msg);
-        } else if (std::holds_alternative<ClientCreateRoomRequest>(msg->payload)) {
-            handleClientCreateRoomRequest(*msg);
-        } else {
-            spdlog::warn("Received unknown message type");
+        if (peerItem != 0 && (items[peerItem].revents & ZMQ_POLLIN)) {
+            receivePeers();
+        }
+
+        if (items[0].revents & ZMQ_POLLIN) {
+            receiveBatch();
+        }
+        expireSessions();
+        flushSends();
+
+        // indexing and searches wait until this pass's chat is sent
+        if (d_localShard && d_localShard->runDeferred()) {
+            flushSends();
+        }
+        // searches over the budget run next pass, without waiting out a poll for them
+        pollTimeout = d_localShard && d_localShard->hasDeferred() ? std::chrono::milliseconds(0) : s_pollTimeout;
+        snapshotOutbound();
+
+        // every task of this pass has run by now (when they use the arena)
+        if (d_arena.reset()) {
+            d_metrics.arenaResizes.add();
         }
     }
 }
 
+void Server::stop() {
+    d_running = false;
+}
+
 void Server::createRoom(const std::string& room_id) {
+    createRoom(room_id, d_config.history);
+}
+
+void Server::createRoom(const std::string& room_id, const HistoryRetention& retention) {
+    createRoom(room_id, retention, configuredPolicy(room_id));
+}
+
+void Server::createRoom(const std::string& room_id, const HistoryRetention& retention, SlowConsumerPolicy policy) {
+    if (d_ring && d_ring->owner(room_id) != d_self) {
+        spdlog::debug("Not creating room {}, it is owned by cluster node {}", room_id, d_ring->owner(room_id));
+        return;
+    }
+
     if (validRoomId(room_id)) {
         spdlog::error("Attempted to create room that already exists: {}", room_id);
         return;
     }
 
-    d_rooms[room_id] = Room{};
+    RoomTask task{RoomTask::Type::e_CREATE, k_invalidHandle, registerRoom(room_id, policy)};
+    task.roomId = room_id;
+    task.retention = retention;
+    dispatchToShard(std::move(task));
+}
+
+bool Server::hasRoom(const std::string& room_id) const {
+    return d_roomIds.find(room_id).has_value();
+}
+
+std::vector<std::pair<std::string, OutboundQueues::Stats>> Server::outboundQueueStats() const {
+    std::vector<std::pair<std::string, OutboundQueues::Stats>> stats;
+    stats.reserve(d_clients.size());
+    for (ClientHandle client = 0; client < d_clients.size(); ++client) {
+        stats.emplace_back(d_clients.name(client), d_outbound.stats(client));
+    }
+    return stats;
 }
 
 // BUSINESS LOGIC FUNCTIONS
-void Server::handleClientChatMessage(const ClientBaseMessage& msg) {
-    auto chatMessage = std::get<ClientChatMessage>(msg.payload).message;
+
+void Server::dispatch(const ClientBaseMessageView& msg, std::chrono::steady_clock::time_point receivedAt) {
+    d_metrics.receiveToDispatchNs.record(std::chrono::steady_clock::now() - receivedAt);
+
+    // the only string lookup on the hot path, everything after works on the handle
+    auto client = d_clients.find(msg.senderId);
+    if (client.has_value() && d_config.sessionTimeout.count() > 0) {
+        // anything a client sends counts as a heartbeat
+        d_sessionTimers.touch(*client, currentTick());
+    }
+
+    if (std::holds_alternative<ClientChatMessageView>(msg.payload)) {
+        ScopedTimer timer(d_metrics.chatHandlerNs);
+        handleClientChatMessage(msg, client);
+    } else if (std::holds_alternative<ClientConnectionRequestView>(msg.payload)) {
+        ScopedTimer timer(d_metrics.connectionHandlerNs);
+        handleClientConnectionRequest(msg, client);
+    } else if (std::holds_alternative<ClientCreateRoomRequestView>(msg.payload)) {
+        ScopedTimer timer(d_metrics.createRoomHandlerNs);
+        handleClientCreateRoomRequest(msg, client);
+    } else if (std::holds_alternative<ClientHistoryRequestView>(msg.payload)) {
+        ScopedTimer timer(d_metrics.historyHandlerNs);
+        handleClientHistoryRequest(msg, client);
+    } else if (std::holds_alternative<ClientHistoryRangeRequestView>(msg.payload)) {
+        ScopedTimer timer(d_metrics.historyHandlerNs);
+        handleClientHistoryRangeRequest(msg, client);
+    } else if (std::holds_alternative<ClientSearchRequestView>(msg.payload)) {
+        ScopedTimer timer(d_metrics.searchHandlerNs);
+        handleClientSearchRequest(msg, client);
+    } else if (std::holds_alternative<ClientLeaveRoomRequestView>(msg.payload)) {
+        ScopedTimer timer(d_metrics.connectionHandlerNs);
+        handleClientLeaveRoomRequest(msg, client);
+    } else if (std::holds_alternative<ClientDirectMessageView>(msg.payload)) {
+        ScopedTimer timer(d_metrics.directHandlerNs);
+        handleClientDirectMessage(msg, client);
+    } else if (std::holds_alternative<ClientDirectHistoryRequestView>(msg.payload)) {
+        ScopedTimer timer(d_metrics.directHandlerNs);
+        handleClientDirectHistoryRequest(msg, client);
+    } else if (std::holds_alternative<ClientHeartbeat>(msg.payload)) {
+        // beyond the touch above, a client back from an expired session is told (again) to rejoin
+        if (client.has_value() && !d_clientData[*client].expiredRooms.empty()) {
+            sendSessionExpired(*client, "Session expired");
+            d_clientData[*client].expiredRooms.clear();
+        }
+    } else {
+        spdlog::warn("Received unknown message type");
+    }
+}
+
+void Server::handleClientChatMessage(const ClientBaseMessageView& msg, std::optional<ClientHandle> client) {
+    const auto& chat = std::get<ClientChatMessageView>(msg.payload);
+    auto chatMessage = chat.message;
     auto senderId = msg.senderId;
 
-    if (!isClientValid(senderId)) {
-        // TODO: also log the state of the client and client data
-        spdlog::warn("Received ClientChatMessage from invalid client: {}", senderId);
+    auto room = d_roomIds.find(chat.roomId);
+    if (!client.has_value() || !room.has_value() || !isClientInRoom(*client, *room)) {
+        spdlog::warn("Received ClientChatMessage from {} for room {} they are not in", senderId, chat.roomId);
         return;
     }
 
-    spdlog::info("Received message: [{}] {}", senderId, chatMessage);
+    logSampled(LogCategory::e_CHAT, spdlog::level::info, "Received message: [{}] {}", senderId, chatMessage);
 
-    // TODO: add timestamp into the message
-    ServerChatMessage serverMsg{senderId, chatMessage}; 
-    broadcastMessage(serverMsg);
+    // the only copies made of the message, the room copies them on into its history
+    auto* resource = taskResource();
+    RoomTask task{RoomTask::Type::e_CHAT, *client, *room,
+                  std::pmr::string(senderId, resource), {}, std::pmr::string(chatMessage, resource)};
+    dispatchToShard(std::move(task));
 }
 
-void Server::handleClientConnectionRequest(const ClientBaseMessage& msg) {
-    auto roomId = std::get<ClientConnectionRequest>(msg.payload).roomId;
+void Server::handleClientConnectionRequest(const ClientBaseMessageView& msg, std::optional<ClientHandle> sender) {
+    const auto& request = std::get<ClientConnectionRequestView>(msg.payload);
+    const auto& roomId = request.roomId;
     auto senderId = msg.senderId;
     
     // if we have a new client, initialize them
-    if (!d_clients.contains(senderId)) {
-        spdlog::info("New client created, name: {}", senderId);       
-        d_clients.insert(senderId);
-        d_clientData[senderId] = Client{};
-    }
-
-    if (validRoomId(roomId) && d_clientData[senderId].room != roomId) {
-        addClientToRoom(senderId, roomId);
-        spdlog::info("Client {} connected to room: {}", senderId, roomId);
-
-        auto& history = d_rooms[roomId].history;
-        sendConnectionResponse(senderId, true, std::nullopt, history);
-        //TODO: should broadcast to all clients in the room that a new client has connected
+    auto client = sender.has_value() ? *sender : internClient(senderId);
+    auto room = d_roomIds.find(roomId);
 
-    } else if (!validRoomId(roomId)) {
+    if (!room.has_value()) {
         spdlog::warn("Client {} attempted to connect to invalid room {}", senderId, roomId);
-        sendConnectionResponse(senderId, false, "Invalid room ID", {});
-    } else {
-        // TODO: bug herem if client closes app and then re-opens they will try to connect to the same room twice
-        // so need some exit message or heartbeat to remove client from room
-        spdlog::warn("Client {} attempted to connect to room {} that they are already in", senderId, roomId);
-        sendConnectionResponse(senderId, false, "Already in room", {});
-    } 
+        sendConnectionResponse(client, roomId, false, "Invalid room ID");
+        return;
+    }
+
+    // the shard owning the room replies with the history. A client already in the room (it reopened
+    // the app, or is switching back to the room) gets it again, or just what it missed when resuming
+    bool member = isClientInRoom(client, *room);
+    addClientToRoom(client, *room, request.lastSequence);
+    if (request.lastSequence.has_value()) {
+        logSampled(LogCategory::e_SESSION, spdlog::level::info, "Client {} resumed room {} after sequence {}",
+                   senderId, roomId, *request.lastSequence);
+    } else if (!member) {
+        logSampled(LogCategory::e_SESSION, spdlog::level::info, "Client {} connected to room: {}", senderId, roomId);
+    }
 }
 
-void Server::handleClientCreateRoomRequest(const ClientBaseMessage& msg) {
-    auto roomId = std::get<ClientCreateRoomRequest>(msg.payload).roomId;
+void Server::handleClientCreateRoomRequest(const ClientBaseMessageView& msg, std::optional<ClientHandle> sender) {
+    auto roomId = std::get<ClientCreateRoomRequestView>(msg.payload).roomId;
     auto senderId = msg.senderId;
 
+    // if we have a new client, initialize them
+    auto client = sender.has_value() ? *sender : internClient(senderId);
 
     if (validRoomId(roomId)) {
         spdlog::warn("Client {} attempted to create room that already exists: {}", senderId, roomId);
-        sendCreateRoomResponse(senderId, false, "Room already exists");
+        sendCreateRoomResponse(client, roomId, false, "Room already exists");
         return;
     }
-   
-    // if we have a new client, initialize them
-    if (!d_clients.contains(senderId)) {
-        spdlog::info("New client created, name: {}", senderId);       
-        d_clients.insert(senderId);
-        d_clientData[senderId] = Client{};
+
+    // the shard owning the room adds the client and sends the response
+    RoomTask task{RoomTask::Type::e_CREATE, client, registerRoom(roomId, configuredPolicy(roomId)),
+                  {}, std::pmr::string(roomId, taskResource())};
+    task.retention = d_config.history;
+    d_membership.join(client, task.room);
+    if (d_clientData[client].node != k_localNode) {
+        notifyClientNode(client, task.room, true);
+    }
+    dispatchToShard(std::move(task));
+    logSampled(LogCategory::e_SESSION, spdlog::level::info, "Client {} created and connected to new room: {}", senderId, roomId);
+}
+
+void Server::handleClientHistoryRequest(const ClientBaseMessageView& msg, std::optional<ClientHandle> client) {
+    const auto& request = std::get<ClientHistoryRequestView>(msg.payload);
+    const auto& senderId = msg.senderId;
+
+    auto room = d_roomIds.find(request.roomId);
+    if (!client.has_value() || !room.has_value() || !isClientInRoom(*client, *room)) {
+        spdlog::warn("Client {} requested history for room {} they are not in", senderId, request.roomId);
+        return;
+    }
+
+    RoomTask task{RoomTask::Type::e_HISTORY, *client, *room};
+    task.beforeSequence = request.beforeSequence;
+    task.count = request.count;
+    dispatchToShard(std::move(task));
+}
+
+void Server::handleClientHistoryRangeRequest(const ClientBaseMessageView& msg, std::optional<ClientHandle> client) {
+    const auto& request = std::get<ClientHistoryRangeRequestView>(msg.payload);
+    const auto& senderId = msg.senderId;
+
+    auto room = d_roomIds.find(request.roomId);
+    if (!client.has_value() || !room.has_value() || !isClientInRoom(*client, *room)) {
+        spdlog::warn("Client {} requested a history range for room {} they are not in", senderId, request.roomId);
+        return;
+    }
+
+    RoomTask task{RoomTask::Type::e_HISTORY_RANGE, *client, *room};
+    task.fromTimestamp = request.fromTimestamp;
+    task.toTimestamp = request.toTimestamp;
+    task.count = request.count;
+    dispatchToShard(std::move(task));
+}
+
+void Server::handleClientSearchRequest(const ClientBaseMessageView& msg, std::optional<ClientHandle> client) {
+    const auto& request = std::get<ClientSearchRequestView>(msg.payload);
+    const auto& senderId = msg.senderId;
+
+    auto room = d_roomIds.find(request.roomId);
+    if (!client.has_value() || !room.has_value() || !isClientInRoom(*client, *room)) {
+        spdlog::warn("Client {} searched room {} they are not in", senderId, request.roomId);
+        return;
+    }
+
+    RoomTask task{RoomTask::Type::e_SEARCH, *client, *room, {}, {}, std::pmr::string(request.query, taskResource())};
+    task.offset = request.offset;
+    task.count = request.count;
+    dispatchToShard(std::move(task));
+}
+
+void Server::handleClientLeaveRoomRequest(const ClientBaseMessageView& msg, std::optional<ClientHandle> client) {
+    const auto& request = std::get<ClientLeaveRoomRequestView>(msg.payload);
+    const auto& senderId = msg.senderId;
+
+    auto room = d_roomIds.find(request.roomId);
+    if (!client.has_value() || !room.has_value() || !isClientInRoom(*client, *room)) {
+        spdlog::warn("Client {} attempted to leave room {} they are not in", senderId, request.roomId);
+        return;
+    }
+
+    removeClientFromRoom(*client, *room);
+    logSampled(LogCategory::e_SESSION, spdlog::level::info, "Client {} left room: {}", senderId, request.roomId);
+}
+
+void Server::handleClientDirectMessage(const ClientBaseMessageView& msg, std::optional<ClientHandle> client) {
+    const auto& direct = std::get<ClientDirectMessageView>(msg.payload);
+    const auto& senderId = msg.senderId;
+
+    // the only lookup, the target's id is also its ROUTER identity
+    auto target = d_clients.find(direct.targetId);
+    if (!client.has_value() || !target.has_value()) {
+        spdlog::warn("Received ClientDirectMessage from {} for unknown client {}", senderId, direct.targetId);
+        return;
+    }
+
+    logSampled(LogCategory::e_CHAT, spdlog::level::info, "Received direct message: [{}] -> [{}] {}",
+               senderId, direct.targetId, direct.message);
+    d_metrics.directMessages.add();
+
+    ServerDirectMessage response{std::string(senderId), {}};
+    if (d_config.directHistory.maxMessages > 0) {
+        response.message = d_directHistories.push(*client, *target, senderId, direct.message, nowNs());
+    } else {
+        response.message = ServerChatMessage{std::string(senderId), std::string(direct.message), 0, nowNs()};
+    }
+
+    auto serialized = serialize_serverbasemsg(ServerBaseMessage{std::move(response)});
+    if (!serialized.has_value()) {
+        spdlog::error("Failed to serialize message in Server::handleClientDirectMessage");
+        return;
+    }
+    sendToClient(*target, zmq::message_t(*serialized));
+}
+
+void Server::handleClientDirectHistoryRequest(const ClientBaseMessageView& msg, std::optional<ClientHandle> client) {
+    const auto& request = std::get<ClientDirectHistoryRequestView>(msg.payload);
+    const auto& senderId = msg.senderId;
+
+    auto peer = d_clients.find(request.peerId);
+    if (!client.has_value() || !peer.has_value()) {
+        spdlog::warn("Client {} requested direct history with unknown client {}", senderId, request.peerId);
+        return;
+    }
+
+    // a pair that never messaged (or nothing kept) gets an empty page
+    ServerDirectHistoryResponse response{std::string(request.peerId), {}, 0, false};
+    if (const auto* history = d_directHistories.find(*client, *peer)) {
+        auto end = std::min(request.beforeSequence, history->nextSequence());
+        auto begin = std::max(end - std::min<std::uint64_t>(end, request.count), history->firstSequence());
+        begin = std::min(begin, end);
+        response.messages = history->range(begin, end);
+        response.firstSequence = begin;
+        response.hasMore = begin > history->firstSequence();
+    }
+
+    auto serialized = serialize_serverbasemsg(ServerBaseMessage{std::move(response)});
+    if (!serialized.has_value()) {
+        spdlog::error("Failed to serialize message in Server::handleClientDirectHistoryRequest");
+        return;
+    }
+    sendToClient(*client, zmq::message_t(*serialized));
+}
+
+RoomHandle Server::registerRoom(std::string_view room_id, SlowConsumerPolicy policy) {
+    auto room = d_roomIds.intern(room_id);
+    if (room >= d_roomPolicies.size()) {
+        d_roomPolicies.resize(room + 1, d_config.slowConsumerPolicy);
+    }
+    d_roomPolicies[room] = policy;
+    return room;
+}
+
+SlowConsumerPolicy Server::configuredPolicy(std::string_view room_id) const {
+    auto it = d_config.roomPolicies.find(std::string(room_id));
+    return it != d_config.roomPolicies.end() ? it->second : d_config.slowConsumerPolicy;
+}
+
+void Server::dispatchToShard(RoomTask&& task) {
+    if (d_workers.empty()) {
+        d_localShard->process(task);
+        return;
+    }
+
+    // a room always maps to the same worker so its tasks stay in order
+    d_workers[task.room % d_workers.size()]->queue.push(std::move(task));
+}
+
+std::pmr::memory_resource* Server::taskResource() {
+    return d_workers.empty() ? d_arena.resource() : std::pmr::new_delete_resource();
+}
+
+void Server::runWorker(Worker& worker) {
+    std::vector<RoomTask> tasks;
+    while (true) {
+        // with searches left over only take what is already queued, they run once it is done
+        if (worker.shard.hasDeferred()) {
+            worker.queue.tryPopAll(tasks);
+        } else if (!worker.queue.popAll(tasks)) {
+            return;
+        }
+        for (const auto& task : tasks) {
+            worker.shard.process(task);
+        }
+        worker.shard.runDeferred();
+        tasks.clear();
+    }
+}
+
+ClientHandle Server::internClient(std::string_view client_id) {
+    auto client = d_clients.intern(client_id);
+    if (client == d_clientData.size()) {
+        logSampled(LogCategory::e_SESSION, spdlog::level::info, "New client created, name: {}", client_id);
+        d_clientData.emplace_back();
+    }
+    if (d_config.sessionTimeout.count() > 0) {
+        d_sessionTimers.touch(client, currentTick());
+    }
+    return client;
+}
+
+std::uint64_t Server::currentTick() const {
+    return (std::chrono::steady_clock::now() - d_startTime) / s_pollTimeout;
+}
+
+void Server::expireSessions() {
+    if (d_config.sessionTimeout.count() == 0) {
+        return;
+    }
+
+    d_sessionTimers.advance(currentTick(), [this](ClientHandle client) {
+        logSampled(LogCategory::e_SESSION, spdlog::level::info, "Client {} timed out", d_clients.name(client));
+        // stops the rooms fanning out to a dead routing id
+        endSession(client, "Session timed out");
+    });
+}
+
+void Server::disconnectSlowClient(ClientHandle client) {
+    const auto& stats = d_outbound.stats(client);
+    spdlog::warn("Removing client {} from its rooms, sends are stalled or it is gone ({} queued, {} dropped so far)",
+                 routingIdOf(client), stats.depth, stats.dropped);
+
+    d_outbound.clear(client);
+    if (d_pipeline) {
+        // the rooms belong to the logic thread, pumpPipelineSends() passes the client on
+        d_pipeline->slowPending.push_back(client);
+        return;
     }
+    endSession(client, "Too slow reading messages");
+}
 
-    createRoom(roomId);
-    addClientToRoom(senderId, roomId);
-    spdlog::info("Client {} created and connected to new room: {}", senderId, roomId);
-    sendCreateRoomResponse(senderId, true, std::nullopt);
+void Server::endSession(ClientHandle client, std::string_view reason) {
+    const auto& rooms = d_membership.roomsOf(client);
+    if (rooms.empty()) {
+        // already out of them, what it was told about stays as it was
+        return;
+    }
+    d_clientData[client].expiredRooms.assign(rooms.begin(), rooms.end());
+    removeClientFromAllRooms(client);
+    sendSessionExpired(client, reason);
+}
+
+void Server::sendSessionExpired(ClientHandle client, std::string_view reason) {
+    ServerSessionExpired notice{{}, std::string(reason)};
+    for (auto room : d_clientData[client].expiredRooms) {
+        if (!isClientInRoom(client, room)) {
+            notice.roomIds.push_back(d_roomIds.name(room));
+        }
+    }
+    if (notice.roomIds.empty()) {
+        return;
+    }
+
+    auto serialized = serialize_serverbasemsg(ServerBaseMessage{std::move(notice)});
+    if (!serialized.has_value()) {
+        spdlog::error("Failed to serialize message in Server::sendSessionExpired");
+        return;
+    }
+    sendToClient(client, zmq::message_t(*serialized));
+}
+
+void Server::runStats() {
+    zmq::pollitem_t items[] = {
+        {d_statsSocket.handle(), 0, ZMQ_POLLIN, 0}
+    };
+
+    while (!d_statsDone) {
+        zmq::poll(items, 1, s_pollTimeout);
+        if (!(items[0].revents & ZMQ_POLLIN)) {
+            continue;
+        }
+
+        // the request body is ignored, every request gets the full snapshot
+        zmq::message_t request;
+        if (!d_statsSocket.recv(request, zmq::recv_flags::none).has_value()) {
+            continue;
+        }
+        d_statsSocket.send(zmq::message_t(statsJson()), zmq::send_flags::none);
+    }
+}
+
+std::string Server::statsJson() {
+    // shard metrics are summed over every shard
+    std::vector<const RoomShard*> shards;
+    if (d_localShard) {
+        shards.push_back(d_localShard.get());
+    }
+    for (const auto& worker : d_workers) {
+        shards.push_back(&worker->shard);
+    }
+
+    auto sumShards = [&shards](LatencyHistogram ShardMetrics::* member) {
+        LatencyHistogram::Buckets buckets{};
+        std::uint64_t sum = 0;
+        std::uint64_t max = 0;
+        for (const auto* shard : shards) {
+            const auto& histogram = shard->metrics().*member;
+            histogram.mergeInto(buckets);
+            sum += histogram.sum();
+            max = std::max(max, histogram.max());
+        }
+        return toJson(LatencyHistogram::snapshotOf(buckets, sum, max));
+    };
+
+    std::uint64_t broadcasts = 0;
+    std::uint64_t historyRequests = 0;
+    std::uint64_t joins = 0;
+    std::uint64_t joinCacheHits = 0;
+    std::uint64_t searches = 0;
+    std::uint64_t searchesDeferred = 0;
+    for (const auto* shard : shards) {
+        broadcasts += shard->metrics().broadcasts.value();
+        historyRequests += shard->metrics().historyRequests.value();
+        joins += shard->metrics().joins.value();
+        joinCacheHits += shard->metrics().joinCacheHits.value();
+        searches += shard->metrics().searches.value();
+        searchesDeferred += shard->metrics().searchesDeferred.value();
+    }
+
+    std::string outbound;
+    {
+        std::lock_guard<std::mutex> lock(d_statsMutex);
+        std::string deepest;
+        for (const auto& [client, depth] : d_outboundSnapshot.deepest) {
+            deepest += fmt::format(R"({}{{"client":"{}","depth":{}}})", deepest.empty() ? "" : ",", client, depth);
+        }
+        outbound = fmt::format(R"({{"queued":{},"dropped":{},"deepest":[{}]}})",
+                               d_outboundSnapshot.queued, d_outboundSnapshot.dropped, deepest);
+    }
+
+    auto logs = logStats();
+    auto uptime = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - d_startTime);
+    return fmt::format(
+        R"({{"uptime_s":{},)"
+        R"("counters":{{"messages_received":{},"bytes_received":{},"decode_failures":{},"messages_sent":{},"messages_published":{},"bytes_sent":{},)"
+        R"("peer_messages_sent":{},"peer_messages_received":{},"peer_messages_dropped":{},"arena_resizes":{},)"
+        R"("direct_messages":{},"rate_limited_messages":{},"rate_limited_bytes":{},"pipeline_stalls":{},"log_sampled_out":{},"log_dropped":{},"broadcasts":{},"history_requests":{},"joins":{},"join_cache_hits":{},"searches":{},"searches_deferred":{}}},)"
+        R"("histograms":{{"recv_to_dispatch_ns":{},"chat_handler_ns":{},"connection_handler_ns":{},"create_room_handler_ns":{},)"
+        R"("history_handler_ns":{},"search_handler_ns":{},"direct_handler_ns":{},"search_ns":{},"index_ns":{},"serialize_ns":{},"fanout_size":{},"flush_ns":{},"messages_per_flush":{}}},)"
+        R"("outbound":{}}})",
+        uptime.count(),
+        d_metrics.messagesReceived.value(), d_metrics.bytesReceived.value(), d_metrics.decodeFailures.value(),
+        d_metrics.messagesSent.value(), d_metrics.messagesPublished.value(), d_metrics.bytesSent.value(),
+        d_metrics.peerMessagesSent.value(), d_metrics.peerMessagesReceived.value(), d_metrics.peerMessagesDropped.value(),
+        d_metrics.arenaResizes.value(), d_metrics.directMessages.value(),
+        d_metrics.rateLimitedMessages.value(), d_metrics.rateLimitedBytes.value(),
+        d_metrics.pipelineStalls.value(), logs.sampledOut, logs.dropped,
+        broadcasts, historyRequests, joins, joinCacheHits, searches, searchesDeferred,
+        toJson(d_metrics.receiveToDispatchNs.snapshot()), toJson(d_metrics.chatHandlerNs.snapshot()),
+        toJson(d_metrics.connectionHandlerNs.snapshot()), toJson(d_metrics.createRoomHandlerNs.snapshot()),
+        toJson(d_metrics.historyHandlerNs.snapshot()), toJson(d_metrics.searchHandlerNs.snapshot()),
+        toJson(d_metrics.directHandlerNs.snapshot()),
+        sumShards(&ShardMetrics::searchNs), sumShards(&ShardMetrics::indexNs), sumShards(&ShardMetrics::serializeNs),
+        sumShards(&ShardMetrics::fanoutSize), toJson(d_metrics.flushNs.snapshot()),
+        toJson(d_metrics.messagesPerFlush.snapshot()), outbound);
+}
+
+void Server::snapshotOutbound() {
+    if (!d_statsThread.joinable()) {
+        return;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if (now - d_lastOutboundSnapshot < s_statsInterval) {
+        return;
+    }
+
+    OutboundSnapshot snapshot;
+    const auto& stats = d_outbound.allStats();
+    for (ClientHandle client = 0; client < stats.size(); ++client) {
+        snapshot.queued += stats[client].depth;
+        snapshot.dropped += stats[client].dropped;
+        if (stats[client].depth > 0) {
+            snapshot.deepest.emplace_back(routingIdOf(client), stats[client].depth);
+        }
+    }
+
+    auto keep = std::min(snapshot.deepest.size(), s_statsDeepestQueues);
+    std::partial_sort(snapshot.deepest.begin(), snapshot.deepest.begin() + keep, snapshot.deepest.end(),
+                      [](const auto& a, const auto& b) { return a.second > b.second; });
+    snapshot.deepest.resize(keep);
+
+    // the stats thread only holds the lock to format a reply, if it has it now just try again next pass
+    std::unique_lock<std::mutex> lock(d_statsMutex, std::try_to_lock);
+    if (lock.owns_lock()) {
+        d_outboundSnapshot = std::move(snapshot);
+        d_lastOutboundSnapshot = now;
+    }
+}
+
+// CLUSTER FUNCTIONS
+
+std::uint32_t Server::ownerOf(RoomHandle room) {
+    if (room >= d_roomOwners.size()) {
+        d_roomOwners.resize(room + 1, k_unknownOwner);
+    }
+    if (d_roomOwners[room] == k_unknownOwner) {
+        d_roomOwners[room] = d_ring->owner(d_roomIds.name(room));
+    }
+    return d_roomOwners[room];
+}
+
+bool Server::isRemoteRoom(RoomHandle room) {
+    return d_ring && room != k_invalidHandle && ownerOf(room) != d_self;
+}
+
+bool Server::routeToOwner(const ClientBaseMessageView& msg, const zmq::message_t& raw) {
+    auto client = d_clients.find(msg.senderId);
+
+    // everything but a heartbeat and direct messages names its room
+    std::uint32_t node = d_self;
+    if (const auto* chat = std::get_if<ClientChatMessageView>(&msg.payload)) {
+        // the hot path, the owner of a room we know of is cached
+        auto room = d_roomIds.find(chat->roomId);
+        node = room.has_value() ? ownerOf(*room) : d_ring->owner(chat->roomId);
+    } else if (const auto* request = std::get_if<ClientConnectionRequestView>(&msg.payload)) {
+        node = d_ring->owner(request->roomId);
+    } else if (const auto* request = std::get_if<ClientCreateRoomRequestView>(&msg.payload)) {
+        node = d_ring->owner(request->roomId);
+    } else if (const auto* request = std::get_if<ClientHistoryRequestView>(&msg.payload)) {
+        node = d_ring->owner(request->roomId);
+    } else if (const auto* request = std::get_if<ClientHistoryRangeRequestView>(&msg.payload)) {
+        node = d_ring->owner(request->roomId);
+    } else if (const auto* request = std::get_if<ClientSearchRequestView>(&msg.payload)) {
+        node = d_ring->owner(request->roomId);
+    } else if (const auto* request = std::get_if<ClientLeaveRoomRequestView>(&msg.payload)) {
+        node = d_ring->owner(request->roomId);
+    } else if (const auto* direct = std::get_if<ClientDirectMessageView>(&msg.payload)) {
+        // the pair's owner keeps the conversation and delivers to the target through the node it
+        // last announced itself on
+        node = d_ring->owner(directPairKey(msg.senderId, direct->targetId));
+    } else if (const auto* request = std::get_if<ClientDirectHistoryRequestView>(&msg.payload)) {
+        node = d_ring->owner(directPairKey(msg.senderId, request->peerId));
+    } else if (client.has_value()) {
+        // a heartbeat, handled here and by every node owning one of the client's rooms
+        forwardHeartbeat(*client, raw);
+    }
+
+    if (node == d_self) {
+        if (client.has_value()) {
+            markLocal(*client);
+        }
+        return false;
+    }
+
+    // the owner's replies come back through us, so we need a handle to deliver them to (this also
+    // counts as the client's heartbeat here)
+    markLocal(internClient(msg.senderId));
+    sendToPeer(node, 'C', {std::string_view(static_cast<const char*>(raw.data()), raw.size())});
+    return true;
+}
+
+void Server::markLocal(ClientHandle client) {
+    auto& data = d_clientData[client];
+    data.node = k_localNode;
+    if (data.announced) {
+        return;
+    }
+
+    data.announced = true;
+    const auto& clientId = d_clients.name(client);
+    for (std::uint32_t node = 0; node < d_peerLinks.size(); ++node) {
+        if (node != d_self) {
+            sendToPeer(node, 'H', {clientId});
+        }
+    }
+}
+
+void Server::forwardHeartbeat(ClientHandle client, const zmq::message_t& raw) {
+    std::string_view heartbeat(static_cast<const char*>(raw.data()), raw.size());
+    // once per node, however many of its rooms the client is in
+    std::vector<std::uint32_t> nodes;
+    for (auto room : d_membership.roomsOf(client)) {
+        if (!isRemoteRoom(room) || std::find(nodes.begin(), nodes.end(), ownerOf(room)) != nodes.end()) {
+            continue;
+        }
+        nodes.push_back(ownerOf(room));
+        sendToPeer(nodes.back(), 'C', {heartbeat});
+    }
+}
+
+void Server::notifyClientNode(ClientHandle client, RoomHandle room, bool joined) {
+    const char flag = joined ? 1 : 0;
+    sendToPeer(d_clientData[client].node, 'R', {d_clients.name(client), d_roomIds.name(room), std::string_view(&flag, 1)});
+}
+
+void Server::sendToPeer(std::uint32_t node, char tag, std::initializer_list<std::string_view> frames,
+                        zmq::message_t* payload) {
+    auto& link = d_peerLinks[node];
+    PeerHeader header{d_self, tag};
+    auto more = frames.size() > 0 || payload != nullptr ? zmq::send_flags::sndmore : zmq::send_flags::none;
+    if (!link.send(zmq::message_t(&header, sizeof(header)), more | zmq::send_flags::dontwait).has_value()) {
+        d_metrics.peerMessagesDropped.add();
+        return;
+    }
+
+    // once the first frame is accepted the rest of the message always is
+    std::size_t remaining = frames.size();
+    for (auto frame : frames) {
+        --remaining;
+        link.send(zmq::message_t(frame.data(), frame.size()),
+                  remaining > 0 || payload != nullptr ? zmq::send_flags::sndmore : zmq::send_flags::none);
+    }
+    if (payload != nullptr) {
+        link.send(*payload, zmq::send_flags::none);
+    }
+    d_metrics.peerMessagesSent.add();
+}
+
+void Server::receivePeers() {
+    std::vector<zmq::message_t> frames;
+    while (true) {
+        zmq::message_t first;
+        if (!d_peerInbound.recv(first, zmq::recv_flags::dontwait).has_value()) {
+            return;
+        }
+
+        frames.clear();
+        bool more = first.more();
+        while (more) {
+            zmq::message_t frame;
+            if (!d_peerInbound.recv(frame, zmq::recv_flags::none).has_value()) {
+                return;
+            }
+            more = frame.more();
+            frames.push_back(std::move(frame));
+        }
+
+        if (first.size() != sizeof(PeerHeader)) {
+            spdlog::warn("Received malformed message from a cluster peer");
+            continue;
+        }
+        PeerHeader header;
+        std::memcpy(&header, first.data(), sizeof(header));
+
+        d_metrics.peerMessagesReceived.add();
+        handlePeerMessage(header, frames);
+    }
+}
+
+void Server::handlePeerMessage(const PeerHeader& header, std::vector<zmq::message_t>& frames) {
+    if (header.tag == 'C' && frames.size() == 1) {
+        auto msg = deserialize_clientbasemsg_view(frames[0].to_string_view());
+        if (!msg.has_value()) {
+            d_metrics.decodeFailures.add();
+            return;
+        }
+        // anything we send the client now goes back through the node it is connected to
+        auto& data = d_clientData[internClient(msg->senderId)];
+        data.node = header.from;
+        data.announced = false;
+        dispatch(*msg, std::chrono::steady_clock::now());
+
+    } else if (header.tag == 'L' && frames.size() == 2) {
+        auto client = d_clients.find(frames[0].to_string_view());
+        auto room = d_roomIds.find(frames[1].to_string_view());
+        if (client.has_value() && room.has_value()) {
+            removeClientFromRoom(*client, *room);
+        }
+
+    } else if (header.tag == 'D' && frames.size() == 3 && frames[1].size() == 1) {
+        auto ids = frames[0].to_string_view();
+        auto kind = *static_cast<const char*>(frames[1].data()) != 0 ? OutboundKind::e_CHAT : OutboundKind::e_CONTROL;
+        std::size_t start = 0;
+        while (start <= ids.size()) {
+            auto end = std::min(ids.find('\0', start), ids.size());
+            auto client = d_clients.find(ids.substr(start, end - start));
+            if (client.has_value()) {
+                zmq::message_t copy;
+                copy.copy(frames[2]);
+                sendToClient(*client, std::move(copy), kind);
+            }
+            start = end + 1;
+        }
+
+    } else if (header.tag == 'R' && frames.size() == 3 && frames[2].size() == 1) {
+        auto client = d_clients.find(frames[0].to_string_view());
+        if (!client.has_value()) {
+            return;
+        }
+        // a room owned elsewhere still needs its policy here, our clients' queues are ours
+        auto room = registerRoom(frames[1].to_string_view(), configuredPolicy(frames[1].to_string_view()));
+        bool joined = *static_cast<const char*>(frames[2].data()) != 0;
+
+        // only our record of the client's rooms, the owner has already done the rest
+        if (joined) {
+            d_membership.join(*client, room);
+        } else {
+            d_membership.leave(*client, room);
+        }
+
+    } else if (header.tag == 'H' && frames.size() == 1) {
+        // the latest announcement wins, a client that moved is reached through its new node
+        auto& data = d_clientData[internClient(frames[0].to_string_view())];
+        data.node = header.from;
+        data.announced = false;
+
+    } else {
+        spdlog::warn("Received unknown message '{}' from cluster node {}", header.tag, header.from);
+    }
+}
+
+void Server::flushPeerSends() {
+    for (std::uint32_t node = 0; node < d_peerSends.size(); ++node) {
+        auto& sends = d_peerSends[node];
+        std::size_t i = 0;
+        while (i < sends.size()) {
+            // a broadcast hands every member a copy() of one message, consecutive sends
+            // sharing their data are batched into one delivery
+            std::string ids = d_clients.name(sends[i].client);
+            std::size_t j = i + 1;
+            while (j < sends.size() && sends[j].payload.data() == sends[i].payload.data()) {
+                ids += '\0';
+                ids += d_clients.name(sends[j].client);
+                ++j;
+            }
+            const char chat = sends[i].kind == OutboundKind::e_CHAT ? 1 : 0;
+            sendToPeer(node, 'D', {ids, std::string_view(&chat, 1)}, &sends[i].payload);
+            i = j;
+        }
+        sends.clear();
+    }
 }
 
 // NETWORKING FUNCTIONS
 
-void Server::broadcastNewConnection(const std::string& id) {
-    ServerChatMessage serverMsg{"ALERT", "New client connected: " + id};
-    broadcastMessage(serverMsg);
+void Server::forwardOutbound() {
+    // drain everything the workers have produced so far
+    while (true) {
+        zmq::message_t headerMsg;
+        zmq::message_t msg;
+
+        auto res = d_outboundSocket.recv(headerMsg, zmq::recv_flags::dontwait);
+        if (!res.has_value()) {
+            return;
+        }
+
+        res = d_outboundSocket.recv(msg, zmq::recv_flags::none);
+        if (!res.has_value()) {
+            return;
+        }
+
+        OutboundHeader header;
+        std::memcpy(&header, headerMsg.data(), sizeof(header));
+        if (header.client != k_invalidHandle) {
+            sendToClient(header.client, std::move(msg), header.kind);
+            continue;
+        }
+
+        // a published message, msg is the topic and the payload follows
+        zmq::message_t payload;
+        res = d_outboundSocket.recv(payload, zmq::recv_flags::none);
+        if (!res.has_value()) {
+            return;
+        }
+        publish(msg.to_string(), std::move(payload));
+    }
 }
 
-std::optional<ClientBaseMessage> Server::receiveMessage() {
-    zmq::message_t id;
-    zmq::message_t msg;
-    
-    auto res = routerSocket.recv(id, zmq::recv_flags::none);
-    if (!res.has_value()) {
-        return std::nullopt;
+void Server::receiveBatch() {
+    // pull everything that is already waiting off the socket first, then decode the whole batch
+    // before dispatching any of it
+    readBatch(d_received);
+    decodeBatch(d_received);
+    processBatch(d_received);
+}
+
+void Server::readBatch(ReceivedBatch& batch) {
+    while (batch.raw.size() < d_config.receiveBatchSize) {
+        zmq::message_t id;
+        zmq::message_t msg;
+
+        auto res = routerSocket.recv(id, zmq::recv_flags::dontwait);
+        if (!res.has_value()) {
+            break;
+        }
+
+        // the rest of a multipart message is always there once its first frame is
+        res = routerSocket.recv(msg, zmq::recv_flags::none);
+        if (!res.has_value()) {
+            break;
+        }
+
+        d_metrics.messagesReceived.add();
+        d_metrics.bytesReceived.add(msg.size());
+        batch.raw.push_back(ReceivedMessage{std::move(id), std::move(msg), std::chrono::steady_clock::now()});
     }
+}
 
-    res = routerSocket.recv(msg, zmq::recv_flags::none);
-    if (!res.has_value()) {
-        return std::nullopt;
+void Server::decodeBatch(ReceivedBatch& batch) {
+    for (const auto& raw : batch.raw) {
+        auto decoded = decodeMessage(raw.id, raw.msg);
+        if (decoded.has_value()) {
+            batch.decoded.emplace_back(std::move(*decoded), &raw - batch.raw.data());
+        } else {
+            d_metrics.decodeFailures.add();
+        }
     }
+}
 
-    std::string idStr = std::string(static_cast<char*>(id.data()), id.size());
-    std::string data = std::string(static_cast<char*>(msg.data()), msg.size());
+void Server::processBatch(ReceivedBatch& batch) {
+    for (const auto& [msg, index] : batch.decoded) {
+        // a flooding client loses its messages here, before any room can fan them out
+        if (d_rateLimiter.enabled() && !admitMessage(msg, batch.raw[index])) {
+            continue;
+        }
+        // in a cluster, messages for rooms another node owns are passed on as they came in
+        if (d_ring && routeToOwner(msg, batch.raw[index].msg)) {
+            continue;
+        }
+        dispatch(msg, batch.raw[index].receivedAt);
+    }
+    batch.decoded.clear();
+    batch.raw.clear();
+}
 
-    auto clientBaseMsg = deserialize_clientbasemsg(data);
+bool Server::admitMessage(const ClientBaseMessageView& msg, const ReceivedMessage& raw) {
+    // a client we have never seen has no bucket yet, its first message (a join) always gets through
+    auto client = d_clients.find(msg.senderId);
+    if (!client.has_value() || d_rateLimiter.admit(*client, raw.msg.size(), raw.receivedAt)) {
+        return true;
+    }
+
+    d_metrics.rateLimitedMessages.add();
+    d_metrics.rateLimitedBytes.add(raw.msg.size());
+    auto dropped = d_rateLimiter.takeNotice(*client, raw.receivedAt);
+    if (!dropped.has_value()) {
+        return false;
+    }
+
+    // at most once per notice interval, so a flood does not flood the log either
+    spdlog::warn("Client {} is over its rate limit, dropped {} messages", msg.senderId, *dropped);
+    if (d_config.rateLimit.notify) {
+        auto retryAfter = std::chrono::duration_cast<std::chrono::milliseconds>(
+            d_rateLimiter.retryAfter(*client, raw.msg.size()));
+        auto serialized = serialize_serverbasemsg(ServerBaseMessage{
+            ServerRateLimited{*dropped, static_cast<std::uint32_t>(retryAfter.count())}});
+        if (!serialized.has_value()) {
+            spdlog::error("Failed to serialize message in Server::admitMessage");
+            return false;
+        }
+        sendToClient(*client, zmq::message_t(*serialized));
+    }
+    return false;
+}
+
+std::optional<ClientBaseMessageView> Server::decodeMessage(const zmq::message_t& id, const zmq::message_t& msg) {
+    // decodes straight from the frame, nothing is copied until a handler needs to keep it
+    auto clientBaseMsg = deserialize_clientbasemsg_view(msg.to_string_view());
     if (!clientBaseMsg.has_value()) {
-        spdlog::warn("Failed to deserialize client base message in Server::receiveMessage");
+        spdlog::warn("Failed to deserialize client base message in Server::decodeMessage");
         return std::nullopt;
     }
-    else if (clientBaseMsg->senderId != idStr) {
+    else if (clientBaseMsg->senderId != id.to_string_view()) {
         spdlog::warn("Sender ID does not match ID in message");
         return std::nullopt;
     }
@@ -145,34 +1163,85 @@ std::optional<ClientBaseMessage> Server::receiveMessage() {
     return clientBaseMsg;
 }
 
-void Server::broadcastMessage(const ServerChatMessage& message) {
-    // may be a better spot elsewhere for serializing
-    ServerBaseMessage baseMessage{message};
-    auto serialized = serialize_serverbasemsg(baseMessage);
-    if (!serialized.has_value()) {
-        spdlog::warn("Failed to serialize message in Server::broadcastMessage");
+const std::string& Server::routingIdOf(ClientHandle client) const {
+    // d_clients belongs to the logic thread when pipelined, the I/O thread has its own copy
+    return d_pipeline ? d_pipeline->routingIds[client] : d_clients.name(client);
+}
+
+void Server::sendToClient(ClientHandle client, zmq::message_t&& payload, OutboundKind kind) {
+    if (d_clientData[client].node != k_localNode) {
+        d_peerSends[d_clientData[client].node].push_back(PeerSend{client, kind, std::move(payload)});
+        return;
+    }
+    if (d_pipeline) {
+        handToIo(client, std::move(payload), kind);
         return;
     }
+    if (!d_outbound.push(client, std::move(payload), OutboundQueues::Clock::now(), policyFor(client), kind)) {
+        disconnectSlowClient(client);
+    }
+}
 
-    auto senderRoomId = d_clientData[message.senderId].room;
-    auto& room = d_rooms[senderRoomId];
+void Server::publish(const std::string& topic, zmq::message_t&& payload) {
+    d_metrics.messagesPublished.add();
+    d_metrics.bytesSent.add(payload.size());
+    d_publishSocket.send(zmq::message_t(topic), zmq::send_flags::sndmore | zmq::send_flags::dontwait);
+    d_publishSocket.send(payload, zmq::send_flags::dontwait);
+}
 
-    for (const auto& client : room.clients) {
-        if (client == message.senderId) {
-            continue;
+void Server::flushSends() {
+    flushPeerSends();
+    flushOutbound();
+}
+
+void Server::flushOutbound() {
+    auto start = std::chrono::steady_clock::now();
+    auto sentBefore = d_metrics.messagesSent.value();
+
+    d_outbound.flush(OutboundQueues::Clock::now(),
+                     [this](ClientHandle client, zmq::message_t& payload) { return trySend(client, payload); },
+                     [this](ClientHandle client) {
+                         return d_pipeline ? d_pipeline->policies[client] : policyFor(client);
+                     },
+                     d_slowClients);
+
+    // disconnecting can queue more work, so it waits until the flush is done
+    for (auto client : d_slowClients) {
+        disconnectSlowClient(client);
+    }
+    d_slowClients.clear();
+
+    auto sent = d_metrics.messagesSent.value() - sentBefore;
+    if (sent > 0) {
+        d_metrics.flushNs.record(std::chrono::steady_clock::now() - start);
+        d_metrics.messagesPerFlush.record(sent);
+    }
+}
+
+OutboundQueues::SendResult Server::trySend(ClientHandle client, zmq::message_t& payload) {
+    zmq::message_t idMsg(routingIdOf(client));
+    try {
+        auto res = routerSocket.send(idMsg, zmq::send_flags::sndmore | zmq::send_flags::dontwait);
+        if (!res.has_value()) {
+            return OutboundQueues::SendResult::e_WOULD_BLOCK;
+        }
+    } catch (const zmq::error_t& e) {
+        if (e.num() != EHOSTUNREACH) {
+            throw;
         }
-        zmq::message_t id(client);
-        zmq::message_t msg(*serialized);
-        routerSocket.send(id, zmq::send_flags::sndmore);
-        routerSocket.send(msg, zmq::send_flags::none);
+        return OutboundQueues::SendResult::e_UNROUTABLE;
     }
 
-    // save message to room history
-    room.history.push_back(message);
+    // once the routing frame is accepted the rest of the message always is
+    d_metrics.messagesSent.add();
+    d_metrics.bytesSent.add(payload.size());
+    routerSocket.send(payload, zmq::send_flags::none);
+    return OutboundQueues::SendResult::e_SENT;
 }
 
-void Server::sendConnectionResponse(const std::string& id, bool accepted, const std::optional<std::string>& reason, const std::vector<ServerChatMessage>& history) {
-    ServerConnectionResponse response{accepted, reason, history};
+void Server::sendConnectionResponse(ClientHandle client, std::string_view room_id, bool accepted,
+                                    const std::optional<std::string>& reason) {
+    ServerConnectionResponse response{std::string(room_id), accepted, reason, {}, 0, std::nullopt};
     ServerBaseMessage baseMessage{response};
     auto serialized = serialize_serverbasemsg(baseMessage);
     if (!serialized.has_value()) {
@@ -180,14 +1249,12 @@ void Server::sendConnectionResponse(const std::string& id, bool accepted, const
         return;
     }
 
-    zmq::message_t idMsg(id);
-    zmq::message_t msg(*serialized);
-    routerSocket.send(idMsg, zmq::send_flags::sndmore);
-    routerSocket.send(msg, zmq::send_flags::none);
+    sendToClient(client, zmq::message_t(*serialized));
 }
 
-void Server::sendCreateRoomResponse(const std::string& id, bool accepted, const std::optional<std::string>& reason) {
-    ServerCreateRoomResponse response{accepted, reason};
+void Server::sendCreateRoomResponse(ClientHandle client, std::string_view room_id, bool accepted,
+                                    const std::optional<std::string>& reason) {
+    ServerCreateRoomResponse response{std::string(room_id), accepted, reason, std::nullopt};
     ServerBaseMessage baseMessage{response};
     auto serialized = serialize_serverbasemsg(baseMessage);
     if (!serialized.has_value()) {
@@ -195,8 +1262,257 @@ void Server::sendCreateRoomResponse(const std::string& id, bool accepted, const
         return;
     }
 
-    zmq::message_t idMsg(id);
-    zmq::message_t msg(*serialized);
-    routerSocket.send(idMsg, zmq::send_flags::sndmore);
-    routerSocket.send(msg, zmq::send_flags::none);
-}
\ No newline at end of file
+    sendToClient(client, zmq::message_t(*serialized));
+}
+
+// PIPELINE FUNCTIONS
+
+void Server::runPipelined() {
+    auto& pipeline = *d_pipeline;
+    pipeline.logicDone = false;
+    pipeline.nextDecoder = 0;
+    for (auto& decoder : pipeline.decoders) {
+        decoder->thread = std::thread(&Server::runDecoder, this, std::ref(*decoder));
+    }
+    pipeline.logicThread = std::thread(&Server::runLogic, this);
+    spdlog::info("Server pipelined across {} decoder threads and a logic thread", pipeline.decoders.size());
+
+    zmq::pollitem_t items[] = {
+        {routerSocket.handle(), 0, ZMQ_POLLIN, 0},
+        {pipeline.ioBell.socket().handle(), 0, ZMQ_POLLIN, 0}
+    };
+
+    while (d_running) {
+        // while a batch is held back the decoders are behind, what is on the socket can wait there
+        items[0].events = pipeline.held ? 0 : ZMQ_POLLIN;
+        auto timeout = pipeline.held || !pipeline.slowPending.empty() ? s_pipelineRetry : s_pollTimeout;
+
+        pipeline.ioBell.prepareSleep();
+        if (pipeline.sends.empty()) {
+            zmq::poll(items, 2, timeout);
+        }
+        pipeline.ioBell.woke();
+
+        readIntoPipeline();
+        pumpPipelineSends();
+        snapshotOutbound();
+    }
+
+    stopPipeline();
+}
+
+void Server::runDecoder(Decoder& decoder) {
+    std::unique_ptr<ReceivedBatch> batch;
+    while (true) {
+        decoder.in.waitNotEmpty();
+        if (!decoder.in.tryPop(batch)) {
+            continue;
+        }
+
+        bool stop = !batch;
+        if (!stop) {
+            decodeBatch(*batch);
+        }
+        while (!decoder.out.tryPush(batch)) {
+            decoder.out.waitNotFull();
+        }
+        d_pipeline->logicBell.ring(decoder.logicRinger);
+
+        if (stop) {
+            return;
+        }
+    }
+}
+
+void Server::runLogic() {
+    auto& pipeline = *d_pipeline;
+    const auto decoderCount = pipeline.decoders.size();
+
+    // worker replies only arrive when sharded, peer messages only in a cluster
+    std::vector<zmq::pollitem_t> items = {
+        {pipeline.logicBell.socket().handle(), 0, ZMQ_POLLIN, 0}
+    };
+    if (!d_workers.empty()) {
+        items.push_back({d_outboundSocket.handle(), 0, ZMQ_POLLIN, 0});
+    }
+    if (d_ring) {
+        items.push_back({d_peerInbound.handle(), 0, ZMQ_POLLIN, 0});
+    }
+
+    std::size_t next = 0;
+    std::size_t stopped = 0;
+    std::unique_ptr<ReceivedBatch> batch;
+    while (stopped < decoderCount) {
+        // taken round robin like the I/O thread handed them out, at most one per decoder per pass
+        // so sessions, peers and worker replies keep up under load
+        for (std::size_t taken = 0; taken < decoderCount && stopped < decoderCount; ++taken) {
+            if (!pipeline.decoders[next]->out.tryPop(batch)) {
+                break;
+            }
+            next = (next + 1) % decoderCount;
+
+            if (!batch) {
+                // the stop markers come after the last batch, one from each decoder
+                ++stopped;
+                continue;
+            }
+            processBatch(*batch);
+            if (!pipeline.spent.tryPush(batch)) {
+                // the I/O thread has plenty to read into already
+                batch.reset();
+            }
+        }
+
+        ClientHandle slow;
+        while (pipeline.slowClients.tryPop(slow)) {
+            endSession(slow, "Too slow reading messages");
+        }
+
+        if (!d_workers.empty()) {
+            forwardOutbound();
+        }
+        if (d_ring) {
+            receivePeers();
+        }
+        expireSessions();
+        flushPeerSends();
+
+        // the I/O thread writes this pass's chat out while indexing and searches run
+        pipeline.ioBell.ring(pipeline.logicRinger);
+        if (d_localShard && d_localShard->runDeferred()) {
+            flushPeerSends();
+            pipeline.ioBell.ring(pipeline.logicRinger);
+        }
+
+        // every task of this pass has run by now (when they use the arena)
+        if (d_arena.reset()) {
+            d_metrics.arenaResizes.add();
+        }
+
+        pipeline.logicBell.prepareSleep();
+        if (stopped < decoderCount && pipeline.decoders[next]->out.empty() && pipeline.slowClients.empty()
+            && !(d_localShard && d_localShard->hasDeferred())) {
+            zmq::poll(items.data(), items.size(), s_pollTimeout);
+        }
+        pipeline.logicBell.woke();
+    }
+
+    pipeline.logicDone = true;
+    pipeline.ioBell.ring(pipeline.logicRinger);
+}
+
+void Server::readIntoPipeline() {
+    auto& pipeline = *d_pipeline;
+    // at most one batch per decoder per pass, so the sends coming back are not kept waiting
+    for (std::size_t handed = 0; handed < pipeline.decoders.size(); ++handed) {
+        if (!pipeline.held) {
+            if (!pipeline.reading && !pipeline.spent.tryPop(pipeline.reading)) {
+                pipeline.reading = std::make_unique<ReceivedBatch>();
+            }
+            readBatch(*pipeline.reading);
+            if (pipeline.reading->raw.empty()) {
+                return;
+            }
+            pipeline.held = std::move(pipeline.reading);
+        }
+
+        auto& decoder = *pipeline.decoders[pipeline.nextDecoder];
+        if (!decoder.in.tryPush(pipeline.held)) {
+            d_metrics.pipelineStalls.add();
+            return;
+        }
+        pipeline.nextDecoder = (pipeline.nextDecoder + 1) % pipeline.decoders.size();
+    }
+}
+
+void Server::pumpPipelineSends() {
+    auto& pipeline = *d_pipeline;
+
+    auto now = OutboundQueues::Clock::now();
+    PipelineSend send;
+    while (pipeline.sends.tryPop(send)) {
+        auto client = send.client;
+        if (client >= pipeline.routingIds.size()) {
+            pipeline.routingIds.resize(client + 1);
+            pipeline.policies.resize(client + 1, d_config.slowConsumerPolicy);
+        }
+        if (send.routingId.size() > 0) {
+            pipeline.routingIds[client] = send.routingId.to_string();
+        }
+        pipeline.policies[client] = send.policy;
+
+        if (!d_outbound.push(client, std::move(send.payload), now, send.policy, send.kind)) {
+            disconnectSlowClient(client);
+        }
+    }
+
+    flushOutbound();
+
+    // the logic thread takes them out of their rooms, whatever does not fit waits for the next pass
+    std::size_t handed = 0;
+    while (handed < pipeline.slowPending.size() && pipeline.slowClients.tryPush(pipeline.slowPending[handed])) {
+        ++handed;
+    }
+    if (handed > 0) {
+        pipeline.slowPending.erase(pipeline.slowPending.begin(), pipeline.slowPending.begin() + handed);
+        pipeline.logicBell.ring(pipeline.ioRinger);
+    }
+}
+
+void Server::stopPipeline() {
+    auto& pipeline = *d_pipeline;
+    const auto decoderCount = pipeline.decoders.size();
+
+    // a batch held back is dropped along with what is still on the socket
+    pipeline.held.reset();
+
+    // in the order the logic thread takes batches in, so it sees the stop markers after the last batch
+    for (std::size_t i = 0; i < decoderCount; ++i) {
+        auto& decoder = *pipeline.decoders[(pipeline.nextDecoder + i) % decoderCount];
+        std::unique_ptr<ReceivedBatch> stop;
+        while (!decoder.in.tryPush(stop)) {
+            // the logic thread may need its sends taken before it can take more batches
+            pumpPipelineSends();
+            std::this_thread::yield();
+        }
+    }
+
+    zmq::pollitem_t items[] = {
+        {pipeline.ioBell.socket().handle(), 0, ZMQ_POLLIN, 0}
+    };
+    while (!pipeline.logicDone) {
+        pipeline.ioBell.prepareSleep();
+        if (!pipeline.logicDone && pipeline.sends.empty()) {
+            zmq::poll(items, 1, s_pollTimeout);
+        }
+        pipeline.ioBell.woke();
+        pumpPipelineSends();
+    }
+
+    for (auto& decoder : pipeline.decoders) {
+        decoder->thread.join();
+    }
+    pipeline.logicThread.join();
+
+    // whatever the logic thread sent last
+    pumpPipelineSends();
+}
+
+void Server::handToIo(ClientHandle client, zmq::message_t&& payload, OutboundKind kind) {
+    auto& pipeline = *d_pipeline;
+
+    PipelineSend send{client, policyFor(client), kind, {}, std::move(payload)};
+    if (client >= pipeline.routingIdSent.size()) {
+        pipeline.routingIdSent.resize(client + 1, false);
+    }
+    if (!pipeline.routingIdSent[client]) {
+        send.routingId = zmq::message_t(d_clients.name(client));
+        pipeline.routingIdSent[client] = true;
+    }
+
+    while (!pipeline.sends.tryPush(send)) {
+        // the I/O thread is behind on writing, make sure it is awake to catch up
+        pipeline.ioBell.ring(pipeline.logicRinger);
+        pipeline.sends.waitNotFull();
+    }
+}
@@ -1,104 +1,545 @@
 #pragma once
 
-#include "messaging.h"
+#include "messaging_view.h"
+#include "roomshard.h"
+#include "workqueue.h"
+#include "messagelog.h"
+#include "registry.h"
+#include "directhistory.h"
+#include "timerwheel.h"
+#include "outboundqueue.h"
+#include "ratelimiter.h"
+#include "metrics.h"
+#include "hashring.h"
+#include "batcharena.h"
+#include "spscring.h"
+#include "doorbell.h"
 
+#include <mutex>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <string>
+#include <thread>
+#include <vector>
+#include <memory>
 #include <zmq.hpp>
 #include <optional>
-#include <unordered_set>
+#include <string_view>
 #include <unordered_map>
+#include <initializer_list>
 
-// a struct to hold client data
+// a client's node when it is connected to this one
+inline constexpr std::uint32_t k_localNode = UINT32_MAX;
+
+// a struct to hold client data, indexed by ClientHandle, the rooms a client is in are in Server::d_membership
 struct Client {
-    std::string room;
+    // the cluster node the client is connected through, for clients in one of
+    // our rooms (or that we have heard are connected) that are connected to another node
+    std::uint32_t node = k_localNode;
+    // connected to us and the other nodes have been told so, see Server::markLocal
+    bool announced = false;
+    // the rooms we took the client out of when its session expired, told again in answer to its next heartbeat
+    std::vector<RoomHandle> expiredRooms;
 };
 
-struct Room {
-    std::unordered_set<std::string> clients;
-    std::vector<ServerChatMessage> history;
+struct ServerConfig {
+    // 0 runs everything on the thread calling run(), otherwise the rooms are
+    // sharded across this many worker threads and run() only does I/O
+    std::size_t workerThreads = 0;
+
+    // retention for rooms created without their own limits (including client created rooms)
+    HistoryRetention history;
+
+    // how many of the most recent messages a join response carries
+    std::size_t joinHistoryTail = 50;
+
+    // direct messages kept per pair of clients, paged through with ClientDirectHistoryRequest.
+    // 0 messages keeps none, direct messages are then only delivered
+    HistoryRetention directHistory{100, 64 << 10};
+    // conversations whose direct history is kept, the least recently active one is dropped for a new one
+    std::size_t directConversations = 10000;
+
+    // durable room log, rooms found in it are restored on startup
+    MessageLogConfig log;
+
+    // most messages drained from the socket per pass of the receive loop before
+    // they are dispatched and the resulting sends flushed
+    std::size_t receiveBatchSize = 64;
+
+    // 0 receives, decodes and dispatches on the thread calling run(). Otherwise run() only moves
+    // bytes between the socket and a pipeline: this many decoder threads decode the batches it
+    // reads, one logic thread owns the clients and rooms and dispatches them in the order they were
+    // read (the rooms themselves still run on the workers with workerThreads), and what the logic
+    // thread sends is handed back to run() to write out
+    std::size_t decoderThreads = 0;
+    // batches each decoder can have waiting on either side of it before the stage feeding it waits
+    std::size_t pipelineDepth = 16;
+
+    // clients that send nothing (not even a heartbeat) for this long are removed from their room, 0 disables
+    std::chrono::milliseconds sessionTimeout{10000};
+
+    // per client send queue limits, see OutboundQueues
+    OutboundQueueConfig outbound;
+
+    // per client limits on what it may send, see RateLimiter (off by default)
+    RateLimitConfig rateLimit;
+
+    // what happens to slow consumers in rooms created without their own policy
+    SlowConsumerPolicy slowConsumerPolicy = SlowConsumerPolicy::e_DROP_OLDEST;
+    // per room policies by room id, for rooms created by clients or restored from the log too.
+    // In a cluster every node needs the same map, it is what a node uses for rooms it does not own
+    std::unordered_map<std::string, SlowConsumerPolicy> roomPolicies;
+
+    // PUB endpoint room chat is published on (topic = room id), members subscribe to their
+    // room and zmq does the fan-out. Empty sends chat to each member over the ROUTER socket.
+    // Published chat bypasses the per client outbound queues, a subscriber that falls
+    // behind loses messages at the PUB high-water mark and catches up by sequence
+    std::string publishAddress;
+
+    // multi-process cluster: every node's internal address (bound by that node, connected to by
+    // the others), the same list in the same order on every node. Rooms are owned by the node the
+    // consistent hash ring picks for them, clients can connect to any node and reach rooms owned
+    // elsewhere through it. Empty runs standalone. The list is fixed while the nodes run, see
+    // rebalanceLogs for adding a node
+    std::vector<std::string> clusterNodes;
+    // this node's index in clusterNodes
+    std::size_t clusterSelf = 0;
+
+    // REP endpoint answering every request with a JSON snapshot of the server's metrics, empty disables
+    std::string statsAddress;
 };
 
 class Server{
 
 public:
-    Server(const std::string& address);
+    Server(const std::string& address, const ServerConfig& config = ServerConfig{});
+
+    ~Server();
 
     void run();
 
+    // makes run() return, safe to call from any thread
+    void stop();
+
+    // in a cluster, only the node owning the room creates it
     void createRoom(const std::string& room_id);
 
+    void createRoom(const std::string& room_id, const HistoryRetention& retention);
+
+    // policy overrides roomPolicies, but only on this node
+    void createRoom(const std::string& room_id, const HistoryRetention& retention, SlowConsumerPolicy policy);
+
+    bool hasRoom(const std::string& room_id) const;
+
+    // outbound queue depth and drop counts for every client seen so far,
+    // only safe to call from the thread running run() or once it has returned
+    std::vector<std::pair<std::string, OutboundQueues::Stats>> outboundQueueStats() const;
+
     private:
+    // a worker thread and the shard of rooms it exclusively owns
+    struct Worker {
+        Worker(zmq::context_t& context, const std::string& outboundAddr, MessageLog* log);
+
+        void enablePublishing(const std::string& address);
+
+        zmq::socket_t pushSocket; // hands encoded replies back to the I/O thread
+        RoomShard shard;
+        WorkQueue<RoomTask> queue;
+        std::thread thread;
+    };
+
+    static const std::string s_outboundAddr;
+    static const std::chrono::milliseconds s_pollTimeout;
+    static const std::size_t s_timerWheelSlots;
+    static const std::chrono::milliseconds s_statsInterval;
+    static const std::size_t s_statsDeepestQueues;
+    static const std::string s_ioBellAddr;
+    static const std::string s_logicBellAddr;
+    static const std::size_t s_pipelineSends;
+    static const std::chrono::milliseconds s_pipelineRetry;
+
+    // first frame of every message between cluster nodes, tag is one of
+    // 'C' [client message]             a client's message for a room the receiver owns
+    // 'L' [client id][room id]         a client left a room the receiver owns
+    // 'D' [client ids][chat][payload]  deliver payload to each '\0' separated client connected to the receiver,
+    //                                  chat is 1 if it is room chat (OutboundKind::e_CHAT)
+    // 'R' [client id][room id][joined] a client connected to the receiver joined or left one of the sender's rooms
+    // 'H' [client id]                  a client is connected to the sender, so direct messages can reach it
+    struct PeerHeader {
+        std::uint32_t from;
+        char tag;
+    };
+
+    // a send for a client connected to another node, until flushPeerSends
+    struct PeerSend {
+        ClientHandle client;
+        OutboundKind kind;
+        zmq::message_t payload;
+    };
+
+    // first frame of a worker's reply to the I/O thread, an invalid client means it is to be published
+    struct OutboundHeader {
+        ClientHandle client;
+        OutboundKind kind;
+    };
+
+    struct ReceivedMessage {
+        zmq::message_t id;
+        zmq::message_t msg;
+        std::chrono::steady_clock::time_point receivedAt;
+    };
+
+    // read off the socket together and decoded together
+    struct ReceivedBatch {
+        std::vector<ReceivedMessage> raw;
+        // decoded message (borrowing from the raw one) and its index in raw
+        std::vector<std::pair<ClientBaseMessageView, std::size_t>> decoded;
+    };
+
+    // a send the logic thread hands to the I/O thread when pipelined
+    struct PipelineSend {
+        ClientHandle client = k_invalidHandle;
+        SlowConsumerPolicy policy = SlowConsumerPolicy::e_DROP_OLDEST;
+        OutboundKind kind = OutboundKind::e_CONTROL;
+        zmq::message_t routingId; // only on the client's first send, the I/O thread keeps it
+        zmq::message_t payload;
+    };
+
+    // a decoder thread and the rings on either side of it
+    struct Decoder {
+        Decoder(zmq::context_t& context, const Doorbell& logicBell, std::size_t depth);
+
+        SpscRing<std::unique_ptr<ReceivedBatch>> in;  // from the I/O thread, null asks it to stop
+        SpscRing<std::unique_ptr<ReceivedBatch>> out; // to the logic thread, the null is passed on
+        zmq::socket_t logicRinger;
+        std::thread thread;
+    };
+
+    // the stages run() hands work to when decoderThreads is set. Every ring has one producer and
+    // one consumer thread, and the logic thread is the only one touching clients and rooms
+    struct Pipeline {
+        Pipeline(zmq::context_t& context, std::size_t decoderCount, std::size_t depth);
+
+        Doorbell ioBell;
+        Doorbell logicBell;
+        // batches go to them round robin and are taken back in the same order, so they are
+        // dispatched in the order they were read
+        std::vector<std::unique_ptr<Decoder>> decoders;
+        SpscRing<std::unique_ptr<ReceivedBatch>> spent; // logic -> I/O, dispatched batches to read into again
+        SpscRing<PipelineSend> sends;                   // logic -> I/O
+        SpscRing<ClientHandle> slowClients;             // I/O -> logic, to be removed from their rooms
+        zmq::socket_t ioRinger;    // the I/O thread ringing logicBell
+        zmq::socket_t logicRinger; // the logic thread ringing ioBell
+        std::thread logicThread;
+        std::atomic_bool logicDone{false};
+
+        // owned by the I/O thread
+        std::unique_ptr<ReceivedBatch> reading; // being read into
+        std::unique_ptr<ReceivedBatch> held;    // read, but the next decoder's ring was full
+        std::size_t nextDecoder = 0;
+        std::vector<std::string> routingIds;        // indexed by ClientHandle, its copy of d_clients
+        std::vector<SlowConsumerPolicy> policies;   // indexed by ClientHandle, as of the last send
+        std::vector<ClientHandle> slowPending;      // not handed over yet, slowClients was full
+
+        // owned by the logic thread
+        std::vector<bool> routingIdSent; // indexed by ClientHandle
+    };
+
+    // what the I/O thread last copied out of d_outbound for the stats thread
+    struct OutboundSnapshot {
+        std::uint64_t queued = 0;
+        std::uint64_t dropped = 0;
+        std::vector<std::pair<std::string, std::size_t>> deepest;
+    };
+
+    ServerConfig d_config;
+
     zmq::context_t context;
     zmq::socket_t routerSocket;
-    // holds the all the client_ids
-    std::unordered_set<std::string> d_clients;
-    std::unordered_map<std::string, Client> d_clientData;
+    zmq::socket_t d_outboundSocket;
+    zmq::socket_t d_publishSocket;
+
+    // cluster links, messages from peers arrive on d_peerInbound, d_peerLinks[n] goes to node n
+    std::unique_ptr<HashRing> d_ring;
+    std::uint32_t d_self;
+    zmq::socket_t d_peerInbound;
+    std::vector<zmq::socket_t> d_peerLinks;
+    std::vector<std::vector<PeerSend>> d_peerSends; // per node, until flushSends
+    std::vector<std::uint32_t> d_roomOwners; // indexed by RoomHandle, filled in by ownerOf
 
-    std::unordered_map<std::string, Room> d_rooms;
+    // every client id we have seen, interned once when they first connect
+    IdRegistry d_clients;
+    std::vector<Client> d_clientData;
+    // which rooms each client is in (in a cluster, also the rooms on other nodes our clients are in)
+    Membership d_membership;
+    // recent direct messages of every pair of clients, in a cluster each pair's conversation lives on
+    // the node the ring picks for the pair
+    DirectHistories d_directHistories;
+
+    // session liveness, one tick per poll timeout
+    TimerWheel d_sessionTimers;
+    std::chrono::steady_clock::time_point d_startTime;
+
+    // every room that exists, the room itself lives in the shard that owns it
+    // (in a cluster, also the rooms on other nodes our clients are in)
+    IdRegistry d_roomIds;
+    std::vector<SlowConsumerPolicy> d_roomPolicies; // indexed by RoomHandle
+
+    std::unique_ptr<MessageLog> d_log;
+
+    std::atomic_bool d_running;
+
+    // receive loop buffers, reused across passes
+    ReceivedBatch d_received;
+
+    // only when pipelined, see ServerConfig::decoderThreads
+    std::unique_ptr<Pipeline> d_pipeline;
+
+    // scratch for one pass of the run loop, see taskResource
+    BatchArena d_arena;
+
+    // checked for every decoded message before it is routed or dispatched
+    RateLimiter d_rateLimiter;
+
+    // everything sent to clients goes through here
+    OutboundQueues d_outbound;
+    std::vector<ClientHandle> d_slowClients;
+
+    // used when running single threaded
+    std::unique_ptr<RoomShard> d_localShard;
+    std::vector<std::unique_ptr<Worker>> d_workers;
+
+    // stats endpoint, the socket is only used by d_statsThread which only ever reads
+    // atomics or takes d_statsMutex, so it can never stall the main loop
+    ServerMetrics d_metrics;
+    zmq::socket_t d_statsSocket;
+    std::thread d_statsThread;
+    std::atomic_bool d_statsDone;
+    std::mutex d_statsMutex;
+    OutboundSnapshot d_outboundSnapshot; // guarded by d_statsMutex
+    std::chrono::steady_clock::time_point d_lastOutboundSnapshot;
 
     // BUSINESS LOGIC FUNCTIONS
 
-    void handleClientChatMessage(const ClientBaseMessage& message);
+    void dispatch(const ClientBaseMessageView& message, std::chrono::steady_clock::time_point receivedAt);
+
+    // client is the sender's handle, if they have been seen before
 
-    void handleClientConnectionRequest(const ClientBaseMessage& message);
+    void handleClientChatMessage(const ClientBaseMessageView& message, std::optional<ClientHandle> client);
 
-    void handleClientCreateRoomRequest(const ClientBaseMessage& message);
+    void handleClientConnectionRequest(const ClientBaseMessageView& message, std::optional<ClientHandle> client);
+
+    void handleClientCreateRoomRequest(const ClientBaseMessageView& message, std::optional<ClientHandle> client);
+
+    void handleClientHistoryRequest(const ClientBaseMessageView& message, std::optional<ClientHandle> client);
+
+    void handleClientHistoryRangeRequest(const ClientBaseMessageView& message, std::optional<ClientHandle> client);
+
+    void handleClientSearchRequest(const ClientBaseMessageView& message, std::optional<ClientHandle> client);
+
+    void handleClientLeaveRoomRequest(const ClientBaseMessageView& message, std::optional<ClientHandle> client);
+
+    // goes straight to the target, no room or shard is involved
+    void handleClientDirectMessage(const ClientBaseMessageView& message, std::optional<ClientHandle> client);
+
+    void handleClientDirectHistoryRequest(const ClientBaseMessageView& message, std::optional<ClientHandle> client);
+
+    // interns a new room and records its slow consumer policy
+    RoomHandle registerRoom(std::string_view room_id, SlowConsumerPolicy policy);
+    // the room's policy in roomPolicies, or the default one
+    SlowConsumerPolicy configuredPolicy(std::string_view room_id) const;
+
+    // hands the task to the shard owning task.roomId (runs it inline when single threaded)
+    void dispatchToShard(RoomTask&& task);
+
+    // where a handler builds its task's strings: the batch arena when the task is run inline,
+    // the heap when a worker thread runs it after the batch is gone
+    std::pmr::memory_resource* taskResource();
+
+    void runWorker(Worker& worker);
+
+    // returns the client's handle, creating it if this is the first time we see them
+    ClientHandle internClient(std::string_view client_id);
+
+    std::uint64_t currentTick() const;
+
+    // removes clients whose session timed out from every room they are in
+    void expireSessions();
+
+    // drops what is queued for the client and removes them from every room they are in, see endSession
+    void disconnectSlowClient(ClientHandle client);
+
+    // removes the client from every room they are in and sends them a ServerSessionExpired for them
+    void endSession(ClientHandle client, std::string_view reason);
+    // the ServerSessionExpired for the client's expiredRooms it has not joined again since
+    void sendSessionExpired(ClientHandle client, std::string_view reason);
+
+    void runStats();
+
+    // the JSON reply of the stats endpoint, called on the stats thread
+    std::string statsJson();
+
+    // copies the outbound queue state for the stats thread at most once per s_statsInterval
+    void snapshotOutbound();
+
+    // CLUSTER FUNCTIONS
+
+    // node owning the room
+    std::uint32_t ownerOf(RoomHandle room);
+
+    bool isRemoteRoom(RoomHandle room);
+
+    // forwards a heartbeat to every other node owning one of the client's rooms, so none of them
+    // times the client out
+    void forwardHeartbeat(ClientHandle client, const zmq::message_t& raw);
+
+    // forwards a client's message to the node owning the room it is about, returns false if that is us
+    bool routeToOwner(const ClientBaseMessageView& message, const zmq::message_t& raw);
+
+    // the client is connected to us, the first time (since it was last elsewhere) every other node is
+    // told with an 'H' so whichever node owns one of its direct conversations can deliver to it
+    void markLocal(ClientHandle client);
+
+    // tells a remote client's node it joined or left one of our rooms
+    void notifyClientNode(ClientHandle client, RoomHandle room, bool joined);
+
+    // sends [header][frames...][payload], payload (if any) goes out without being copied.
+    // Peers that are down or far behind lose messages instead of stalling us
+    void sendToPeer(std::uint32_t node, char tag, std::initializer_list<std::string_view> frames,
+                    zmq::message_t* payload = nullptr);
+    void receivePeers();
+    void handlePeerMessage(const PeerHeader& header, std::vector<zmq::message_t>& frames);
+    // sends what the rooms queued for remote clients, one 'D' per broadcast per node
+    void flushPeerSends();
 
     // NETWORKING FUNCTIONS
 
-    void broadcastNewConnection(const std::string& id);
-    void sendConnectionResponse(const std::string& id, bool accepted, const std::optional<std::string>& reason, const std::vector<ServerChatMessage>& history);
-    void sendCreateRoomResponse(const std::string& id, bool accepted, const std::optional<std::string>& reason);
+    void forwardOutbound();
 
-    std::optional<ClientBaseMessage> receiveMessage();
-    void broadcastMessage(const ServerChatMessage& message);
+    // drains up to receiveBatchSize messages without blocking, then dispatches them
+    void receiveBatch();
 
-    // INLINE FUNCTIONS
+    // the three steps of receiveBatch(), which the pipeline runs on different threads
+    void readBatch(ReceivedBatch& batch);
+    void decodeBatch(ReceivedBatch& batch);
+    // dispatches and empties the batch
+    void processBatch(ReceivedBatch& batch);
+
+    // false if the sender is over its rate and the message has to be dropped, the sender is told
+    // with a ServerRateLimited now and then
+    bool admitMessage(const ClientBaseMessageView& message, const ReceivedMessage& raw);
+
+    // queues a send, nothing goes out until flushSends(). Only e_CHAT sends can be dropped for a slow client
+    void sendToClient(ClientHandle client, zmq::message_t&& payload, OutboundKind kind = OutboundKind::e_CONTROL);
+    // publishes straight away, PUB sockets never block
+    void publish(const std::string& topic, zmq::message_t&& payload);
+    // writes out queued sends until the socket would block on each client
+    void flushSends();
+    // the part of flushSends() writing to our own clients, on the I/O thread when pipelined
+    void flushOutbound();
+    OutboundQueues::SendResult trySend(ClientHandle client, zmq::message_t& payload);
+    void sendConnectionResponse(ClientHandle client, std::string_view room_id, bool accepted,
+                                const std::optional<std::string>& reason);
+    void sendCreateRoomResponse(ClientHandle client, std::string_view room_id, bool accepted,
+                                const std::optional<std::string>& reason);
+
+    // the result borrows from msg
+    std::optional<ClientBaseMessageView> decodeMessage(const zmq::message_t& id, const zmq::message_t& msg);
+
+    // the client's id on the router socket, from the thread writing to it
+    const std::string& routingIdOf(ClientHandle client) const;
+
+    // PIPELINE FUNCTIONS, see ServerConfig::decoderThreads
 
-    // checks client exists in d_clients and d_clientData and is in a valid room
-    bool isClientValid(const std::string& client_id);
+    // run() when pipelined, the I/O thread
+    void runPipelined();
+    void runDecoder(Decoder& decoder);
+    void runLogic();
 
-    bool validRoomId(const std::string& room_id);
+    // I/O thread: reads batches and hands them to the decoders until the socket is empty or the
+    // next decoder is full
+    void readIntoPipeline();
+    // I/O thread: queues what the logic thread sent, writes it out and passes slow clients back
+    void pumpPipelineSends();
+    // I/O thread: stops the decoders and the logic thread, sending what they still send until they are done
+    void stopPipeline();
+
+    // logic thread: sendToClient() for a client connected to us
+    void handToIo(ClientHandle client, zmq::message_t&& payload, OutboundKind kind);
+
+    // INLINE FUNCTIONS
+
+    bool validRoomId(std::string_view room_id);
     
-    bool isClientInRoom(const std::string& client_id, const std::string& room_id);
+    bool isClientInRoom(ClientHandle client, RoomHandle room);
+
+    // sends the client the room's history (again, if it is already in the room), lastSequence is
+    // set when the client is resuming the room
+    void addClientToRoom(ClientHandle client, RoomHandle room, std::optional<std::uint64_t> lastSequence = std::nullopt);
+
+    void removeClientFromRoom(ClientHandle client, RoomHandle room);
 
-    void addClientToRoom(const std::string& client_id, const std::string& room_id);
+    void removeClientFromAllRooms(ClientHandle client);
 
-    void removeClientFromRoom(const std::string& client_id, const std::string& room_id);
+    // a client in several rooms follows the strictest of their policies, its queue is shared by all of them
+    SlowConsumerPolicy policyFor(ClientHandle client);
 };
 
 inline
-bool Server::isClientValid(const std::string& client_id) {
-    return d_clients.contains(client_id) && d_clientData.contains(client_id) && 
-           validRoomId(d_clientData[client_id].room);
+bool Server::validRoomId(std::string_view room_id) {
+    return d_roomIds.find(room_id).has_value();
 }
 
 inline
-bool Server::validRoomId(const std::string& room_id) {
-    return d_rooms.contains(room_id);
+bool Server::isClientInRoom(ClientHandle client, RoomHandle room) {
+    return d_membership.contains(client, room);
 }
 
-inline
-bool Server::isClientInRoom(const std::string& client_id, const std::string& room_id) {
-    if (!d_rooms.contains(room_id)) {
-        return false;
+inline 
+void Server::addClientToRoom(ClientHandle client, RoomHandle room, std::optional<std::uint64_t> lastSequence) {
+    if (d_membership.join(client, room) && d_clientData[client].node != k_localNode) {
+        notifyClientNode(client, room, true);
     }
-    return d_rooms[room_id].clients.contains(client_id);
+    RoomTask task{RoomTask::Type::e_JOIN, client, room};
+    task.count = d_config.joinHistoryTail;
+    task.lastSequence = lastSequence;
+    dispatchToShard(std::move(task));
 }
 
-inline 
-void Server::addClientToRoom(const std::string& client_id, const std::string& room_id) {
-    // remove client from room if already in one
-    if (d_clientData[client_id].room != "") {
-        removeClientFromRoom(client_id, d_clientData[client_id].room);
+inline
+void Server::removeClientFromRoom(ClientHandle client, RoomHandle room) {
+    if (!d_membership.leave(client, room)) {
+        return;
+    }
+    if (isRemoteRoom(room)) {
+        sendToPeer(ownerOf(room), 'L', {d_clients.name(client), d_roomIds.name(room)});
+        return;
+    }
+    if (d_clientData[client].node != k_localNode) {
+        notifyClientNode(client, room, false);
     }
+    dispatchToShard(RoomTask{RoomTask::Type::e_LEAVE, client, room});
+}
 
-    d_clientData[client_id].room = room_id;
-    d_rooms[room_id].clients.insert(client_id);
+inline
+void Server::removeClientFromAllRooms(ClientHandle client) {
+    // leaving changes the list, so take the rooms from the back
+    const auto& rooms = d_membership.roomsOf(client);
+    while (!rooms.empty()) {
+        removeClientFromRoom(client, rooms.back());
+    }
 }
 
 inline
-void Server::removeClientFromRoom(const std::string& client_id, const std::string& room_id) {
-    d_clientData[client_id].room = "";
-    d_rooms[room_id].clients.erase(client_id);
-}
\ No newline at end of file
+SlowConsumerPolicy Server::policyFor(ClientHandle client) {
+    const auto& rooms = d_membership.roomsOf(client);
+    if (rooms.empty()) {
+        return d_config.slowConsumerPolicy;
+    }
+    auto policy = SlowConsumerPolicy::e_DROP_OLDEST;
+    for (auto room : rooms) {
+        policy = std::max(policy, room < d_roomPolicies.size() ? d_roomPolicies[room] : d_config.slowConsumerPolicy);
+    }
+    return policy;
+}
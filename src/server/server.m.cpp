@@ -1,10 +1,99 @@
 #include "server.h"
+#include "logging.h"
+#include "rebalance.h"
 #include "spdlog/spdlog.h"
 
 #include <iostream>
 #include <string>
+#include <sstream>
 #include <zmq.hpp>
 
+/*
+Usage: ./server [--threads <n>] [--history-messages <n>] [--history-bytes <n>] [--join-history <n>] [--dm-history <n>] [--dm-conversations <n>] [--log-dir <path>] [--batch <n>] [--session-timeout <ms>]
+                [--decoders <n>] [--pipeline-depth <n>]
+                [--client-hwm <n>] [--client-max-age <ms>] [--slow-policy <drop-oldest|conflate|disconnect>]
+                [--room-policy <room=policy,...>]
+                [--rate-messages <n>] [--rate-bytes <n>] [--rate-burst <s>] [--rate-notice <on|off>]
+                [--stats <address>] [--publish <address>] [--address <address>] [--cluster <address,address,...> --node <n>]
+                [--cluster <address,address,...> --rebalance <log dir,log dir,...>]
+                [--log-mode <async|sync>] [--log-queue <n>] [--log-overflow <block|drop-oldest|drop-new>]
+                [--log-sample <category=n,...>] [--log-rate <category=n,...>]
+
+--threads           number of worker threads to shard rooms across (default 0, single threaded)
+--history-messages  max messages of history kept per room (default 1000)
+--history-bytes     max bytes of history kept per room (default 1MiB)
+--join-history      messages of history sent with a join, older pages are fetched on demand (default 50)
+--dm-history        direct messages kept per pair of clients, 0 keeps none (default 100)
+--dm-conversations  pairs of clients whose direct history is kept, the least recently active pair goes first (default 10000)
+--log-dir           directory for the durable room log, rooms in it are restored on startup (default off)
+--batch             most messages drained from the socket before dispatching and flushing sends (default 64)
+--decoders          pipeline the server: n threads decode, one thread runs the clients and rooms, the calling thread only does I/O (default 0, off)
+--pipeline-depth    batches queued on either side of each decoder before the stage feeding it waits (default 16)
+--session-timeout   silent clients are removed from their room after this long, 0 disables (default 10000)
+--client-hwm        messages queued for one client before it is treated as a slow consumer (default 1000)
+--client-max-age    age of a client's oldest queued message before it is treated as a slow consumer (default 5000)
+--slow-policy       what happens to slow consumers: drop-oldest, conflate or disconnect (default drop-oldest)
+--room-policy       slow consumer policy of particular rooms, e.g. general=conflate,trades=disconnect. A client in
+                    several rooms gets the strictest of their policies (disconnect, then conflate, then drop-oldest)
+--rate-messages     messages a second one client may send, more are dropped on arrival, 0 is unlimited (default 0)
+--rate-bytes        bytes a second one client may send, 0 is unlimited (default 0)
+--rate-burst        seconds worth of its rate a client may send at once (default 2)
+--rate-notice       tell a client its messages are being dropped for going over its rate: on or off (default on)
+--publish           PUB endpoint room chat is published on instead of sent to each member, e.g. tcp://0.0.0.0:8887 (default off)
+--stats             REP endpoint that answers any request with a JSON metrics snapshot, e.g. tcp://127.0.0.1:8889 (default off)
+--address           endpoint clients connect to (default tcp://0.0.0.0:8888)
+--cluster           internal endpoint of every node in the cluster, the same list on every node (default off, standalone)
+--node              index of this node in the --cluster list
+--rebalance         with every node stopped, moves each room's log to the log directory (one per node, in --cluster
+                    order) of the node owning it under the --cluster list, then exits. Nodes cannot join a running
+                    cluster, adding one is: stop the nodes, rebalance with the new list, start them with it
+--log-mode          async writes log records from a background thread, sync from the logging thread (default async)
+--log-queue         records the async log queue holds (default 8192)
+--log-overflow      what happens to a record when the async queue is full: block, drop-oldest or drop-new (default drop-new)
+--log-sample        log 1 in n records of a category (chat, session), 0 logs none, e.g. chat=100 (default 1 for all)
+--log-rate          log at most n records a second of a category, e.g. chat=50,session=200 (default unlimited)
+
+Warnings and errors are never sampled.
+*/
+
+namespace {
+
+// parses "room=policy,room=policy" into config.roomPolicies
+void parseRoomPolicies(const std::string& arg, ServerConfig& config) {
+    std::stringstream entries(arg);
+    std::string entry;
+    while (std::getline(entries, entry, ',')) {
+        auto split = entry.find('=');
+        if (split == std::string::npos) {
+            spdlog::warn("Missing slow consumer policy in: {}", entry);
+            continue;
+        }
+        auto policy = slowConsumerPolicyFromName(std::string_view(entry).substr(split + 1));
+        if (!policy.has_value()) {
+            spdlog::warn("Unknown slow consumer policy in: {}", entry);
+            continue;
+        }
+        config.roomPolicies[entry.substr(0, split)] = *policy;
+    }
+}
+
+// parses "category=n,category=n" into field of the categories' sampling
+void parseSampling(const std::string& arg, std::size_t LogSampling::*field, LogConfig& config) {
+    std::stringstream entries(arg);
+    std::string entry;
+    while (std::getline(entries, entry, ',')) {
+        auto split = entry.find('=');
+        auto category = logCategoryFromName(std::string_view(entry).substr(0, split));
+        if (split == std::string::npos || !category.has_value()) {
+            spdlog::warn("Unknown log category in: {}", entry);
+            continue;
+        }
+        config.sampling[static_cast<std::size_t>(*category)].*field = std::stoul(entry.substr(split + 1));
+    }
+}
+
+} // namespace
+
 int main(int argc, const char *argv[]){
 
     // set the log level to debug (globally)
@@ -12,10 +101,117 @@ int main(int argc, const char *argv[]){
 
     spdlog::info("server.m is running");
 
-    Server server("tcp://*:8888");
-    server.createRoom("general");
+    ServerConfig config;
+    LogConfig logConfig;
+    std::string address = "tcp://*:8888";
+    std::vector<std::string> rebalanceDirectories;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string flag = argv[i];
+        if (flag == "--threads") {
+            config.workerThreads = std::stoul(argv[i + 1]);
+        } else if (flag == "--history-messages") {
+            config.history.maxMessages = std::stoul(argv[i + 1]);
+        } else if (flag == "--history-bytes") {
+            config.history.maxBytes = std::stoul(argv[i + 1]);
+        } else if (flag == "--join-history") {
+            config.joinHistoryTail = std::stoul(argv[i + 1]);
+        } else if (flag == "--dm-history") {
+            config.directHistory.maxMessages = std::stoul(argv[i + 1]);
+        } else if (flag == "--dm-conversations") {
+            config.directConversations = std::stoul(argv[i + 1]);
+        } else if (flag == "--log-dir") {
+            config.log.directory = argv[i + 1];
+        } else if (flag == "--batch") {
+            config.receiveBatchSize = std::stoul(argv[i + 1]);
+        } else if (flag == "--decoders") {
+            config.decoderThreads = std::stoul(argv[i + 1]);
+        } else if (flag == "--pipeline-depth") {
+            config.pipelineDepth = std::stoul(argv[i + 1]);
+        } else if (flag == "--session-timeout") {
+            config.sessionTimeout = std::chrono::milliseconds(std::stoul(argv[i + 1]));
+        } else if (flag == "--client-hwm") {
+            config.outbound.highWaterMark = std::stoul(argv[i + 1]);
+        } else if (flag == "--client-max-age") {
+            config.outbound.maxAge = std::chrono::milliseconds(std::stoul(argv[i + 1]));
+        } else if (flag == "--slow-policy") {
+            auto policy = slowConsumerPolicyFromName(argv[i + 1]);
+            if (policy.has_value()) {
+                config.slowConsumerPolicy = *policy;
+            } else {
+                spdlog::warn("Unknown slow consumer policy: {}", argv[i + 1]);
+            }
+        } else if (flag == "--room-policy") {
+            parseRoomPolicies(argv[i + 1], config);
+        } else if (flag == "--rate-messages") {
+            config.rateLimit.messagesPerSecond = std::stod(argv[i + 1]);
+        } else if (flag == "--rate-bytes") {
+            config.rateLimit.bytesPerSecond = std::stod(argv[i + 1]);
+        } else if (flag == "--rate-burst") {
+            config.rateLimit.burstSeconds = std::stod(argv[i + 1]);
+        } else if (flag == "--rate-notice") {
+            config.rateLimit.notify = std::string(argv[i + 1]) != "off";
+        } else if (flag == "--publish") {
+            config.publishAddress = argv[i + 1];
+        } else if (flag == "--stats") {
+            config.statsAddress = argv[i + 1];
+        } else if (flag == "--address") {
+            address = argv[i + 1];
+        } else if (flag == "--cluster") {
+            std::stringstream nodes(argv[i + 1]);
+            std::string node;
+            while (std::getline(nodes, node, ',')) {
+                config.clusterNodes.push_back(node);
+            }
+        } else if (flag == "--node") {
+            config.clusterSelf = std::stoul(argv[i + 1]);
+        } else if (flag == "--rebalance") {
+            std::stringstream directories(argv[i + 1]);
+            std::string directory;
+            while (std::getline(directories, directory, ',')) {
+                rebalanceDirectories.push_back(directory);
+            }
+        } else if (flag == "--log-mode") {
+            logConfig.async = std::string(argv[i + 1]) != "sync";
+        } else if (flag == "--log-queue") {
+            logConfig.queueSize = std::stoul(argv[i + 1]);
+        } else if (flag == "--log-overflow") {
+            std::string overflow = argv[i + 1];
+            if (overflow == "block") {
+                logConfig.overflow = LogOverflow::e_BLOCK;
+            } else if (overflow == "drop-oldest") {
+                logConfig.overflow = LogOverflow::e_DROP_OLDEST;
+            } else if (overflow == "drop-new") {
+                logConfig.overflow = LogOverflow::e_DROP_NEW;
+            } else {
+                spdlog::warn("Unknown log overflow policy: {}", overflow);
+            }
+        } else if (flag == "--log-sample") {
+            parseSampling(argv[i + 1], &LogSampling::every, logConfig);
+        } else if (flag == "--log-rate") {
+            parseSampling(argv[i + 1], &LogSampling::perSecond, logConfig);
+        } else {
+            spdlog::warn("Unknown argument: {}", flag);
+        }
+    }
+
+    setupLogging(logConfig);
+
+    if (!rebalanceDirectories.empty()) {
+        auto stats = rebalanceLogs(config.clusterNodes, rebalanceDirectories);
+        spdlog::info("Rebalanced {} rooms across {} nodes, {} moved ({} bytes)",
+                     stats.rooms, config.clusterNodes.size(), stats.moved, stats.bytesMoved);
+        shutdownLogging();
+        return 0;
+    }
+
+    Server server(address, config);
+    // in a cluster this is a no-op on every node but the one owning it
+    if (!server.hasRoom("general")) {
+        server.createRoom("general");
+    }
 
     server.run();
 
+    shutdownLogging();
     return 0;
 }
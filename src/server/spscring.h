@@ -0,0 +1,113 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+#include <utility>
+
+// A bounded lock-free queue between exactly one producer thread and one
+// consumer thread, used to hand work between the stages of the pipelined
+// server. Slots are allocated up front and reused, so pushing and popping
+// never allocate or take a lock.
+//
+// The head (next to pop) and tail (next to push) only ever go up and each is
+// written by one side alone, the other side only reads it, and each side keeps
+// its last look at the other's index so it only touches the shared cache line
+// when it seems to have run out of room (or items).
+template <typename T>
+class SpscRing {
+
+public:
+    // capacity is rounded up to a power of two
+    explicit SpscRing(std::size_t capacity);
+
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    // producer only, moves from value unless the ring is full (then false and value is untouched)
+    bool tryPush(T& value);
+
+    // consumer only, false if the ring is empty
+    bool tryPop(T& value);
+
+    // consumer only
+    bool empty() const;
+
+    // consumer only, sleeps until the ring has something in it
+    void waitNotEmpty() const;
+
+    // producer only, sleeps until the ring has room
+    void waitNotFull() const;
+
+    private:
+    static constexpr std::size_t s_cacheLine = 64;
+
+    std::vector<T> d_slots;
+    std::size_t d_mask;
+
+    alignas(s_cacheLine) std::atomic<std::size_t> d_head{0};
+    std::size_t d_tailSeen = 0; // the consumer's last look at d_tail
+
+    alignas(s_cacheLine) std::atomic<std::size_t> d_tail{0};
+    std::size_t d_headSeen = 0; // the producer's last look at d_head
+};
+
+template <typename T>
+SpscRing<T>::SpscRing(std::size_t capacity)
+{
+    std::size_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    d_slots.resize(size);
+    d_mask = size - 1;
+}
+
+template <typename T>
+bool SpscRing<T>::tryPush(T& value) {
+    auto tail = d_tail.load(std::memory_order_relaxed);
+    if (tail - d_headSeen == d_slots.size()) {
+        d_headSeen = d_head.load(std::memory_order_acquire);
+        if (tail - d_headSeen == d_slots.size()) {
+            return false;
+        }
+    }
+
+    d_slots[tail & d_mask] = std::move(value);
+    d_tail.store(tail + 1, std::memory_order_release);
+    d_tail.notify_one();
+    return true;
+}
+
+template <typename T>
+bool SpscRing<T>::tryPop(T& value) {
+    auto head = d_head.load(std::memory_order_relaxed);
+    if (head == d_tailSeen) {
+        d_tailSeen = d_tail.load(std::memory_order_acquire);
+        if (head == d_tailSeen) {
+            return false;
+        }
+    }
+
+    value = std::move(d_slots[head & d_mask]);
+    d_head.store(head + 1, std::memory_order_release);
+    d_head.notify_one();
+    return true;
+}
+
+template <typename T>
+bool SpscRing<T>::empty() const {
+    return d_head.load(std::memory_order_relaxed) == d_tail.load(std::memory_order_acquire);
+}
+
+template <typename T>
+void SpscRing<T>::waitNotEmpty() const {
+    auto head = d_head.load(std::memory_order_relaxed);
+    d_tail.wait(head, std::memory_order_acquire);
+}
+
+template <typename T>
+void SpscRing<T>::waitNotFull() const {
+    auto tail = d_tail.load(std::memory_order_relaxed);
+    d_head.wait(tail - d_slots.size(), std::memory_order_acquire);
+}
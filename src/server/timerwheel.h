@@ -0,0 +1,121 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <utility>
+
+/*
+Hashed timer wheel for expiring ids (dense handles) that go quiet.
+
+Time is counted in ticks. touch() only records the id's new deadline, so
+refreshing a busy id is O(1) with no list manipulation. An id sits in the slot
+of the deadline it had when it was (re)scheduled; when that slot comes round,
+ids that were touched since are moved on to the slot of their new deadline and
+the rest expire. Advancing is O(1) per tick plus the ids in the slots passed.
+*/
+class TimerWheel {
+
+public:
+    using Id = std::uint32_t;
+
+    // timeoutTicks is how long an untouched id lives, slots should be at least that
+    TimerWheel(std::uint64_t timeoutTicks, std::size_t slots);
+
+    // (re)starts the id's timeout from now
+    void touch(Id id, std::uint64_t nowTick);
+
+    // stops tracking the id, it will not expire
+    void cancel(Id id);
+
+    // calls onExpired(id) for every id whose timeout is up as of nowTick
+    template <typename Callback>
+    void advance(std::uint64_t nowTick, Callback&& onExpired);
+
+    private:
+    struct Entry {
+        std::uint64_t deadline = 0;
+        std::uint32_t generation = 0;
+        bool scheduled = false;
+    };
+
+    // slot entries go stale when their id is cancelled, the generation tells them apart
+    struct SlotEntry {
+        Id id;
+        std::uint32_t generation;
+    };
+
+    std::uint64_t d_timeout;
+    std::uint64_t d_currentTick = 0;
+    std::vector<std::vector<SlotEntry>> d_slots;
+    std::vector<SlotEntry> d_expiring;
+    std::vector<Entry> d_entries;
+
+    void schedule(Id id, std::uint64_t deadline);
+};
+
+inline
+TimerWheel::TimerWheel(std::uint64_t timeoutTicks, std::size_t slots)
+: d_timeout(timeoutTicks)
+, d_slots(slots == 0 ? 1 : slots)
+{
+}
+
+inline
+void TimerWheel::touch(Id id, std::uint64_t nowTick) {
+    if (id >= d_entries.size()) {
+        d_entries.resize(id + 1);
+    }
+
+    auto& entry = d_entries[id];
+    entry.deadline = nowTick + d_timeout;
+    if (!entry.scheduled) {
+        entry.scheduled = true;
+        schedule(id, entry.deadline);
+    }
+}
+
+inline
+void TimerWheel::cancel(Id id) {
+    if (id < d_entries.size() && d_entries[id].scheduled) {
+        d_entries[id].scheduled = false;
+        ++d_entries[id].generation;
+    }
+}
+
+template <typename Callback>
+void TimerWheel::advance(std::uint64_t nowTick, Callback&& onExpired) {
+    while (d_currentTick < nowTick) {
+        ++d_currentTick;
+
+        // swap the slot out so rescheduling into it while we walk it is safe
+        auto& slot = d_slots[d_currentTick % d_slots.size()];
+        d_expiring.swap(slot);
+
+        for (auto [id, generation] : d_expiring) {
+            auto& entry = d_entries[id];
+            if (!entry.scheduled || entry.generation != generation) {
+                continue;
+            }
+
+            if (entry.deadline > d_currentTick) {
+                // touched since it was scheduled (or a later round of the wheel)
+                schedule(id, entry.deadline);
+                continue;
+            }
+
+            entry.scheduled = false;
+            ++entry.generation;
+            onExpired(id);
+        }
+        d_expiring.clear();
+    }
+}
+
+inline
+void TimerWheel::schedule(Id id, std::uint64_t deadline) {
+    // never schedule into the slot being walked right now
+    if (deadline <= d_currentTick) {
+        deadline = d_currentTick + 1;
+    }
+    d_slots[deadline % d_slots.size()].push_back(SlotEntry{id, d_entries[id].generation});
+}
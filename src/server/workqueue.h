@@ -0,0 +1,67 @@
+#pragma once
+
+#include <mutex>
+#include <vector>
+#include <condition_variable>
+
+// a blocking multi-producer queue used to hand work from the I/O thread to a worker thread
+template <typename T>
+class WorkQueue {
+
+public:
+    void push(T&& item);
+
+    // blocks until there is at least one item (or the queue is closed) and
+    // moves every pending item into out. Returns false once closed and empty.
+    bool popAll(std::vector<T>& out);
+
+    // moves every pending item into out without waiting, out is left empty if there are none
+    void tryPopAll(std::vector<T>& out);
+
+    // wakes up any waiting consumer, popAll will drain what is left then return false
+    void close();
+
+    private:
+    std::mutex d_mutex;
+    std::condition_variable d_cv;
+    std::vector<T> d_items;
+    bool d_closed = false;
+};
+
+template <typename T>
+void WorkQueue<T>::push(T&& item) {
+    {
+        std::lock_guard<std::mutex> lock(d_mutex);
+        d_items.push_back(std::move(item));
+    }
+    d_cv.notify_one();
+}
+
+template <typename T>
+bool WorkQueue<T>::popAll(std::vector<T>& out) {
+    std::unique_lock<std::mutex> lock(d_mutex);
+    d_cv.wait(lock, [this] { return d_closed || !d_items.empty(); });
+
+    if (d_items.empty()) {
+        return false;
+    }
+
+    // swap so neither side reallocates on the steady state
+    out.swap(d_items);
+    return true;
+}
+
+template <typename T>
+void WorkQueue<T>::tryPopAll(std::vector<T>& out) {
+    std::lock_guard<std::mutex> lock(d_mutex);
+    out.swap(d_items);
+}
+
+template <typename T>
+void WorkQueue<T>::close() {
+    {
+        std::lock_guard<std::mutex> lock(d_mutex);
+        d_closed = true;
+    }
+    d_cv.notify_all();
+}